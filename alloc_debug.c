@@ -0,0 +1,85 @@
+/*
+ *  Copyright 2016 Kendall E. Blake
+ *
+ *  This file is part of cairo-test.
+ *
+ *  cairo-test is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published
+ *  by the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  cairo-test is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with cairo-test.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <stddef.h>
+
+#include "alloc_debug.h"
+
+/* glibc's own allocator, under the names it keeps for interposers. */
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *p, size_t size);
+extern void *__libc_memalign(size_t alignment, size_t size);
+extern void  __libc_free(void *p);
+
+static _Thread_local struct alloc_count counted;
+
+static void tally(size_t size)
+{
+	counted.allocations++;
+	counted.bytes += size;
+}
+
+void alloc_debug_count(struct alloc_count *count)
+{
+	*count = counted;
+}
+
+void *malloc(size_t size)
+{
+	tally(size);
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t n, size_t size)
+{
+	tally(n * size);
+	return __libc_calloc(n, size);
+}
+
+void *realloc(void *p, size_t size)
+{
+	tally(size);
+	return __libc_realloc(p, size);
+}
+
+void *memalign(size_t alignment, size_t size)
+{
+	tally(size);
+	return __libc_memalign(alignment, size);
+}
+
+void *aligned_alloc(size_t alignment, size_t size)
+{
+	tally(size);
+	return __libc_memalign(alignment, size);
+}
+
+int posix_memalign(void **p, size_t alignment, size_t size)
+{
+	tally(size);
+	*p = __libc_memalign(alignment, size);
+	return *p ? 0 : ENOMEM;
+}
+
+void free(void *p)
+{
+	__libc_free(p);
+}
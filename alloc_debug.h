@@ -0,0 +1,35 @@
+#ifndef ALLOC_DEBUG_H
+#define ALLOC_DEBUG_H
+/*
+ *  Copyright 2016 Kendall E. Blake
+ *
+ *  This file is part of cairo-test.
+ *
+ *  cairo-test is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published
+ *  by the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  cairo-test is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with cairo-test.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Heap use counted by alloc_debug.c, which stands in front of the C
+ * library's malloc() and friends for everything in the program, cairo and
+ * SDL included.  Link it in (make ALLOC_DEBUG=1 does, for the game) to
+ * find out what a frame allocates. */
+struct alloc_count
+{
+	unsigned long      allocations;
+	unsigned long long bytes;
+};
+
+/* What the calling thread has allocated so far. */
+void alloc_debug_count(struct alloc_count *count);
+
+#endif
@@ -0,0 +1,111 @@
+/*
+ *  Copyright 2016 Kendall E. Blake
+ *
+ *  This file is part of cairo-test.
+ *
+ *  cairo-test is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published
+ *  by the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  cairo-test is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with cairo-test.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdalign.h>
+#include <stdlib.h>
+
+#include "arena.h"
+
+/* The smallest block worth asking the heap for. */
+#define ARENA_BLOCK 16384
+
+struct arena_block
+{
+	/* the block filled before this one */
+	/*@null@*/ struct arena_block *next;
+	size_t      size, used;
+	max_align_t data[];
+};
+
+static _Thread_local struct arena frame = ARENA_INIT;
+
+struct arena *frame_arena(void)
+{
+	return &frame;
+}
+
+void *arena_alloc(struct arena *arena, size_t size)
+{
+	struct arena_block *top = arena->top;
+	size_t want;
+	char  *p;
+
+	size = (size + alignof(max_align_t) - 1) & ~(alignof(max_align_t) - 1);
+	if (!top || top->size - top->used < size) {
+		want = size > ARENA_BLOCK ? size : ARENA_BLOCK;
+		if (!top && arena->peak > want)
+			want = arena->peak;
+		else if (top && 2 * top->size > want)
+			want = 2 * top->size;
+		top = malloc(sizeof *top + want);
+		if (!top)
+			return NULL;
+		top->next = arena->top;
+		top->size = want;
+		top->used = 0;
+		arena->top = top;
+	}
+	p = (char *)top->data + top->used;
+	top->used += size;
+	arena->in_use += size;
+	if (arena->in_use > arena->peak)
+		arena->peak = arena->in_use;
+	return p;
+}
+
+struct arena_mark arena_mark(struct arena *arena)
+{
+	struct arena_mark mark = { arena->top, arena->top ? arena->top->used : 0, arena->in_use };
+
+	return mark;
+}
+
+void arena_rewind(struct arena *arena, struct arena_mark mark)
+{
+	while (arena->top && arena->top != mark.block) {
+		struct arena_block *block = arena->top;
+
+		/* emptied: the last block stays if it holds the most ever used */
+		if (!block->next && block->size >= arena->peak)
+			break;
+		arena->top = block->next;
+		free(block);
+	}
+	if (arena->top)
+		arena->top->used = mark.block ? mark.used : 0;
+	arena->in_use = mark.in_use;
+}
+
+void arena_reset(struct arena *arena)
+{
+	struct arena_mark empty = { NULL, 0, 0 };
+
+	arena_rewind(arena, empty);
+}
+
+void arena_release(struct arena *arena)
+{
+	while (arena->top) {
+		struct arena_block *block = arena->top;
+
+		arena->top = block->next;
+		free(block);
+	}
+	arena->in_use = arena->peak = 0;
+}
@@ -0,0 +1,59 @@
+#ifndef ARENA_H
+#define ARENA_H
+/*
+ *  Copyright 2016 Kendall E. Blake
+ *
+ *  This file is part of cairo-test.
+ *
+ *  cairo-test is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published
+ *  by the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  cairo-test is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with cairo-test.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stddef.h>
+
+/* Scratch memory handed out by bumping a pointer and taken back all at
+ * once.  An arena keeps its biggest block when it is emptied and, once
+ * it has seen the most it is ever asked to hold at one time, empties
+ * into a single block that big: from then on it allocates nothing. */
+struct arena_block;
+
+struct arena
+{
+	/*@null@*/ struct arena_block *top;
+	size_t in_use, peak;
+};
+
+/* Where an arena had got to, to go back to. */
+struct arena_mark
+{
+	/*@null@*/ struct arena_block *block;
+	size_t used, in_use;
+};
+
+#define ARENA_INIT { NULL, 0, 0 }
+
+/* size bytes aligned for anything, or NULL if they can't be had. */
+/*@null@*/
+void *arena_alloc(struct arena *arena, size_t size);
+struct arena_mark arena_mark(struct arena *arena);
+/* Take back everything allocated since mark. */
+void arena_rewind(struct arena *arena, struct arena_mark mark);
+void arena_reset(struct arena *arena);
+/* Give all the arena's memory back to the heap. */
+void arena_release(struct arena *arena);
+
+/* The calling thread's arena for data that lives only as long as the
+ * frame being painted.  view_paint() empties it as each frame starts. */
+struct arena *frame_arena(void);
+
+#endif
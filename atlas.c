@@ -0,0 +1,214 @@
+/*
+ *  Copyright 2016 Kendall E. Blake
+ *
+ *  This file is part of cairo-test.
+ *
+ *  cairo-test is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published
+ *  by the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  cairo-test is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with cairo-test.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "atlas.h"
+#include "direction.h"
+#include "map.h"
+#include "view.h"
+
+struct atlas
+{
+	const unsigned char       *base;
+	size_t                     size;
+	const struct atlas_header *header;
+	const uint32_t            *index;
+	const struct atlas_frame  *frames;
+};
+
+void atlas_signature(struct map *map, int x, int y, int facing, char *signature)
+{
+	struct view_cone cone;
+	int vertical = (facing == DIRECTION_NORTH || facing == DIRECTION_SOUTH);
+
+	view_cone_gather(map, x, y, facing, VIEW_STEPS, &cone);
+	for (int i = 0; i < VIEW_CONE_CELLS; i++)
+	{
+		char tile = cone.tiles[i];
+		if (vertical && tile == '|') tile = '-';
+		else if (vertical && tile == '-') tile = '|';
+		signature[i] = tile;
+	}
+}
+
+size_t atlas_compress_bound(int width, int height)
+{
+	/* worst case: a literal word per row on top of the raw pixels */
+	return (size_t)height * (4 + (size_t)width * 4);
+}
+
+size_t atlas_compress(const void *pixels, int width, int height, int stride, void *out)
+{
+	uint32_t *o = (uint32_t *)out;
+
+	for (int y = 0; y < height; y++)
+	{
+		const uint32_t *row = (const uint32_t *)((const char *)pixels + (size_t)y * stride);
+		int x = 0;
+
+		while (x < width) {
+			int run = 1;
+			while (x + run < width && row[x + run] == row[x])
+				run++;
+			if (run > 2) {
+				*o++ = ATLAS_RUN | (uint32_t)run;
+				*o++ = row[x];
+				x += run;
+			} else {
+				/* gather pixels until a worthwhile run starts */
+				int start = x;
+				uint32_t *count = o++;
+				while (x < width && !(x + 2 < width
+						&& row[x] == row[x + 1] && row[x] == row[x + 2]))
+					*o++ = row[x++];
+				*count = (uint32_t)(x - start);
+			}
+		}
+	}
+	return (size_t)((char *)o - (char *)out);
+}
+
+/*@null@*/
+struct atlas *atlas_open(const char *path)
+{
+	struct atlas *atlas = (struct atlas *)calloc(1, sizeof(struct atlas));
+	struct stat st;
+	size_t index_size;
+	int fd;
+
+	if (!atlas)
+		return NULL;
+	fd = open(path, O_RDONLY);
+	if (fd < 0 || fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(struct atlas_header))
+		goto fail;
+
+	atlas->size = (size_t)st.st_size;
+	atlas->base = (const unsigned char *)mmap(NULL, atlas->size, PROT_READ, MAP_SHARED, fd, 0);
+	if (atlas->base == MAP_FAILED) {
+		atlas->base = NULL;
+		goto fail;
+	}
+	close(fd);
+	fd = -1;
+
+	atlas->header = (const struct atlas_header *)atlas->base;
+	if (memcmp(atlas->header->magic, ATLAS_MAGIC, sizeof(atlas->header->magic))
+		|| atlas->header->version != ATLAS_VERSION)
+		goto fail;
+
+	index_size = (size_t)atlas->header->map_width * atlas->header->map_height
+		* 4 * sizeof(uint32_t);
+	if (atlas->header->index_offset + index_size > atlas->size
+		|| atlas->header->frames_offset + (uint64_t)atlas->header->frame_count
+			* sizeof(struct atlas_frame) > atlas->size)
+		goto fail;
+	atlas->index  = (const uint32_t *)(atlas->base + atlas->header->index_offset);
+	atlas->frames = (const struct atlas_frame *)(atlas->base + atlas->header->frames_offset);
+	return atlas;
+
+	fail:
+	if (fd >= 0) close(fd);
+	atlas_close(atlas);
+	return NULL;
+}
+
+void atlas_close(struct atlas *atlas)
+{
+	if (atlas) {
+		if (atlas->base) munmap((void *)atlas->base, atlas->size);
+		free(atlas);
+	}
+}
+
+int atlas_frame_width(struct atlas *atlas)
+{
+	return (int)atlas->header->frame_width;
+}
+
+int atlas_frame_height(struct atlas *atlas)
+{
+	return (int)atlas->header->frame_height;
+}
+
+int atlas_draw(struct atlas *atlas, struct map *map, int x, int y, int facing,
+	void *pixels, int pitch)
+{
+	const struct atlas_frame *frame;
+	const uint32_t *in, *end;
+	char signature[VIEW_CONE_CELLS];
+	uint32_t id;
+	int width = (int)atlas->header->frame_width;
+	int row = 0, col = 0;
+
+	if (x < 0 || y < 0 || (uint32_t)x >= atlas->header->map_width
+		|| (uint32_t)y >= atlas->header->map_height)
+		return 0;
+	id = atlas->index[((size_t)y * atlas->header->map_width + x) * 4 + facing];
+	if (id == ATLAS_NO_FRAME || id >= atlas->header->frame_count)
+		return 0;
+
+	/* The map may have changed since baking: a looted chest, say. */
+	frame = &atlas->frames[id];
+	atlas_signature(map, x, y, facing, signature);
+	if (memcmp(signature, frame->signature, VIEW_CONE_CELLS))
+		return 0;
+	if (frame->offset + frame->length > atlas->size || frame->length % sizeof(uint32_t))
+		return 0;
+
+	/* The file may be cut short or damaged: every word read is checked
+	 * to be in the frame, and the frame must fill the picture exactly. */
+	in  = (const uint32_t *)(atlas->base + frame->offset);
+	end = in + frame->length / sizeof(uint32_t);
+	while (row < (int)atlas->header->frame_height) {
+		uint32_t *out = (uint32_t *)((char *)pixels + (size_t)row * pitch) + col;
+		uint32_t  count;
+
+		if (in == end)
+			return 0;
+		count = *in & ~ATLAS_RUN;
+		if (count > (uint32_t)(width - col))
+			return 0;
+		if (*in++ & ATLAS_RUN) {
+			uint32_t pixel;
+
+			if (in == end)
+				return 0;
+			pixel = *in++;
+			for (uint32_t i = 0; i < count; i++)
+				out[i] = pixel;
+		} else {
+			if ((size_t)(end - in) < count)
+				return 0;
+			memcpy(out, in, count * sizeof(uint32_t));
+			in += count;
+		}
+		col += (int)count;
+		if (col == width) {
+			col = 0;
+			row++;
+		}
+	}
+	return in == end;
+}
@@ -0,0 +1,89 @@
+#ifndef ATLAS_H
+#define ATLAS_H
+/*
+ *  Copyright 2016 Kendall E. Blake
+ *
+ *  This file is part of cairo-test.
+ *
+ *  cairo-test is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published
+ *  by the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  cairo-test is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with cairo-test.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "map.h"
+#include "view.h"
+
+/* A frame atlas holds a pre-rendered view for every pose on a map that
+ * never changes, so showing a move is a lookup and a decode instead of a
+ * repaint.  Poses that see the same cone share a frame.
+
+   File layout, all native byte order:
+
+	struct atlas_header
+	uint32_t index[map_height][map_width][4]   frame per cell and facing
+	struct atlas_frame frames[frame_count]
+	compressed pixel data
+
+   Frames are run-length coded ARGB32: a uint32_t word whose top bit says
+   whether a run (one pixel repeated) or a literal (that many pixels
+   copied) follows, and whose low bits give the pixel count. */
+
+#define ATLAS_MAGIC    "DUNATLAS"
+#define ATLAS_VERSION  1
+#define ATLAS_NO_FRAME 0xffffffffu
+#define ATLAS_RUN      0x80000000u
+
+struct atlas_header
+{
+	char     magic[8];
+	uint32_t version;
+	uint32_t map_width, map_height;
+	uint32_t frame_width, frame_height;
+	uint32_t frame_count;
+	uint64_t index_offset;
+	uint64_t frames_offset;
+};
+
+struct atlas_frame
+{
+	uint64_t offset;
+	uint32_t length;        /* bytes */
+	char     signature[VIEW_CONE_CELLS];
+};
+
+struct atlas;
+
+/* The cone as the atlas keys it: doors are turned to match the facing so
+ * that poses looking north and east can share frames. */
+void atlas_signature(struct map *map, int x, int y, int facing, char *signature);
+
+/* Run-length code width * height ARGB32 pixels into out, which must have
+ * room for atlas_compress_bound() bytes.  Returns the bytes used. */
+size_t atlas_compress_bound(int width, int height);
+size_t atlas_compress(const void *pixels, int width, int height, int stride, void *out);
+
+/*@null@*/
+struct atlas *atlas_open(const char *path);
+void atlas_close(struct atlas *atlas);
+int atlas_frame_width(struct atlas *atlas);
+int atlas_frame_height(struct atlas *atlas);
+/* Decode the frame for this pose into pixels.  Returns 0, leaving pixels
+ * alone, when the atlas has no frame for it or the map around the pose has
+ * changed since baking; also 0 if the frame's data is cut short or does
+ * not fill the picture exactly, with pixels then only partly decoded. */
+int atlas_draw(struct atlas *atlas, struct map *map, int x, int y, int facing,
+	void *pixels, int pitch);
+
+#endif
@@ -0,0 +1,293 @@
+/*
+ *  Copyright 2016 Kendall E. Blake
+ *
+ *  This file is part of cairo-test.
+ *
+ *  cairo-test is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published
+ *  by the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  cairo-test is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with cairo-test.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <cairo.h>
+
+#include "atlas.h"
+#include "drawing.h"
+#include "map.h"
+#include "map_loader.h"
+#include "player.h"
+#include "view.h"
+
+/* Render every view a map can show into a frame atlas for dungeon --atlas.
+ * Poses are grouped by what their view cone contains, each distinct cone is
+ * painted once, and the painting is spread over all CPUs. */
+
+struct baked_frame
+{
+	char   signature[VIEW_CONE_CELLS];
+	int    x, y, facing;
+	void  *data;
+	size_t length;
+};
+
+static struct map         *map;
+static struct baked_frame *frames;
+static uint32_t            nframes, frames_size;
+static uint32_t           *slots;       /* hash of signature -> frame + 1 */
+static size_t              nslots;
+static atomic_uint         next_frame;
+
+static uint64_t hash_signature(const char *signature)
+{
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	for (int i = 0; i < VIEW_CONE_CELLS; i++) {
+		hash ^= (unsigned char)signature[i];
+		hash *= 0x100000001b3ULL;
+	}
+	return hash;
+}
+
+static int grow_slots(void)
+{
+	size_t    new_nslots = nslots ? nslots * 2 : 1024;
+	uint32_t *new_slots = (uint32_t *)calloc(new_nslots, sizeof(uint32_t));
+
+	if (!new_slots)
+		return 0;
+	for (uint32_t f = 0; f < nframes; f++)
+	{
+		size_t i = hash_signature(frames[f].signature) & (new_nslots - 1);
+		while (new_slots[i])
+			i = (i + 1) & (new_nslots - 1);
+		new_slots[i] = f + 1;
+	}
+	free(slots);
+	slots  = new_slots;
+	nslots = new_nslots;
+	return 1;
+}
+
+/* The frame showing this signature, adding one for pose if it is new. */
+static uint32_t find_frame(const char *signature, int x, int y, int facing)
+{
+	size_t i;
+
+	if ((nframes + 1) * 2 > nslots && !grow_slots())
+		return ATLAS_NO_FRAME;
+	i = hash_signature(signature) & (nslots - 1);
+	while (slots[i]) {
+		if (!memcmp(frames[slots[i] - 1].signature, signature, VIEW_CONE_CELLS))
+			return slots[i] - 1;
+		i = (i + 1) & (nslots - 1);
+	}
+
+	if (nframes == frames_size) {
+		uint32_t new_size = frames_size ? frames_size * 2 : 1024;
+		struct baked_frame *bigger = (struct baked_frame *)realloc(frames,
+			new_size * sizeof(struct baked_frame));
+		if (!bigger)
+			return ATLAS_NO_FRAME;
+		frames = bigger;
+		frames_size = new_size;
+	}
+	memcpy(frames[nframes].signature, signature, VIEW_CONE_CELLS);
+	frames[nframes].x = x;
+	frames[nframes].y = y;
+	frames[nframes].facing = facing;
+	frames[nframes].data = NULL;
+	frames[nframes].length = 0;
+	slots[i] = nframes + 1;
+	return nframes++;
+}
+
+static void *render_frames(void *arg)
+{
+	struct player   *player = player_new();
+	cairo_surface_t *surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32,
+		display_width(), display_height());
+	cairo_t *cr = cairo_create(surface);
+	void    *buffer = malloc(atlas_compress_bound(display_width(), display_height()));
+	uint32_t f;
+
+	(void)arg;
+	if (!player || !buffer)
+		goto done;
+	player_use(player);
+
+	while ((f = atomic_fetch_add(&next_frame, 1)) < nframes) {
+		struct baked_frame *frame = &frames[f];
+
+		player_set_x(frame->x);
+		player_set_y(frame->y);
+		player_set_facing(frame->facing);
+		view_paint(cr, map);
+		cairo_surface_flush(surface);
+
+		frame->length = atlas_compress(cairo_image_surface_get_data(surface),
+			display_width(), display_height(),
+			cairo_image_surface_get_stride(surface), buffer);
+		frame->data = malloc(frame->length);
+		if (frame->data)
+			memcpy(frame->data, buffer, frame->length);
+	}
+
+	done:
+	view_release();
+	free(buffer);
+	cairo_destroy(cr);
+	cairo_surface_destroy(surface);
+	player_use(NULL);
+	player_delete(player);
+	return NULL;
+}
+
+static int write_atlas(const char *path, uint32_t *index)
+{
+	struct atlas_header header;
+	size_t   index_size = (size_t)map_width(map) * map_height(map) * 4 * sizeof(uint32_t);
+	uint64_t offset;
+	FILE    *out = fopen(path, "wb");
+
+	if (!out)
+		return 0;
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, ATLAS_MAGIC, sizeof(header.magic));
+	header.version       = ATLAS_VERSION;
+	header.map_width     = (uint32_t)map_width(map);
+	header.map_height    = (uint32_t)map_height(map);
+	header.frame_width   = (uint32_t)display_width();
+	header.frame_height  = (uint32_t)display_height();
+	header.frame_count   = nframes;
+	header.index_offset  = sizeof(header);
+	header.frames_offset = header.index_offset + index_size;
+	fwrite(&header, sizeof(header), 1, out);
+	fwrite(index, index_size, 1, out);
+
+	offset = header.frames_offset + (uint64_t)nframes * sizeof(struct atlas_frame);
+	for (uint32_t f = 0; f < nframes; f++)
+	{
+		struct atlas_frame entry;
+		memset(&entry, 0, sizeof(entry));
+		entry.offset = offset;
+		entry.length = (uint32_t)frames[f].length;
+		memcpy(entry.signature, frames[f].signature, VIEW_CONE_CELLS);
+		fwrite(&entry, sizeof(entry), 1, out);
+		offset += frames[f].length;
+	}
+	for (uint32_t f = 0; f < nframes; f++)
+		fwrite(frames[f].data, frames[f].length, 1, out);
+
+	if (ferror(out)) {
+		fclose(out);
+		return 0;
+	}
+	return fclose(out) == 0;
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "usage: %s [--threads n] [--size WxH] [-o atlas] [map]\n", name);
+	exit(2);
+}
+
+int main (int argc, char *argv[])
+{
+	const char *map_path = "map";
+	const char *out_path = "map.atlas";
+	long        nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	pthread_t  *threads;
+	uint32_t   *index;
+	size_t      poses = 0, raw = 0, packed = 0;
+
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "--threads") && i + 1 < argc) {
+			nthreads = atol(argv[++i]);
+		} else if (!strcmp(argv[i], "--size") && i + 1 < argc) {
+			int w, h;
+			if (!display_parse_size(argv[++i], &w, &h))
+				usage(argv[0]);
+			display_set_size(w, h);
+		} else if (!strcmp(argv[i], "-o") && i + 1 < argc) {
+			out_path = argv[++i];
+		} else if (argv[i][0] != '-') {
+			map_path = argv[i];
+		} else {
+			usage(argv[0]);
+		}
+	}
+	if (nthreads < 1)
+		nthreads = 1;
+
+	map = load_map_from_path(map_path);
+	if (!map) {
+		fprintf(stderr, "Can't open map file: %s\n", map_path);
+		return 1;
+	}
+
+	index = (uint32_t *)malloc((size_t)map_width(map) * map_height(map) * 4 * sizeof(uint32_t));
+	if (!index)
+		return 1;
+	for (int y = 0; y < map_height(map); y++)
+	for (int x = 0; x < map_width(map); x++)
+	for (int facing = 0; facing < 4; facing++)
+	{
+		uint32_t id = ATLAS_NO_FRAME;
+		if (map_tile(map, x, y) != 'X') {
+			char signature[VIEW_CONE_CELLS];
+			atlas_signature(map, x, y, facing, signature);
+			id = find_frame(signature, x, y, facing);
+			poses++;
+		}
+		index[((size_t)y * map_width(map) + x) * 4 + facing] = id;
+	}
+
+	threads = (pthread_t *)malloc(sizeof(pthread_t) * nthreads);
+	if (!threads)
+		return 1;
+	for (long t = 0; t < nthreads; t++)
+		pthread_create(&threads[t], NULL, render_frames, NULL);
+	for (long t = 0; t < nthreads; t++)
+		pthread_join(threads[t], NULL);
+
+	for (uint32_t f = 0; f < nframes; f++) {
+		if (!frames[f].data) {
+			fprintf(stderr, "Out of memory baking frame %u\n", f);
+			return 1;
+		}
+		packed += frames[f].length;
+	}
+	raw = (size_t)nframes * display_width() * display_height() * 4;
+
+	if (!write_atlas(out_path, index)) {
+		perror(out_path);
+		return 1;
+	}
+	printf("%zu poses, %u distinct frames, %zu KiB of pixels packed into %zu KiB\n",
+		poses, nframes, raw / 1024, packed / 1024);
+
+	for (uint32_t f = 0; f < nframes; f++)
+		free(frames[f].data);
+	free(frames);
+	free(slots);
+	free(index);
+	free(threads);
+	map_delete(map);
+	return 0;
+}
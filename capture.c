@@ -0,0 +1,314 @@
+/*
+ *  Copyright 2016 Kendall E. Blake
+ *
+ *  This file is part of cairo-test.
+ *
+ *  cairo-test is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published
+ *  by the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  cairo-test is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with cairo-test.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include <cairo.h>
+
+#include "capture.h"
+
+enum { CAPTURE_PNG, CAPTURE_Y4M, CAPTURE_RGB };
+
+struct capture_slot
+{
+	unsigned char *pixels;
+	size_t         size;
+	int            width, height, stride;
+	uint32_t       ms;
+};
+
+struct capture
+{
+	char                *path;
+	int                  format;
+	/*@null@*/ FILE     *stream;
+	pthread_t            thread;
+	sem_t                ready;
+	atomic_int           stopping;
+
+	/* Frames begun by the game and written by the thread; the slots
+	 * between tail and head are the thread's. */
+	struct capture_slot  slots[CAPTURE_QUEUE];
+	atomic_ulong         head, tail;
+	unsigned long        dropped;
+
+	/* The thread's own: the stream's size and start, and the last frame
+	 * converted, held until it is known how long it was shown for. */
+	unsigned long        written, frames_out, resized, failed;
+	int                  width, height;
+	uint32_t             start_ms;
+	/*@null@*/ unsigned char *held;
+};
+
+static int ends_with(const char *s, const char *suffix)
+{
+	size_t n = strlen(s), m = strlen(suffix);
+
+	return n >= m && !strcmp(s + n - m, suffix);
+}
+
+static void write_png(struct capture *capture, const struct capture_slot *slot)
+{
+	char             name[4096];
+	cairo_surface_t *surface;
+
+	snprintf(name, sizeof name, "%s/frame-%06lu.png", capture->path, capture->written);
+	surface = cairo_image_surface_create_for_data(slot->pixels, CAIRO_FORMAT_ARGB32,
+		slot->width, slot->height, slot->stride);
+	if (cairo_surface_write_to_png(surface, name) != CAIRO_STATUS_SUCCESS)
+		capture->failed++;
+	cairo_surface_destroy(surface);
+}
+
+static size_t held_size(struct capture *capture)
+{
+	return (size_t)capture->width * capture->height * 3;
+}
+
+/* Convert the slot into the held frame: planes of Y, U and V (BT.601,
+ * studio range) for a Y4M stream, or packed RGB. */
+static void hold(struct capture *capture, const struct capture_slot *slot)
+{
+	size_t         plane = (size_t)slot->width * slot->height;
+	unsigned char *out = capture->held;
+
+	for (int y = 0; y < slot->height; y++) {
+		const uint32_t *row = (const uint32_t *)(slot->pixels + (size_t)y * slot->stride);
+
+		for (int x = 0; x < slot->width; x++) {
+			int    r = (row[x] >> 16) & 0xff, g = (row[x] >> 8) & 0xff, b = row[x] & 0xff;
+			size_t i = (size_t)y * slot->width + x;
+
+			if (capture->format == CAPTURE_Y4M) {
+				out[i]             = (unsigned char)(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+				out[plane + i]     = (unsigned char)(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+				out[2 * plane + i] = (unsigned char)(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+			} else {
+				out[3 * i]     = (unsigned char)r;
+				out[3 * i + 1] = (unsigned char)g;
+				out[3 * i + 2] = (unsigned char)b;
+			}
+		}
+	}
+}
+
+static void write_held(struct capture *capture)
+{
+	if (capture->format == CAPTURE_Y4M && fputs("FRAME\n", capture->stream) == EOF)
+		capture->failed++;
+	if (fwrite(capture->held, 1, held_size(capture), capture->stream) != held_size(capture))
+		capture->failed++;
+	capture->frames_out++;
+}
+
+static void write_stream(struct capture *capture, const struct capture_slot *slot)
+{
+	unsigned long due;
+
+	if (!capture->held) {
+		capture->width    = slot->width;
+		capture->height   = slot->height;
+		capture->start_ms = slot->ms;
+		capture->held     = malloc(held_size(capture));
+		if (!capture->held) {
+			capture->failed++;
+			return;
+		}
+		if (capture->format == CAPTURE_Y4M)
+			fprintf(capture->stream, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C444\n",
+				capture->width, capture->height, CAPTURE_FPS);
+		else
+			fprintf(stderr, "Capturing %dx%d RGB24 at %d fps to %s\n",
+				capture->width, capture->height, CAPTURE_FPS, capture->path);
+	} else if (slot->width != capture->width || slot->height != capture->height) {
+		capture->resized++;
+		return;
+	} else {
+		/* the frame held was on screen until this one came */
+		due = (unsigned long)(slot->ms - capture->start_ms) * CAPTURE_FPS / 1000;
+		while (capture->frames_out < due)
+			write_held(capture);
+	}
+	hold(capture, slot);
+}
+
+static void *write_frames(void *arg)
+{
+	struct capture *capture = arg;
+	unsigned long   tail = 0;
+
+	for (;;) {
+		int stopping;
+
+		if (sem_wait(&capture->ready) && errno == EINTR)
+			continue;
+		/* anything queued before the stop is seen by the drain below */
+		stopping = atomic_load(&capture->stopping);
+		while (tail != atomic_load_explicit(&capture->head, memory_order_acquire)) {
+			const struct capture_slot *slot = &capture->slots[tail % CAPTURE_QUEUE];
+
+			if (capture->format == CAPTURE_PNG)
+				write_png(capture, slot);
+			else
+				write_stream(capture, slot);
+			capture->written++;
+			atomic_store_explicit(&capture->tail, ++tail, memory_order_release);
+		}
+		if (stopping)
+			break;
+	}
+	if (capture->held)
+		write_held(capture);
+	return NULL;
+}
+
+struct capture *capture_start(const char *path)
+{
+	struct capture *capture = calloc(1, sizeof *capture);
+
+	if (!capture)
+		return NULL;
+	capture->path = strdup(path);
+	capture->format = ends_with(path, ".y4m") ? CAPTURE_Y4M
+		: ends_with(path, ".rgb") ? CAPTURE_RGB : CAPTURE_PNG;
+	atomic_init(&capture->head, 0);
+	atomic_init(&capture->tail, 0);
+	atomic_init(&capture->stopping, 0);
+	if (!capture->path)
+		goto fail;
+	if (capture->format == CAPTURE_PNG) {
+		if (mkdir(path, 0777) && errno != EEXIST)
+			goto fail;
+	} else if (!(capture->stream = fopen(path, "wb"))) {
+		goto fail;
+	}
+	if (sem_init(&capture->ready, 0, 0))
+		goto fail;
+	if (pthread_create(&capture->thread, NULL, write_frames, capture)) {
+		sem_destroy(&capture->ready);
+		goto fail;
+	}
+	return capture;
+fail:
+	if (capture->stream)
+		fclose(capture->stream);
+	free(capture->path);
+	free(capture);
+	return NULL;
+}
+
+void capture_stop(struct capture *capture)
+{
+	if (!capture)
+		return;
+	atomic_store(&capture->stopping, 1);
+	sem_post(&capture->ready);
+	pthread_join(capture->thread, NULL);
+	if (capture->stream && fclose(capture->stream))
+		capture->failed++;
+	fprintf(stderr, "Captured %lu frames to %s, %lu dropped\n",
+		capture->written, capture->path, capture->dropped);
+	if (capture->resized)
+		fprintf(stderr, "%lu frames were a different size from the stream and left out\n",
+			capture->resized);
+	if (capture->failed)
+		fprintf(stderr, "%lu writes to %s failed\n", capture->failed, capture->path);
+	for (int i = 0; i < CAPTURE_QUEUE; i++)
+		free(capture->slots[i].pixels);
+	sem_destroy(&capture->ready);
+	free(capture->held);
+	free(capture->path);
+	free(capture);
+}
+
+unsigned char *capture_begin(struct capture *capture, int width, int height, int *stride)
+{
+	unsigned long        head = atomic_load_explicit(&capture->head, memory_order_relaxed);
+	struct capture_slot *slot = &capture->slots[head % CAPTURE_QUEUE];
+	size_t               need = (size_t)width * 4 * height;
+
+	if (head - atomic_load_explicit(&capture->tail, memory_order_acquire) == CAPTURE_QUEUE) {
+		capture->dropped++;
+		return NULL;
+	}
+	/* only when the size first changes */
+	if (slot->size < need) {
+		unsigned char *bigger = realloc(slot->pixels, need);
+
+		if (!bigger) {
+			capture->dropped++;
+			return NULL;
+		}
+		slot->pixels = bigger;
+		slot->size   = need;
+	}
+	slot->width  = width;
+	slot->height = height;
+	slot->stride = width * 4;
+	*stride = slot->stride;
+	return slot->pixels;
+}
+
+void capture_commit(struct capture *capture, uint32_t ms)
+{
+	unsigned long head = atomic_load_explicit(&capture->head, memory_order_relaxed);
+
+	capture->slots[head % CAPTURE_QUEUE].ms = ms;
+	atomic_store_explicit(&capture->head, head + 1, memory_order_release);
+	sem_post(&capture->ready);
+}
+
+/* Copy rows of width pixels into out, padding each to frame_width. */
+static void copy_rows(unsigned char *out, int stride, int frame_width,
+	const unsigned char *in, int in_stride, int width, int rows)
+{
+	for (int row = 0; row < rows; row++) {
+		memcpy(out + (size_t)row * stride, in + (size_t)row * in_stride, (size_t)width * 4);
+		memset(out + (size_t)row * stride + (size_t)width * 4, 0,
+			(size_t)(frame_width - width) * 4);
+	}
+}
+
+void capture_compose(struct capture *capture,
+	const unsigned char *view, int view_stride, int view_width, int view_height,
+	const unsigned char *panel, int panel_stride, int panel_width, int panel_height,
+	uint32_t ms)
+{
+	int            width = view_width > panel_width ? view_width : panel_width, stride;
+	unsigned char *out = capture_begin(capture, width, view_height + panel_height, &stride);
+
+	if (!out)
+		return;
+	copy_rows(out, stride, width, view, view_stride, view_width, view_height);
+	copy_rows(out + (size_t)view_height * stride, stride, width,
+		panel, panel_stride, panel_width, panel_height);
+	capture_commit(capture, ms);
+}
+
+unsigned long capture_dropped(struct capture *capture)
+{
+	return capture->dropped;
+}
@@ -0,0 +1,59 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+/*
+ *  Copyright 2016 Kendall E. Blake
+ *
+ *  This file is part of cairo-test.
+ *
+ *  cairo-test is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published
+ *  by the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  cairo-test is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with cairo-test.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+
+/* Frames waiting to be written, at most.  Past this the game is running
+ * ahead of the disk and frames are dropped. */
+#define CAPTURE_QUEUE 8
+/* The frame rate of a video stream.  The game only shows a frame when
+ * something changes, so each one is repeated until the next comes. */
+#define CAPTURE_FPS 30
+
+struct capture;
+
+/* Capture frames to path: a YUV4MPEG2 stream (4:4:4) if it ends in
+ * ".y4m", bare 24-bit RGB if it ends in ".rgb", or otherwise a directory
+ * of numbered PNGs.  Frames are written by a thread of the capture's own. */
+/*@null@*/
+struct capture *capture_start(const char *path);
+/* Write out every frame still queued, then say on stderr how many were
+ * captured and dropped. */
+void capture_stop(/*@null@*/ struct capture *capture);
+
+/* Where to copy a width x height ARGB32 frame, stride bytes to a row, or
+ * NULL if the queue is full and the frame is dropped.  Never blocks. */
+/*@null@*/
+unsigned char *capture_begin(struct capture *capture, int width, int height, int *stride);
+/* Queue the frame begun last, shown ms milliseconds into the session. */
+void capture_commit(struct capture *capture, uint32_t ms);
+
+/* Queue a frame of view (view_width x view_height ARGB32 pixels) above
+ * panel, each copied at its own size: the frame is as wide as the wider
+ * of the two, and black where the narrower leaves a gap. */
+void capture_compose(struct capture *capture,
+	const unsigned char *view, int view_stride, int view_width, int view_height,
+	const unsigned char *panel, int panel_stride, int panel_width, int panel_height,
+	uint32_t ms);
+
+unsigned long capture_dropped(struct capture *capture);
+
+#endif
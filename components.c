@@ -0,0 +1,615 @@
+/*
+ *  Copyright 2016 Kendall E. Blake
+ *
+ *  This file is part of cairo-test.
+ *
+ *  cairo-test is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published
+ *  by the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  cairo-test is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with cairo-test.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "components.h"
+
+/* A closed tile can have open tiles on all four sides. */
+#define SIDES 4
+
+/* The tiles one search has reached, in the order it reached them; those
+ * from head on have still to be looked around. */
+struct search
+{
+	uint32_t *cells;
+	size_t    head, count, size;
+};
+
+struct components
+{
+	size_t        width, height;
+	uint32_t     *labels;       /* one per tile */
+	uint32_t     *sizes;        /* tiles with each label; 0 if unused */
+	uint32_t     *unused;       /* labels free to hand out again */
+	size_t        label_count, unused_count, label_room;
+	size_t        count;
+	/* which search reached a tile, while a closed tile is being split */
+	uint32_t     *stamps;
+	uint32_t      stamp;
+	struct search searches[SIDES];
+	int           invalid;      /* an update ran out of memory halfway */
+};
+
+/* Labelling a whole map runs in phases, each cutting the rows into bands
+ * for the threads to share. */
+enum { LINK, ROOT, NUMBER, TALLY };
+
+struct build
+{
+	struct components *components;
+	struct map        *map;
+	uint32_t          *parents;
+	size_t            *roots;       /* per band: how many, then the first's label */
+	_Atomic uint32_t  *tally;
+	size_t             bands;
+	int                phase;
+	atomic_size_t      next_band;
+	atomic_int         failed;
+};
+
+static size_t band_start(struct build *build, size_t band)
+{
+	return band * build->components->height / build->bands * build->components->width;
+}
+
+static uint32_t find(uint32_t *parents, uint32_t c)
+{
+	while (parents[c] != c) {
+		parents[c] = parents[parents[c]];
+		c = parents[c];
+	}
+	return c;
+}
+
+/* Roots are always the lowest tile of their set, so every tile's parent
+ * is at or before it. */
+static void unite(uint32_t *parents, uint32_t a, uint32_t b)
+{
+	a = find(parents, a);
+	b = find(parents, b);
+	if (a < b)
+		parents[b] = a;
+	else if (b < a)
+		parents[a] = b;
+}
+
+/* Join each open tile to those left of and above it within the band. */
+static void link_band(struct build *build, size_t start, size_t end, char *row)
+{
+	uint32_t *parents = build->parents;
+	size_t    width = build->components->width;
+
+	for (size_t y0 = start; y0 < end; y0 += width) {
+		map_read_row(build->map, 0, (int)(y0 / width), row, width);
+		for (size_t x = 0; x < width; x++) {
+			uint32_t c = (uint32_t)(y0 + x);
+
+			if (row[x] == 'X') {
+				parents[c] = COMPONENT_NONE;
+				continue;
+			}
+			parents[c] = c;
+			if (x > 0 && parents[c - 1] != COMPONENT_NONE)
+				unite(parents, c, c - 1);
+			if (y0 > start && parents[c - width] != COMPONENT_NONE)
+				unite(parents, c, (uint32_t)(c - width));
+		}
+	}
+}
+
+/* Point every tile at its root without writing to the sets, which other
+ * bands are reading.  A parent in this band already has its root. */
+static size_t root_band(struct build *build, size_t start, size_t end)
+{
+	uint32_t *parents = build->parents, *labels = build->components->labels;
+	size_t    roots = 0;
+
+	for (size_t c = start; c < end; c++) {
+		uint32_t p = parents[c];
+
+		if (p == COMPONENT_NONE) {
+			labels[c] = COMPONENT_NONE;
+			continue;
+		}
+		if (p == c) {
+			roots++;
+		} else if (p >= start) {
+			p = labels[p];
+		} else {
+			while (parents[p] != p)
+				p = parents[p];
+		}
+		labels[c] = p;
+	}
+	return roots;
+}
+
+/* Give each root of the band the next label, kept in its parent. */
+static void number_band(struct build *build, size_t band, size_t start, size_t end)
+{
+	uint32_t *labels = build->components->labels;
+	uint32_t  next = (uint32_t)build->roots[band];
+
+	for (size_t c = start; c < end; c++)
+		if (labels[c] == c)
+			build->parents[c] = next++;
+}
+
+/* Swap roots for labels and count each label's tiles a run at a time. */
+static void tally_band(struct build *build, size_t start, size_t end)
+{
+	uint32_t *labels = build->components->labels;
+	uint32_t  run = COMPONENT_NONE, length = 0;
+
+	for (size_t c = start; c < end; c++) {
+		uint32_t label = labels[c];
+
+		if (label == COMPONENT_NONE)
+			continue;
+		label = labels[c] = build->parents[label];
+		if (label != run && length)
+			atomic_fetch_add_explicit(&build->tally[run], length, memory_order_relaxed);
+		if (label != run)
+			length = 0;
+		run = label;
+		length++;
+	}
+	if (length)
+		atomic_fetch_add_explicit(&build->tally[run], length, memory_order_relaxed);
+}
+
+static void *build_main(void *arg)
+{
+	struct build *build = (struct build *)arg;
+	char         *row = NULL;
+	size_t        band;
+
+	if (build->phase == LINK && !(row = (char *)malloc(build->components->width))) {
+		atomic_store(&build->failed, 1);
+		return NULL;
+	}
+	while ((band = atomic_fetch_add(&build->next_band, 1)) < build->bands) {
+		size_t start = band_start(build, band), end = band_start(build, band + 1);
+
+		switch (build->phase) {
+			case LINK:   link_band(build, start, end, row); break;
+			case ROOT:   build->roots[band] = root_band(build, start, end); break;
+			case NUMBER: number_band(build, band, start, end); break;
+			case TALLY:  tally_band(build, start, end); break;
+		}
+	}
+	free(row);
+	return NULL;
+}
+
+static void run_phase(struct build *build, int phase, int threads)
+{
+	pthread_t workers[threads];
+	int       started = 0;
+
+	build->phase = phase;
+	atomic_store(&build->next_band, 0);
+	for (int i = 0; i < threads - 1; i++) {
+		if (pthread_create(&workers[started], NULL, build_main, build))
+			break;
+		started++;
+	}
+	/* this thread works too, and finishes the phase alone if it must */
+	build_main(build);
+	for (int i = 0; i < started; i++)
+		pthread_join(workers[i], NULL);
+}
+
+/* Union-find over each band at once, then across the seams between them,
+ * then the roots numbered into labels. */
+static int label_map(struct components *components, struct map *map, int threads)
+{
+	struct build build;
+	size_t       tiles = components->width * components->height, labels = 0;
+	int          ok;
+
+	if (threads <= 0)
+		threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	if ((size_t)threads > components->height)
+		threads = (int)components->height;
+	build.components = components;
+	build.map        = map;
+	build.bands      = (size_t)threads;
+	build.parents    = (uint32_t *)malloc(tiles * sizeof(uint32_t));
+	build.roots      = (size_t *)malloc(build.bands * sizeof(size_t));
+	build.tally      = NULL;
+	atomic_init(&build.failed, 0);
+	atomic_init(&build.next_band, 0);
+	ok = build.parents && build.roots;
+	if (ok) {
+		run_phase(&build, LINK, threads);
+		ok = !atomic_load(&build.failed);
+	}
+	if (ok) {
+		for (size_t band = 1; band < build.bands; band++) {
+			size_t start = band_start(&build, band);
+
+			for (size_t c = start; c < start + components->width; c++)
+				if (build.parents[c] != COMPONENT_NONE
+						&& build.parents[c - components->width] != COMPONENT_NONE)
+					unite(build.parents, (uint32_t)c, (uint32_t)(c - components->width));
+		}
+		run_phase(&build, ROOT, threads);
+		for (size_t band = 0; band < build.bands; band++) {
+			size_t roots = build.roots[band];
+
+			build.roots[band] = labels;
+			labels += roots;
+		}
+		components->label_room = labels > 16 ? labels : 16;
+		components->sizes  = (uint32_t *)malloc(components->label_room * sizeof(uint32_t));
+		components->unused = (uint32_t *)malloc(components->label_room * sizeof(uint32_t));
+		build.tally = (_Atomic uint32_t *)malloc(components->label_room * sizeof(*build.tally));
+		ok = components->sizes && components->unused && build.tally;
+	}
+	if (ok) {
+		for (size_t i = 0; i < labels; i++)
+			atomic_init(&build.tally[i], 0);
+		run_phase(&build, NUMBER, threads);
+		run_phase(&build, TALLY, threads);
+		for (size_t i = 0; i < labels; i++)
+			components->sizes[i] = atomic_load(&build.tally[i]);
+		components->label_count = components->count = labels;
+	}
+	free(build.parents);
+	free(build.roots);
+	free(build.tally);
+	return ok;
+}
+
+/*@null@*/
+struct components *components_new(struct map *map, int threads)
+{
+	struct components *components = (struct components *)calloc(1, sizeof *components);
+	size_t             tiles;
+
+	if (!components)
+		return NULL;
+	components->width  = (size_t)map_width(map);
+	components->height = (size_t)map_height(map);
+	tiles = components->width * components->height;
+	components->stamp  = 1;
+	if (!tiles || tiles >= COMPONENT_NONE)
+		goto fail;
+	components->labels = (uint32_t *)malloc(tiles * sizeof(uint32_t));
+	components->stamps = (uint32_t *)calloc(tiles, sizeof(uint32_t));
+	if (!components->labels || !components->stamps || !label_map(components, map, threads))
+		goto fail;
+	return components;
+fail:
+	components_delete(components);
+	return NULL;
+}
+
+void components_delete(/*@null@*/ struct components *components)
+{
+	if (!components)
+		return;
+	for (int i = 0; i < SIDES; i++)
+		free(components->searches[i].cells);
+	free(components->labels);
+	free(components->sizes);
+	free(components->unused);
+	free(components->stamps);
+	free(components);
+}
+
+uint32_t components_label(struct components *components, int x, int y)
+{
+	if (components->invalid)
+		return COMPONENT_NONE;
+	if (x < 0 || y < 0 || (size_t)x >= components->width || (size_t)y >= components->height)
+		return COMPONENT_NONE;
+	return components->labels[(size_t)y * components->width + (size_t)x];
+}
+
+int components_connected(struct components *components, int ax, int ay, int bx, int by)
+{
+	uint32_t a = components_label(components, ax, ay);
+
+	return a != COMPONENT_NONE && a == components_label(components, bx, by);
+}
+
+size_t components_count(struct components *components)
+{
+	return components->invalid ? 0 : components->count;
+}
+
+size_t components_size(struct components *components, uint32_t label)
+{
+	if (components->invalid)
+		return 0;
+	return label < components->label_count ? components->sizes[label] : 0;
+}
+
+static uint32_t new_label(struct components *components)
+{
+	if (components->unused_count)
+		return components->unused[--components->unused_count];
+	if (components->label_count == components->label_room) {
+		size_t    room = components->label_room * 2;
+		uint32_t *sizes = (uint32_t *)realloc(components->sizes, room * sizeof(uint32_t));
+		uint32_t *unused;
+
+		if (sizes)
+			components->sizes = sizes;
+		unused = sizes ? (uint32_t *)realloc(components->unused, room * sizeof(uint32_t)) : NULL;
+		if (!unused)
+			return COMPONENT_NONE;
+		components->unused = unused;
+		components->label_room = room;
+	}
+	return (uint32_t)components->label_count++;
+}
+
+static void drop_label(struct components *components, uint32_t label)
+{
+	components->sizes[label] = 0;
+	components->unused[components->unused_count++] = label;
+	components->count--;
+}
+
+static int make_room(struct search *search, size_t count)
+{
+	uint32_t *cells;
+	size_t    size = search->size ? search->size : 64;
+
+	if (count <= search->size)
+		return 1;
+	while (size < count)
+		size *= 2;
+	cells = (uint32_t *)realloc(search->cells, size * sizeof(uint32_t));
+	if (!cells)
+		return 0;
+	search->cells = cells;
+	search->size  = size;
+	return 1;
+}
+
+static int push(struct search *search, uint32_t c)
+{
+	if (!make_room(search, search->count + 1))
+		return 0;
+	search->cells[search->count++] = c;
+	return 1;
+}
+
+static int sides_of(struct components *components, uint32_t c, uint32_t *sides)
+{
+	size_t w = components->width, x = c % w, y = c / w;
+	int    n = 0;
+
+	if (x > 0)
+		sides[n++] = c - 1;
+	if (x + 1 < w)
+		sides[n++] = c + 1;
+	if (y > 0)
+		sides[n++] = (uint32_t)(c - w);
+	if (y + 1 < components->height)
+		sides[n++] = (uint32_t)(c + w);
+	return n;
+}
+
+/* Relabel the component that reaches from c as label.  The search must
+ * have room for all of it already. */
+static void flood(struct components *components, uint32_t c, uint32_t from, uint32_t label)
+{
+	struct search *search = &components->searches[0];
+
+	search->head = search->count = 0;
+	components->labels[c] = label;
+	search->cells[search->count++] = c;
+	while (search->head < search->count) {
+		uint32_t sides[SIDES];
+		int      n = sides_of(components, search->cells[search->head++], sides);
+
+		for (int i = 0; i < n; i++)
+			if (components->labels[sides[i]] == from) {
+				components->labels[sides[i]] = label;
+				search->cells[search->count++] = sides[i];
+			}
+	}
+}
+
+static int open_tile(struct components *components, uint32_t c)
+{
+	uint32_t sides[SIDES], around[SIDES], from[SIDES], best = COMPONENT_NONE;
+	size_t   room = 0;
+	int      n = sides_of(components, c, sides), m = 0;
+
+	for (int i = 0; i < n; i++) {
+		uint32_t label = components->labels[sides[i]];
+		int      seen = 0;
+
+		for (int j = 0; j < m; j++)
+			seen |= around[j] == label;
+		if (label == COMPONENT_NONE || seen)
+			continue;
+		around[m] = label;
+		from[m++] = sides[i];
+		if (best == COMPONENT_NONE || components->sizes[label] > components->sizes[best])
+			best = label;
+	}
+	/* find the room for every flood before changing anything */
+	for (int i = 0; i < m; i++)
+		if (around[i] != best && components->sizes[around[i]] > room)
+			room = components->sizes[around[i]];
+	if (!make_room(&components->searches[0], room))
+		return 0;
+	if (best == COMPONENT_NONE) {
+		best = new_label(components);
+		if (best == COMPONENT_NONE)
+			return 0;
+		components->sizes[best] = 0;
+		components->count++;
+	}
+	components->labels[c] = best;
+	components->sizes[best]++;
+	/* the smaller components join the biggest */
+	for (int i = 0; i < m; i++) {
+		if (around[i] == best)
+			continue;
+		flood(components, from[i], around[i], best);
+		components->sizes[best] += components->sizes[around[i]];
+		drop_label(components, around[i]);
+	}
+	return 1;
+}
+
+static int group_of(int *groups, int i)
+{
+	while (groups[i] != i)
+		i = groups[i];
+	return i;
+}
+
+/* Give the tiles the searches in group reached a label of their own. */
+static int cut_off(struct components *components, int *groups, int n, int group, uint32_t from)
+{
+	uint32_t label = new_label(components);
+
+	if (label == COMPONENT_NONE)
+		return 0;
+	components->sizes[label] = 0;
+	components->count++;
+	for (int i = 0; i < n; i++) {
+		struct search *search = &components->searches[i];
+
+		if (group_of(groups, i) != group)
+			continue;
+		for (size_t j = 0; j < search->count; j++)
+			components->labels[search->cells[j]] = label;
+		components->sizes[label] += (uint32_t)search->count;
+		components->sizes[from]  -= (uint32_t)search->count;
+	}
+	return 1;
+}
+
+static int exhausted(struct components *components, int *groups, int n, int group)
+{
+	for (int i = 0; i < n; i++) {
+		struct search *search = &components->searches[i];
+
+		if (group_of(groups, i) == group && search->head < search->count)
+			return 0;
+	}
+	return 1;
+}
+
+/* Search out from each open side of c a tile at a time in turn.  Searches
+ * that meet join up; one that runs out of tiles without meeting the rest
+ * has found a piece that c cut off.  Stop once one group is left, having
+ * looked at no more of the component than the pieces cut off from it.
+ * Zero if a search ran out of memory before every piece was found. */
+static int close_tile(struct components *components, uint32_t c)
+{
+	uint32_t label = components->labels[c], sides[SIDES], open[SIDES], base;
+	int      groups[SIDES], n = sides_of(components, c, sides), m = 0, left;
+
+	components->labels[c] = COMPONENT_NONE;
+	if (--components->sizes[label] == 0) {
+		drop_label(components, label);
+		return 1;
+	}
+	for (int i = 0; i < n; i++)
+		if (components->labels[sides[i]] == label)
+			open[m++] = sides[i];
+	if (m < 2)
+		return 1;
+	if (components->stamp > UINT32_MAX - SIDES) {
+		memset(components->stamps, 0, components->width * components->height * sizeof(uint32_t));
+		components->stamp = 1;
+	}
+	base = components->stamp;
+	components->stamp += SIDES;
+	for (int i = 0; i < m; i++) {
+		components->searches[i].head = components->searches[i].count = 0;
+		if (!push(&components->searches[i], open[i]))
+			return 0;
+		components->stamps[open[i]] = base + (uint32_t)i;
+		groups[i] = i;
+	}
+	left = m;
+	while (left > 1) {
+		for (int i = 0; i < m && left > 1; i++) {
+			struct search *search = &components->searches[i];
+			uint32_t       around[SIDES];
+			int            k;
+
+			if (search->head == search->count)
+				continue;
+			k = sides_of(components, search->cells[search->head++], around);
+			for (int j = 0; j < k; j++) {
+				uint32_t t = around[j], stamp = components->stamps[t];
+
+				if (components->labels[t] != label)
+					continue;
+				if (stamp >= base && stamp < base + SIDES) {
+					int a = group_of(groups, i), b = group_of(groups, (int)(stamp - base));
+
+					if (a != b) {
+						groups[b] = a;
+						left--;
+					}
+				} else {
+					components->stamps[t] = base + (uint32_t)i;
+					if (!push(search, t))
+						return 0;
+				}
+			}
+			if (search->head == search->count && left > 1
+					&& exhausted(components, groups, m, group_of(groups, i))) {
+				if (!cut_off(components, groups, m, group_of(groups, i), label))
+					return 0;
+				left--;
+			}
+		}
+	}
+	return 1;
+}
+
+int components_update(struct components *components, struct map *map, int x, int y)
+{
+	uint32_t c;
+	int      open, ok = 1;
+
+	if (components->invalid)
+		return 0;
+	if (x < 0 || y < 0 || (size_t)x >= components->width || (size_t)y >= components->height)
+		return 1;
+	c = (uint32_t)((size_t)y * components->width + (size_t)x);
+	open = map_tile(map, x, y) != 'X';
+	if (open && components->labels[c] == COMPONENT_NONE)
+		ok = open_tile(components, c);
+	else if (!open && components->labels[c] != COMPONENT_NONE)
+		ok = close_tile(components, c);
+	components->invalid = !ok;
+	return ok;
+}
@@ -0,0 +1,59 @@
+#ifndef COMPONENTS_H
+#define COMPONENTS_H
+/*
+ *  Copyright 2016 Kendall E. Blake
+ *
+ *  This file is part of cairo-test.
+ *
+ *  cairo-test is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published
+ *  by the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  cairo-test is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with cairo-test.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "map.h"
+
+/* Which open tiles of a map can be reached from which.  Every tile the
+ * player could walk onto (anything but 'X', doors included) carries the
+ * label of the connected component it is in, so asking whether one tile
+ * can be reached from another is two array reads, however far apart they
+ * are and whether or not they can. */
+#define COMPONENT_NONE UINT32_MAX   /* the label of walls and off the map */
+
+struct components;
+
+/* Label every tile of map, using up to threads threads (0 for one per
+ * processor).  NULL for an unbounded map, one of more than 4G tiles, or if
+ * there is not the memory for it. */
+/*@null@*/
+struct components *components_new(struct map *map, int threads);
+void components_delete(/*@null@*/ struct components *components);
+
+uint32_t components_label(struct components *components, int x, int y);
+/* Nonzero if (bx, by) can be walked to from (ax, ay). */
+int components_connected(struct components *components, int ax, int ay, int bx, int by);
+/* How many components there are, and how many tiles one has. */
+size_t components_count(struct components *components);
+size_t components_size(struct components *components, uint32_t label);
+
+/* Catch up with a change map_set_tile() made to (x, y) of map.  Opening a
+ * tile joins the components around it, relabelling the smaller ones;
+ * closing one searches out from each side at once, so that only the
+ * pieces it cut off are relabelled.  Labels other than those are kept.
+ * Zero if there was not the memory for it: the index is then left out of
+ * step with the map, every tile reads as COMPONENT_NONE, there are no
+ * components and every update fails until it is deleted and built again with components_new(). */
+int components_update(struct components *components, struct map *map, int x, int y);
+
+#endif
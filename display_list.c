@@ -0,0 +1,358 @@
+/*
+ *  Copyright 2016 Kendall E. Blake
+ *
+ *  This file is part of cairo-test.
+ *
+ *  cairo-test is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published
+ *  by the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  cairo-test is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with cairo-test.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <cairo.h>
+
+#include "display_list.h"
+
+/* How many batches back a polygon may be moved to join one of its own
+ * colour.  Keeps optimizing linear in the size of the frame. */
+#define BATCH_WINDOW 64
+
+/* Polygons closer than this may still touch once antialiased; strokes
+ * reach half the line width further. */
+#define FILL_MARGIN   1.0
+
+static int grow(void **array, int *size, int need, size_t elem)
+{
+	int   new_size = *size ? *size : 256;
+	void *bigger;
+
+	if (need <= *size)
+		return 1;
+	while (new_size < need)
+		new_size *= 2;
+	bigger = realloc(*array, (size_t)new_size * elem);
+	if (!bigger)
+		return 0;
+	*array = bigger;
+	*size  = new_size;
+	return 1;
+}
+
+void display_list_init(struct display_list *dl)
+{
+	memset(dl, 0, sizeof(struct display_list));
+	dl->line_width = DISPLAY_LINE_WIDTH;
+}
+
+void display_list_release(struct display_list *dl)
+{
+	free(dl->points);
+	free(dl->commands);
+	free(dl->batches);
+	display_list_init(dl);
+}
+
+void display_list_reset(struct display_list *dl)
+{
+	dl->npoints    = 0;
+	dl->ncommands  = 0;
+	dl->nbatches   = 0;
+	dl->path_start = 0;
+	dl->order      = 0;
+}
+
+void display_list_set_color(struct display_list *dl, float r, float g, float b)
+{
+	dl->color[0] = r;
+	dl->color[1] = g;
+	dl->color[2] = b;
+}
+
+void display_list_set_line_width(struct display_list *dl, double width)
+{
+	dl->line_width = width;
+}
+
+static void add_point(struct display_list *dl, double x, double y, int move)
+{
+	if (!grow((void **)&dl->points, &dl->points_size, dl->npoints + 1,
+			sizeof(struct display_point)))
+		return;
+	dl->points[dl->npoints].x    = x;
+	dl->points[dl->npoints].y    = y;
+	dl->points[dl->npoints].move = move;
+	dl->npoints++;
+}
+
+void display_list_move_to(struct display_list *dl, double x, double y)
+{
+	add_point(dl, x, y, 1);
+}
+
+void display_list_line_to(struct display_list *dl, double x, double y)
+{
+	add_point(dl, x, y, dl->npoints == dl->path_start);
+}
+
+static double cross(struct display_point *o, struct display_point *a, struct display_point *b)
+{
+	return (a->x - o->x) * (b->y - o->y) - (a->y - o->y) * (b->x - o->x);
+}
+
+/* Look at the shape of the path just recorded: its bounds, how many
+ * subpaths it has, whether it is one convex outline, and which way round
+ * it goes. */
+static void classify(struct display_list *dl, struct display_command *cmd)
+{
+	struct display_point *p = dl->points + cmd->first;
+	int   n = cmd->count;
+	double area = 0.0;
+	int   sign = 0;
+
+	cmd->bounds[0] = cmd->bounds[2] = p[0].x;
+	cmd->bounds[1] = cmd->bounds[3] = p[0].y;
+	cmd->convex = 1;
+	cmd->subpaths = 1;
+	for (int i = 1; i < n; i++) {
+		if (p[i].x < cmd->bounds[0]) cmd->bounds[0] = p[i].x;
+		if (p[i].y < cmd->bounds[1]) cmd->bounds[1] = p[i].y;
+		if (p[i].x > cmd->bounds[2]) cmd->bounds[2] = p[i].x;
+		if (p[i].y > cmd->bounds[3]) cmd->bounds[3] = p[i].y;
+		if (p[i].move) {
+			cmd->convex = 0;
+			cmd->subpaths++;
+		}
+	}
+
+	/* a closed outline usually repeats its first point */
+	if (n > 2 && p[n - 1].x == p[0].x && p[n - 1].y == p[0].y)
+		n--;
+	for (int i = 0; i < n && cmd->convex; i++) {
+		double c = cross(&p[i], &p[(i + 1) % n], &p[(i + 2) % n]);
+		if (c > 0.0 && sign < 0) cmd->convex = 0;
+		if (c < 0.0 && sign > 0) cmd->convex = 0;
+		if (c != 0.0) sign = c > 0.0 ? 1 : -1;
+	}
+	if (cmd->subpaths == 1 && cmd->op == DISPLAY_FILL) {
+		/* With the winding fill rule, two overlapping outlines going
+		 * opposite ways would cancel out once merged into one path,
+		 * convex or not. */
+		for (int i = 0; i < n; i++)
+			area += p[i].x * p[(i + 1) % n].y - p[(i + 1) % n].x * p[i].y;
+		cmd->reversed = area < 0.0;
+	}
+}
+
+static void add_command(struct display_list *dl, int op)
+{
+	struct display_command *cmd;
+	int count = dl->npoints - dl->path_start;
+
+	if (count < 2)
+		return;
+	if (!grow((void **)&dl->commands, &dl->commands_size, dl->ncommands + 1,
+			sizeof(struct display_command)))
+		return;
+	cmd = &dl->commands[dl->ncommands++];
+	memset(cmd, 0, sizeof(struct display_command));
+	cmd->op = op;
+	memcpy(cmd->color, dl->color, sizeof(cmd->color));
+	cmd->order = dl->order++;
+	cmd->first = dl->path_start;
+	cmd->count = count;
+	cmd->next  = -1;
+	classify(dl, cmd);
+}
+
+void display_list_stroke(struct display_list *dl, int preserve)
+{
+	add_command(dl, DISPLAY_STROKE);
+	if (!preserve)
+		dl->path_start = dl->npoints;
+}
+
+void display_list_fill(struct display_list *dl)
+{
+	add_command(dl, DISPLAY_FILL);
+	dl->path_start = dl->npoints;
+}
+
+static double stroke_margin(struct display_list *dl)
+{
+	return FILL_MARGIN + dl->line_width / 2.0;
+}
+
+static double margin(struct display_list *dl, struct display_command *cmd)
+{
+	return cmd->op == DISPLAY_STROKE ? stroke_margin(dl) : FILL_MARGIN;
+}
+
+static int bounds_overlap(const double *a, const double *b, double m)
+{
+	return a[0] - m <= b[2] && b[0] - m <= a[2]
+		&& a[1] - m <= b[3] && b[1] - m <= a[3];
+}
+
+/* Is there a line, along one of the edges of a or b, with a on one side
+ * and b on the other? */
+static int separated_by_edges_of(struct display_list *dl,
+	struct display_command *a, struct display_command *b, double m)
+{
+	struct display_point *p = dl->points + a->first;
+
+	for (int i = 0; i < a->count; i++) {
+		struct display_point *e0 = &p[i], *e1 = &p[(i + 1) % a->count];
+		double nx = e0->y - e1->y, ny = e1->x - e0->x;
+		double len = sqrt(nx * nx + ny * ny);
+		double amin = INFINITY, amax = -INFINITY, bmin = INFINITY, bmax = -INFINITY;
+
+		if (len == 0.0)
+			continue;
+		for (int j = 0; j < a->count; j++) {
+			double d = p[j].x * nx + p[j].y * ny;
+			if (d < amin) amin = d;
+			if (d > amax) amax = d;
+		}
+		for (int j = 0; j < b->count; j++) {
+			struct display_point *q = dl->points + b->first + j;
+			double d = q->x * nx + q->y * ny;
+			if (d < bmin) bmin = d;
+			if (d > bmax) bmax = d;
+		}
+		if (amax + m * len < bmin || bmax + m * len < amin)
+			return 1;
+	}
+	return 0;
+}
+
+static int commands_overlap(struct display_list *dl,
+	struct display_command *a, struct display_command *b)
+{
+	double m = margin(dl, a) + margin(dl, b);
+
+	if (!bounds_overlap(a->bounds, b->bounds, m))
+		return 0;
+	if (!a->convex || !b->convex)
+		return 1;
+	return !separated_by_edges_of(dl, a, b, m) && !separated_by_edges_of(dl, b, a, m);
+}
+
+static int batch_overlaps(struct display_list *dl, struct display_batch *batch,
+	struct display_command *cmd)
+{
+	if (!bounds_overlap(batch->bounds, cmd->bounds, stroke_margin(dl) + margin(dl, cmd)))
+		return 0;
+	for (int c = batch->head; c != -1; c = dl->commands[c].next) {
+		if (commands_overlap(dl, &dl->commands[c], cmd))
+			return 1;
+	}
+	return 0;
+}
+
+void display_list_optimize(struct display_list *dl)
+{
+	dl->nbatches = 0;
+	for (int c = 0; c < dl->ncommands; c++)
+	{
+		struct display_command *cmd = &dl->commands[c];
+		struct display_batch   *batch;
+		int stop = dl->nbatches > BATCH_WINDOW ? dl->nbatches - BATCH_WINDOW : 0;
+		int target = -1;
+
+		/* Walk back through what is already painted.  cmd may join a
+		 * batch of its own colour as long as nothing painted after that
+		 * batch overlaps it. */
+		for (int b = dl->nbatches - 1; b >= stop; b--) {
+			batch = &dl->batches[b];
+			if (batch->op == cmd->op && !memcmp(batch->color, cmd->color, sizeof(cmd->color))) {
+				/* a fill of several subpaths cannot be turned
+				 * round, so it only joins what it misses */
+				if (cmd->op != DISPLAY_FILL || cmd->subpaths == 1
+					|| !batch_overlaps(dl, batch, cmd))
+					target = b;
+				break;
+			}
+			if (batch_overlaps(dl, batch, cmd))
+				break;
+		}
+
+		if (target >= 0) {
+			batch = &dl->batches[target];
+			dl->commands[batch->tail].next = c;
+			batch->tail = c;
+			if (cmd->bounds[0] < batch->bounds[0]) batch->bounds[0] = cmd->bounds[0];
+			if (cmd->bounds[1] < batch->bounds[1]) batch->bounds[1] = cmd->bounds[1];
+			if (cmd->bounds[2] > batch->bounds[2]) batch->bounds[2] = cmd->bounds[2];
+			if (cmd->bounds[3] > batch->bounds[3]) batch->bounds[3] = cmd->bounds[3];
+			continue;
+		}
+
+		if (!grow((void **)&dl->batches, &dl->batches_size, dl->nbatches + 1,
+				sizeof(struct display_batch)))
+			return;
+		batch = &dl->batches[dl->nbatches++];
+		batch->op = cmd->op;
+		memcpy(batch->color, cmd->color, sizeof(batch->color));
+		memcpy(batch->bounds, cmd->bounds, sizeof(batch->bounds));
+		batch->head = batch->tail = c;
+	}
+}
+
+static void emit_path(cairo_t *cr, struct display_list *dl, struct display_command *cmd)
+{
+	struct display_point *p = dl->points + cmd->first;
+
+	if (cmd->reversed) {
+		cairo_move_to(cr, p[cmd->count - 1].x, p[cmd->count - 1].y);
+		for (int i = cmd->count - 2; i >= 0; i--)
+			cairo_line_to(cr, p[i].x, p[i].y);
+		return;
+	}
+	for (int i = 0; i < cmd->count; i++) {
+		if (i == 0 || p[i].move)
+			cairo_move_to(cr, p[i].x, p[i].y);
+		else
+			cairo_line_to(cr, p[i].x, p[i].y);
+	}
+}
+
+void display_list_submit(struct display_list *dl, cairo_t *cr)
+{
+	float current[3];
+	int   have_source = 0;
+
+	display_list_optimize(dl);
+	dl->batches_drawn  = dl->nbatches;
+	dl->source_changes = 0;
+	cairo_set_line_width(cr, dl->line_width);
+
+	for (int b = 0; b < dl->nbatches; b++)
+	{
+		struct display_batch *batch = &dl->batches[b];
+
+		if (!have_source || memcmp(current, batch->color, sizeof(current))) {
+			cairo_set_source_rgb(cr, batch->color[0], batch->color[1], batch->color[2]);
+			memcpy(current, batch->color, sizeof(current));
+			have_source = 1;
+			dl->source_changes++;
+		}
+		for (int c = batch->head; c != -1; c = dl->commands[c].next)
+			emit_path(cr, dl, &dl->commands[c]);
+		if (batch->op == DISPLAY_FILL)
+			cairo_fill(cr);
+		else
+			cairo_stroke(cr);
+	}
+}
@@ -0,0 +1,103 @@
+#ifndef DISPLAY_LIST_H
+#define DISPLAY_LIST_H
+/*
+ *  Copyright 2016 Kendall E. Blake
+ *
+ *  This file is part of cairo-test.
+ *
+ *  cairo-test is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published
+ *  by the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  cairo-test is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with cairo-test.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cairo.h>
+
+/* A frame's worth of drawing, kept back from cairo so it can be tidied up
+ * first.  The drawing primitives record projected polygons with their
+ * colours in painter's order; display_list_submit() then merges polygons
+ * of the same colour into one path wherever nothing painted between them
+ * overlaps, and sets the cairo source only when it actually changes.  The
+ * picture comes out the same with far fewer trips into the rasterizer. */
+
+/* cairo's default, and what the view uses at its design size */
+#define DISPLAY_LINE_WIDTH 2.0
+
+enum {
+	DISPLAY_FILL,
+	DISPLAY_STROKE
+};
+
+struct display_point
+{
+	double x, y;
+	int   move;         /* starts a new subpath */
+};
+
+struct display_command
+{
+	int      op;
+	float    color[3];
+	unsigned order;     /* position in painter's order */
+	int      first, count;
+	int      subpaths;
+	int      convex;    /* a single convex subpath */
+	int      reversed;  /* fill the points back to front */
+	double   bounds[4]; /* x0, y0, x1, y1 */
+	int      next;      /* next command in the same batch, or -1 */
+};
+
+struct display_batch
+{
+	int   op;
+	float  color[3];
+	double bounds[4];
+	int    head, tail;
+};
+
+struct display_list
+{
+	struct display_point   *points;
+	int                     npoints, points_size;
+	struct display_command *commands;
+	int                     ncommands, commands_size;
+	struct display_batch   *batches;
+	int                     nbatches, batches_size;
+	int                     path_start;
+	float                   color[3];
+	unsigned                order;
+	double                  line_width;
+
+	/* what the last submit sent to cairo */
+	int                     batches_drawn;
+	int                     source_changes;
+};
+
+void display_list_init(struct display_list *dl);
+void display_list_release(struct display_list *dl);
+/* Forget everything recorded, keeping the memory for the next frame. */
+void display_list_reset(struct display_list *dl);
+
+void display_list_set_color(struct display_list *dl, float r, float g, float b);
+/* Width of every stroke in the list; DISPLAY_LINE_WIDTH until set. */
+void display_list_set_line_width(struct display_list *dl, double width);
+void display_list_move_to(struct display_list *dl, double x, double y);
+void display_list_line_to(struct display_list *dl, double x, double y);
+/* Like cairo_stroke_preserve() / cairo_stroke() / cairo_fill(). */
+void display_list_stroke(struct display_list *dl, int preserve);
+void display_list_fill(struct display_list *dl);
+
+/* Work out the batches for what has been recorded. */
+void display_list_optimize(struct display_list *dl);
+/* Optimize and draw everything recorded onto cr. */
+void display_list_submit(struct display_list *dl, cairo_t *cr);
+
+#endif
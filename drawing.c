@@ -18,18 +18,35 @@
  */
 
 #include <math.h> // powf
+#include <stdio.h>
 
 #include <SDL.h>
 #include <cairo.h>
 
+#include "display_list.h"
 #include "drawing.h"
 
 #define INCHES(x) ((x)/12.0)
 
-static const int height = 480;
-static const int width  = 480;
-static const int door_height = 7.0;
-static const int door_width  = 5.0;
+/* The view was drawn for 480x480; line widths and text scale from there. */
+#define DESIGN_SIZE 480
+
+static int height = DESIGN_SIZE;
+static int width  = DESIGN_SIZE;
+/* A size of the calling thread's own, if it has set one. */
+static _Thread_local int thread_height = 0;
+static _Thread_local int thread_width  = 0;
+
+/* Level of detail.  Below these projected heights, in pixels at the
+ * design size, faces lose their outlines, chests become a single box and
+ * ladders lose their rungs. */
+#define LOD_OUTLINE_MIN 12.0
+#define LOD_CHEST_MIN   12.0
+#define LOD_RUNG_MIN     4.0
+
+static int lod_enabled = 1;
+static const int door_height = DOOR_HEIGHT;
+static const int door_width  = DOOR_WIDTH;
 
 static const int chest_height = INCHES(18.0);
 static const int chest_width  = INCHES(22.0);
@@ -40,94 +57,260 @@ const float ladder_width    = 2.0;
 const float rung_spacing    = 1.1;
 const float ladder_box_side = 4.0;
 
-static float left_bias = 0.0;
+static _Thread_local float left_bias = 0.0;
+/* Where the eye is, for moves and turns part way done: how far it has
+ * come forward, and how far across the picture is panned, in tenths of
+ * the view. */
+static _Thread_local float eye_depth = 0.0;
+static _Thread_local float eye_pan = 0.0;
+static _Thread_local struct display_list *recording;
+
+/* Distance fog.  Every colour below, faded towards the black background
+ * for each row of depth, is worked out once by drawing_set_fog(). */
+#define FOG_ROWS 64
+
+static const float inks[INK_COUNT][3] = {
+	{ 1.0, 1.0, 1.0 },
+	{ 102.0/255.0, 81.0/255.0, 70.0/255.0 },
+	{ 141.0/255.0, 101.0/255.0, 56.0/255.0 },
+	{ 1.0, 1.0, 1.0 },
+	{ 0.5, 0.5, 0.0 },
+	{ 0.60, 0.450, 0.30 },
+	{ 0.50, 0.350, 0.25 }
+};
+
+static int   fog_enabled = 0;
+static float fog_amount[FOG_ROWS];
+static float fog_inks[FOG_ROWS][INK_COUNT][3];
+static _Thread_local int depth = 0;
+
+/* Everything below draws through these, so that a frame can be recorded
+ * into a display list instead of going straight to cairo. */
+static void set_color(cairo_t *cr, float r, float g, float b)
+{
+	if (recording)
+		display_list_set_color(recording, r, g, b);
+	else
+		cairo_set_source_rgb(cr, r, g, b);
+}
+
+static void path_to(cairo_t *cr, double x, double y, int move)
+{
+	if (recording && move)
+		display_list_move_to(recording, x, y);
+	else if (recording)
+		display_list_line_to(recording, x, y);
+	else if (move)
+		cairo_move_to(cr, x, y);
+	else
+		cairo_line_to(cr, x, y);
+}
+
+static void stroke_preserve(cairo_t *cr)
+{
+	if (recording)
+		display_list_stroke(recording, 1);
+	else
+		cairo_stroke_preserve(cr);
+}
+
+static void stroke(cairo_t *cr)
+{
+	if (recording)
+		display_list_stroke(recording, 0);
+	else
+		cairo_stroke(cr);
+}
+
+static void fill(cairo_t *cr)
+{
+	if (recording)
+		display_list_fill(recording);
+	else
+		cairo_fill(cr);
+}
+
+void drawing_record(struct display_list *dl)
+{
+	recording = dl;
+}
+
+void drawing_set_lod(int enabled)
+{
+	lod_enabled = enabled;
+}
+
+/* How tall something size feet tall at distance comes out, in pixels at
+ * the design size; see eye_3_to_2(). */
+static float projected(float size, float distance)
+{
+	return size / 10.0 * DESIGN_SIZE * pow(2, 0-(distance / 10.0));
+}
+
+static int detailed(float size, float distance, float threshold)
+{
+	return !lod_enabled || projected(size, distance) >= threshold;
+}
+
+int drawing_outlined(float size, float distance)
+{
+	return detailed(size, distance, LOD_OUTLINE_MIN);
+}
+
+/* Outline the current path, keeping it for the fill, unless the face is
+ * too small on screen for the outline to show. */
+static void outline(cairo_t *cr, float size, float distance)
+{
+	if (detailed(size, distance, LOD_OUTLINE_MIN))
+		stroke_preserve(cr);
+}
+
+void drawing_set_fog(int start, int end)
+{
+	fog_enabled = start < end;
+	for (int row = 0; row < FOG_ROWS; row++)
+	{
+		float amount = 0.0;
+
+		if (fog_enabled && row >= start)
+			amount = row >= end ? 1.0 : (float)(row - start + 1) / (end - start + 1);
+		fog_amount[row] = amount;
+		for (int i = 0; i < INK_COUNT; i++)
+		for (int c = 0; c < 3; c++)
+			fog_inks[row][i][c] = inks[i][c] * (1.0 - amount);
+	}
+}
+
+float drawing_fog(int steps)
+{
+	if (!fog_enabled)
+		return 0.0;
+	return fog_amount[steps < 0 ? 0 : steps >= FOG_ROWS ? FOG_ROWS - 1 : steps];
+}
+
+void drawing_set_eye(float depth, float pan)
+{
+	eye_depth = depth;
+	eye_pan = pan;
+}
+
+void drawing_set_depth(int steps)
+{
+	depth = steps < 0 ? 0 : steps >= FOG_ROWS ? FOG_ROWS - 1 : steps;
+}
+
+const float *drawing_ink(int i)
+{
+	return fog_enabled ? fog_inks[depth][i] : inks[i];
+}
+
+static void ink(cairo_t *cr, int i)
+{
+	const float *c = drawing_ink(i);
+	set_color(cr, c[0], c[1], c[2]);
+}
 
 void ladder_outline_color(cairo_t *cr)
 {
-	cairo_set_source_rgb(cr, 1.0, 1.0, 1.0);
+	ink(cr, INK_LADDER_OUTLINE);
 }
 
 void chest_outline_color(cairo_t *cr)
 {
-	cairo_set_source_rgb(cr, 102.0/255.0, 81.0/255.0, 70.0/255.0);
+	ink(cr, INK_CHEST_OUTLINE);
 }
 
 void chest_fill_color(cairo_t *cr)
 {
-	cairo_set_source_rgb(cr, 141.0/255.0, 101.0/255.0, 56.0/255.0);
+	ink(cr, INK_CHEST_FILL);
 }
 
 void door_outline_color(cairo_t *cr)
 {
-	cairo_set_source_rgb(cr, 1.0, 1.0, 1.0);
+	ink(cr, INK_DOOR_OUTLINE);
 }
 
 void door_fill_color(cairo_t *cr)
 {
-	cairo_set_source_rgb(cr, 0.5, 0.5, 0.0);
+	ink(cr, INK_DOOR_FILL);
 }
 
 void wall_color_light(cairo_t *cr)
 {
-	cairo_set_source_rgb(cr, 0.60, 0.450, 0.30);
-	
+	ink(cr, INK_WALL_LIGHT);
 }
+
 void wall_color_dark(cairo_t *cr)
 {
-	cairo_set_source_rgb(cr, 0.50, 0.350, 0.25);
+	ink(cr, INK_WALL_DARK);
 }
 
 void eye_3_to_2(float x, float y, float z, float *out_x, float *out_y)
 {
 	float z_coeff  = 0.0;
 	
-	z_coeff = pow(2, 0-(z / 10.0));
+	z_coeff = pow(2, 0-((z - eye_depth) / 10.0));
 
-	*out_x = (x-5) * z_coeff + 5.0;
+	*out_x = (x-5) * z_coeff + 5.0 + eye_pan;
 	*out_y = (y-5) * z_coeff + 5.0;
 }
 
-void convert_cairo3(cairo_t *cr, float x, float y, float z, void (*fn)(cairo_t *, double, double))
+void convert_cairo3(cairo_t *cr, float x, float y, float z, int move)
 {
 	float x2, y2;
 	eye_3_to_2(x, y, z, &x2, &y2);
-	fn(cr, (x2/10.0 * width), (10.0 - y2)/10.0 * height);
+	path_to(cr, (x2/10.0 * display_width()), (10.0 - y2)/10.0 * display_height(), move);
 }
 
 void move_to_3(cairo_t *cr, float x, float y, float z)
 {
-	convert_cairo3(cr, x, y, z, cairo_move_to);
+	convert_cairo3(cr, x, y, z, 1);
 }
 
 void line_to_3(cairo_t *cr, float x, float y, float z)
 {
-	convert_cairo3(cr, x, y, z, cairo_line_to);
+	convert_cairo3(cr, x, y, z, 0);
 }
 
 void wall(cairo_t *cr, float distance)
+{
+	wall_span(cr, distance, 10.0);
+}
+
+/* A wall facing us, width wide from left_bias.  A run of wall faces along
+ * a row is still one flat rectangle on screen. */
+void wall_span(cairo_t *cr, float distance, float width)
 {
 	wall_color_dark(cr);
 	move_to_3(cr, left_bias, 0.0, distance);
-	line_to_3(cr, left_bias + 10.0, 0.0, distance);
-	line_to_3(cr, left_bias + 10.0, 10.0, distance);
+	line_to_3(cr, left_bias + width, 0.0, distance);
+	line_to_3(cr, left_bias + width, 10.0, distance);
 	line_to_3(cr, left_bias, 10.0, distance);
 	line_to_3(cr, left_bias, 0.0, distance);
-	cairo_stroke_preserve(cr);
+	outline(cr, 10.0, distance);
 	wall_color_light(cr);
-	cairo_fill(cr);
+	fill(cr);
 }
 
 void left_wall(cairo_t *cr, float distance)
+{
+	left_wall_span(cr, distance, 10.0);
+}
+
+/* A side wall running depth feet away from distance.  Its top and bottom
+ * edges head straight for the vanishing point, so a run of side walls
+ * down a corridor is still one quadrilateral on screen. */
+void left_wall_span(cairo_t *cr, float distance, float depth)
 {
 	wall_color_dark(cr);
 	move_to_3(cr, left_bias, 0.0, distance);
-	line_to_3(cr, left_bias, 0.0, distance+10.0);
-	line_to_3(cr, left_bias, 10.0, distance+10.0);
+	line_to_3(cr, left_bias, 0.0, distance+depth);
+	line_to_3(cr, left_bias, 10.0, distance+depth);
 	line_to_3(cr, left_bias, 10.0, distance);
 	line_to_3(cr, left_bias, 0.0, distance);
-	cairo_stroke_preserve(cr);
+	outline(cr, 10.0, distance);
 	wall_color_light(cr);
-	cairo_fill(cr);
+	fill(cr);
 }
 
 void left_door(cairo_t *cr, float distance)
@@ -139,9 +322,9 @@ void left_door(cairo_t *cr, float distance)
 	line_to_3(cr, left_bias, door_height, distance+door_width);
 	line_to_3(cr, left_bias, 0.0, distance+door_width);
 	line_to_3(cr, left_bias, 0.0, distance);
-	cairo_stroke_preserve(cr);
+	outline(cr, door_height, distance);
 	door_fill_color(cr);
-	cairo_fill(cr);
+	fill(cr);
 }
 
 void right_door(cairo_t *cr, float distance)
@@ -153,9 +336,9 @@ void right_door(cairo_t *cr, float distance)
 	line_to_3(cr, left_bias + 10.0, door_height, distance+door_width);
 	line_to_3(cr, left_bias + 10.0, 0.0, distance+door_width);
 	line_to_3(cr, left_bias + 10.0, 0.0, distance);
-	cairo_stroke_preserve(cr);
+	outline(cr, door_height, distance);
 	door_fill_color(cr);
-	cairo_fill(cr);
+	fill(cr);
 }
 
 void door(cairo_t *cr, float distance)
@@ -168,9 +351,9 @@ void door(cairo_t *cr, float distance)
 	line_to_3(cr, left_bias + door_start+door_width, door_height, distance);
 	line_to_3(cr, left_bias + door_start+door_width, 0.0, distance);
 	line_to_3(cr, left_bias + door_start, 0.0, distance);
-	cairo_stroke_preserve(cr);
+	outline(cr, door_height, distance);
 	door_fill_color(cr);
-	cairo_fill(cr);
+	fill(cr);
 }
 
 void open_door(cairo_t *cr, float distance)
@@ -188,9 +371,9 @@ void open_door(cairo_t *cr, float distance)
 	line_to_3(cr, left_bias + 10.0, 10.0, distance);
 	line_to_3(cr, left_bias, 10.0, distance);
 	line_to_3(cr, left_bias, 0.0, distance);
-	cairo_stroke_preserve(cr);
+	stroke_preserve(cr);
 	wall_color_dark(cr);
-	cairo_fill(cr);
+	fill(cr);
 }
 
 void open_door_side(cairo_t *cr)
@@ -205,18 +388,18 @@ void open_door_side(cairo_t *cr)
 	line_to_3(cr, wall_start + wall_depth, door_height, jamb_dist);
 	line_to_3(cr, wall_start + wall_depth, 0.0, jamb_dist);
 	line_to_3(cr, wall_start, 0.0, jamb_dist);
-	cairo_stroke_preserve(cr);
+	stroke_preserve(cr);
 	door_fill_color(cr);
-	cairo_fill(cr);
+	fill(cr);
 	door_outline_color(cr);
 	move_to_3(cr, wall_start, door_height, jamb_dist);
 	line_to_3(cr, wall_start, 10.0, 0.0);
 	line_to_3(cr, wall_start + wall_depth, 10.0, 0.0);
 	line_to_3(cr, wall_start + wall_depth, door_height, jamb_dist);
 	line_to_3(cr, wall_start, door_height, jamb_dist);
-	cairo_stroke_preserve(cr);
+	stroke_preserve(cr);
 	door_fill_color(cr);
-	cairo_fill(cr);
+	fill(cr);
 }
 
 void chest(cairo_t *cr, float distance)
@@ -230,6 +413,20 @@ void chest(cairo_t *cr, float distance)
 		front_z = distance + (10.0 - chest_depth) / 2.0
 	;
 
+	if (!detailed(chest_height, front_z, LOD_CHEST_MIN)) {
+		/* one box: the front and top faces together */
+		move_to_3(cr, left_x, bottom_y, front_z);
+		line_to_3(cr, left_x, top_y, front_z);
+		line_to_3(cr, left_x, top_y, back_z);
+		line_to_3(cr, right_x, top_y, back_z);
+		line_to_3(cr, right_x, top_y, front_z);
+		line_to_3(cr, right_x, bottom_y, front_z);
+		line_to_3(cr, left_x, bottom_y, front_z);
+		chest_fill_color(cr);
+		fill(cr);
+		return;
+	}
+
 	// back
 	chest_outline_color(cr);
 	move_to_3(cr, left_x, bottom_y, back_z);
@@ -237,9 +434,9 @@ void chest(cairo_t *cr, float distance)
 	line_to_3(cr, right_x, top_y, back_z);
 	line_to_3(cr, right_x, bottom_y, back_z);
 	line_to_3(cr, left_x, bottom_y, back_z);
-	cairo_stroke_preserve(cr);
+	outline(cr, chest_height, front_z);
 	chest_fill_color(cr);
-	cairo_fill(cr);
+	fill(cr);
 
 	// bottom
 	chest_outline_color(cr);
@@ -248,9 +445,9 @@ void chest(cairo_t *cr, float distance)
 	line_to_3(cr, right_x, bottom_y, front_z);
 	line_to_3(cr, right_x, bottom_y, back_z);
 	line_to_3(cr, left_x, bottom_y, back_z);
-	cairo_stroke_preserve(cr);
+	outline(cr, chest_height, front_z);
 	chest_fill_color(cr);
-	cairo_fill(cr);
+	fill(cr);
 
 	// left
 	chest_outline_color(cr);
@@ -259,9 +456,9 @@ void chest(cairo_t *cr, float distance)
 	line_to_3(cr, left_x, top_y, front_z);
 	line_to_3(cr, left_x, top_y, back_z);
 	line_to_3(cr, left_x, bottom_y, back_z);
-	cairo_stroke_preserve(cr);
+	outline(cr, chest_height, front_z);
 	chest_fill_color(cr);
-	cairo_fill(cr);
+	fill(cr);
 
 	// right
 	chest_outline_color(cr);
@@ -270,9 +467,9 @@ void chest(cairo_t *cr, float distance)
 	line_to_3(cr, right_x, top_y, front_z);
 	line_to_3(cr, right_x, top_y, back_z);
 	line_to_3(cr, right_x, bottom_y, back_z);
-	cairo_stroke_preserve(cr);
+	outline(cr, chest_height, front_z);
 	chest_fill_color(cr);
-	cairo_fill(cr);
+	fill(cr);
 
 	// top
 	chest_outline_color(cr);
@@ -281,9 +478,9 @@ void chest(cairo_t *cr, float distance)
 	line_to_3(cr, right_x, top_y, front_z);
 	line_to_3(cr, right_x, top_y, back_z);
 	line_to_3(cr, left_x, top_y, back_z);
-	cairo_stroke_preserve(cr);
+	outline(cr, chest_height, front_z);
 	chest_fill_color(cr);
-	cairo_fill(cr);
+	fill(cr);
 
 	// front
 	chest_outline_color(cr);
@@ -292,9 +489,9 @@ void chest(cairo_t *cr, float distance)
 	line_to_3(cr, right_x, top_y, front_z);
 	line_to_3(cr, right_x, bottom_y, front_z);
 	line_to_3(cr, left_x, bottom_y, front_z);
-	cairo_stroke_preserve(cr);
+	outline(cr, chest_height, front_z);
 	chest_fill_color(cr);
-	cairo_fill(cr);
+	fill(cr);
 }
 
 void draw_ladder(cairo_t *cr, float distance,
@@ -306,11 +503,11 @@ void draw_ladder(cairo_t *cr, float distance,
 	/* The ladder */
 	move_to_3(cr, left_bias + ladder_left, ladder_bottom, halfway);
 	line_to_3(cr, left_bias + ladder_left, ladder_top, halfway);
-	cairo_stroke(cr);
+	stroke(cr);
 	move_to_3(cr, left_bias + ladder_right, ladder_bottom, halfway);
 	line_to_3(cr, left_bias + ladder_right, ladder_top, halfway);
-	cairo_stroke(cr);
-	{ /* rungs */
+	stroke(cr);
+	if (detailed(rung_spacing, halfway, LOD_RUNG_MIN)) { /* rungs */
 		float rung;
 		if (ladder_bottom > 0) {
 			rung = ladder_bottom + rung_spacing;
@@ -322,22 +519,27 @@ void draw_ladder(cairo_t *cr, float distance,
 		for (; rung < ladder_top; rung += rung_spacing) {
 			move_to_3(cr, left_bias + ladder_left, rung, halfway);
 			line_to_3(cr, left_bias + ladder_right, rung, halfway);
-			cairo_stroke(cr);
+			stroke(cr);
 		}
 	}
 }
 
 void right_wall(cairo_t *cr, float distance)
+{
+	right_wall_span(cr, distance, 10.0);
+}
+
+void right_wall_span(cairo_t *cr, float distance, float depth)
 {
 	wall_color_light(cr);
 	move_to_3(cr, left_bias + 10.0, 0.0, distance);
-	line_to_3(cr, left_bias + 10.0, 0.0, distance+10.0);
-	line_to_3(cr, left_bias + 10.0, 10.0, distance+10.0);
+	line_to_3(cr, left_bias + 10.0, 0.0, distance+depth);
+	line_to_3(cr, left_bias + 10.0, 10.0, distance+depth);
 	line_to_3(cr, left_bias + 10.0, 10.0, distance);
 	line_to_3(cr, left_bias + 10.0, 0.0, distance);
-	cairo_stroke_preserve(cr);
+	outline(cr, 10.0, distance);
 	wall_color_dark(cr);
-	cairo_fill(cr);
+	fill(cr);
 }
 
 void ladder_down(cairo_t *cr, float distance)
@@ -378,7 +580,8 @@ void ladder_up(cairo_t *cr, float distance)
 
 void do_door(cairo_t *cr, float dist)
 {
-	if (dist == 0.0) {
+	/* the door stands open from the moment the eye sets off into it */
+	if (dist - eye_depth < 10.0) {
 		open_door(cr, dist);
 	} else {
 		wall(cr, dist);
@@ -411,10 +614,39 @@ void set_left_bias(float amount)
 
 float display_height ()
 {
-	return height;
+	return thread_height ? thread_height : height;
 }
 
 float display_width ()
 {
-	return width;
+	return thread_width ? thread_width : width;
+}
+
+void display_set_size (int w, int h)
+{
+	width  = w;
+	height = h;
+}
+
+void display_set_thread_size (int w, int h)
+{
+	thread_width  = w;
+	thread_height = h;
+}
+
+int display_parse_size (const char *spec, int *w, int *h)
+{
+	char end;
+
+	return sscanf(spec, "%dx%d%c", w, h, &end) == 2 && *w > 0 && *h > 0;
+}
+
+float display_row_height (int steps)
+{
+	return display_height() * pow(2, 0-steps);
+}
+
+float display_scale ()
+{
+	return display_height() / DESIGN_SIZE;
 }
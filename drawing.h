@@ -19,13 +19,61 @@
  *  along with cairo-test.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <cairo.h>
+
+#include "display_list.h"
+
+/* Record everything drawn on this thread into dl rather than drawing it,
+ * until called again with NULL. */
+void drawing_record(struct display_list *dl);
+/* Draw distant faces more simply (1, the default) or everything in full. */
+void drawing_set_lod(int enabled);
+/* Fade colours towards black from row start, reaching it at row end;
+ * start >= end turns fog off, as it starts. */
+void drawing_set_fog(int start, int end);
+/* How far faded (0 to 1) colours are steps rows out. */
+float drawing_fog(int steps);
+/* Draw as if the eye were depth feet further forward, and the picture
+ * panned pan tenths of its width to the right. */
+void drawing_set_eye(float depth, float pan);
+/* Colour what is drawn from now on as if it were steps rows out. */
+void drawing_set_depth(int steps);
+
+/* The colours everything is drawn in. */
+enum {
+	INK_LADDER_OUTLINE,
+	INK_CHEST_OUTLINE,
+	INK_CHEST_FILL,
+	INK_DOOR_OUTLINE,
+	INK_DOOR_FILL,
+	INK_WALL_LIGHT,
+	INK_WALL_DARK,
+	INK_COUNT
+};
+
+/* An ink as it comes out at the depth last set, fog and all. */
+const float *drawing_ink(int ink);
+/* Nonzero if a face size feet tall at distance is big enough on screen
+ * to be outlined. */
+int drawing_outlined(float size, float distance);
+
+/* Doors are this many feet wide, in the middle of their wall, and tall. */
+#define DOOR_WIDTH  5.0
+#define DOOR_HEIGHT 7.0
+
+/* Project a point in view space onto the picture, both in tenths. */
+void eye_3_to_2(float x, float y, float z, float *out_x, float *out_y);
+
 void wall(cairo_t *cr, float distance);
+void wall_span(cairo_t *cr, float distance, float width);
 void left_wall(cairo_t *cr, float distance);
+void left_wall_span(cairo_t *cr, float distance, float depth);
 void left_door(cairo_t *cr, float distance);
 void right_door(cairo_t *cr, float distance);
 void door(cairo_t *cr, float distance);
 void open_door(cairo_t *cr, float distance);
 void right_wall(cairo_t *cr, float distance);
+void right_wall_span(cairo_t *cr, float distance, float depth);
 void do_door(cairo_t *cr, float dist);
 void both_walls(cairo_t *cr, float dist);
 void both_doors(cairo_t *cr, float dist);
@@ -37,5 +85,16 @@ float modify_left_bias(float amount);
 void set_left_bias(float amount);
 float display_height();
 float display_width();
+/* Set the size, in pixels, of the surface views are painted for. */
+void display_set_size(int width, int height);
+/* Paint at width x height on the calling thread alone, whatever size the
+ * others are set to; 0 x 0 goes back to the shared size. */
+void display_set_thread_size(int width, int height);
+/* Read "WxH"; nonzero if it was one. */
+int display_parse_size(const char *spec, int *width, int *height);
+/* How tall, in pixels, a wall steps rows out comes out. */
+float display_row_height(int steps);
+/* How much bigger than its design size the view is drawn. */
+float display_scale();
 
 #endif
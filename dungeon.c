@@ -20,287 +20,372 @@
 #define _GNU_SOURCE
 #include <math.h> // powf
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
 
 #include <SDL.h>
 #include <cairo.h>
 
-#include "direction.h"
+#ifdef ALLOC_DEBUG
+#include "alloc_debug.h"
+#endif
+#include "atlas.h"
+#include "capture.h"
 #include "drawing.h"
+#include "game.h"
+#include "journal.h"
 #include "map.h"
 #include "map_loader.h"
+#include "map_watch.h"
+#include "message_log.h"
 #include "player.h"
-
-#define message printf
-struct map * current_map;
+#include "recording.h"
+#include "view.h"
+#include "view_thread.h"
+#include "world.h"
 
 SDL_Window   *window;
 SDL_Renderer *renderer;
 SDL_Texture  *texture, *stats_texture;
+struct atlas *atlas;
+struct capture *capture;
+/* A copy of the pixels last put on the view's texture, kept for capture
+ * only, and the size of the frame they came from. */
+unsigned char *shown_view;
+size_t         shown_view_size;
+int            shown_view_width, shown_view_height;
+
+/* Sizes in window points; everything on screen is these times dpi_scale. */
+#define PANEL_POINTS 240
+#define MIN_VIEW     64
+
+int   view_points = 480;
+float dpi_scale = 1.0;
+int   panel_size = PANEL_POINTS;
 
 int stats_height()
 {
-	return 240;
+	return panel_size;
 }
 
 int stats_width()
 {
-	return display_width()+240;
+	return display_width() + panel_size;
 }
 
-int window_height()
+SDL_Texture *make_texture(SDL_Texture *old, int w, int h)
 {
-	return display_height() + stats_height() + 2;
+	if (old)
+		SDL_DestroyTexture(old);
+	return SDL_CreateTexture(
+		renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, w, h);
 }
 
-int window_width()
+/* The panel's font, looked up once rather than every frame. */
+cairo_font_face_t *mono_font(void)
 {
-	return stats_width() + 2;
-}
+	static cairo_font_face_t *mono;
 
-void window_setup (void)
-{
-	SDL_Init(SDL_INIT_EVERYTHING);
-	window   = SDL_CreateWindow("Cairo!", 20, 20,
-		window_width(), window_height(), 0);
-	renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED);
-	texture  = SDL_CreateTexture(
-		renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING,
-		display_width(), display_height()
-	);
-	stats_texture = SDL_CreateTexture(
-		renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING,
-		stats_width(), stats_height()
-	);
+	if (!mono)
+		mono = cairo_toy_font_face_create("Mono", CAIRO_FONT_SLANT_NORMAL,
+			CAIRO_FONT_WEIGHT_NORMAL);
+	return mono;
 }
 
-typedef void (*drawing_fn_t)(cairo_t *, int, int, int, float);
+/* The message log fills the panel under the gold count.  Its lines stay
+ * laid out on a surface of their own: new lines scroll the old ones up
+ * with a blit and only the new ones are drawn. */
+cairo_surface_t *log_surface;
+cairo_t         *log_cr;
+unsigned long    log_shown;     /* message_log_count() when last drawn */
 
-void draw_square (cairo_t *cr, int approach, int x, int y, float dist, drawing_fn_t drawfn)
+int log_top(void)
 {
-	if (y >= 0 && y < map_height(current_map))
-	if (x >= 0 && x < map_width(current_map))
-	{
-		drawfn(cr, approach, x, y, dist);
-	}
-	if (approach < 0) modify_left_bias(10.0);
-	if (approach > 0) modify_left_bias(-10.0);
+	return (int)(30.0 * dpi_scale + 0.5);
 }
 
-void iterate_east (cairo_t *cr, int steps, drawing_fn_t drawfn)
+int log_line_height(void)
 {
-	float dist = steps * 10.0;
-	int x = player_x() + steps;
-
-	if (x >= map_width(current_map))
-		return;
-
-	modify_left_bias(-10.0);
-	for (int y = player_y() - steps-1; y < player_y(); y++)
-	{
-		draw_square (cr, y-player_y(), x, y, dist, drawfn);
-	}
-	set_left_bias(steps * 10.0);
-	modify_left_bias(10.0);
-	for (int y = player_y() + steps+1; y >= player_y();  y--)
-	{
-		draw_square (cr, y-player_y(), x, y, dist, drawfn);
-	}
+	return (int)(20.0 * dpi_scale + 0.5);
 }
 
-void iterate_north (cairo_t *cr, int steps, drawing_fn_t drawfn)
+int log_rows(void)
 {
-	int y = player_y() - steps;
-	float dist = steps * 10.0;
+	int rows = (stats_height() - log_top()) / log_line_height();
 
-	if (y < 0)
-		return;
-
-	modify_left_bias(-10.0);
-	for (int x = player_x() - steps -1; x < player_x(); x++)
-	{
-		draw_square (cr, x-player_x(), x, y, dist, drawfn);
-	}
-	set_left_bias(steps * 10.0);
-	modify_left_bias(10.0);
-	for (int x = player_x() + steps +1; x >= player_x(); x--)
-	{
-		draw_square (cr, x-player_x(), x, y, dist, drawfn);
-	}
+	return rows < MESSAGE_LOG_LINES ? rows : MESSAGE_LOG_LINES;
 }
 
-void iterate_west (cairo_t *cr, int steps, drawing_fn_t drawfn)
+/* Throw away the laid-out lines; the next update lays out the whole log
+ * again at the new size. */
+void log_layout(void)
 {
-	int x = player_x() - steps;
-	float dist = steps * 10.0;
-
-	if (x < 0) return;
-
-	modify_left_bias(-10);
-	for (int y = player_y() + steps+ 1; y > player_y(); y--)
-	{
-		draw_square (cr, player_y()-y, x, y, dist, drawfn);
-	}
-	set_left_bias(steps * 10.0);
-	modify_left_bias(10);
-	for (int y = player_y() - steps -1; y <= player_y(); y++)
-	{
-		draw_square (cr, player_y()-y, x, y, dist, drawfn);
-	}
+	if (log_cr)
+		cairo_destroy(log_cr);
+	if (log_surface)
+		cairo_surface_destroy(log_surface);
+	log_cr = NULL;
+	log_surface = NULL;
 }
 
-void iterate_south (cairo_t *cr, int steps, drawing_fn_t drawfn)
+void log_update(void)
 {
-	int y = player_y() + steps;
-	float dist = steps * 10.0;
-	if (y > map_height(current_map)) return;
+	unsigned long  count = message_log_count();
+	int            rows = log_rows(), line = log_line_height(), fresh, stride;
+	unsigned char *data;
+	cairo_t       *cr;
 
-	modify_left_bias(-10.0);
-	for (int x = player_x() + steps + 1; x > player_x(); x--)
-	{
-		draw_square (cr, player_x()-x, x, y, dist, drawfn);
-	}
-	set_left_bias(10.0*steps);
-	modify_left_bias(10.0);
-	for (int x = player_x() - steps - 1; x <= player_x(); x++)
-	{
-		draw_square (cr, player_x()-x, x, y, dist, drawfn);
+	if (rows <= 0)
+		return;
+	if (!log_surface) {
+		log_surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32,
+			stats_width(), rows * line);
+		log_cr = cairo_create(log_surface);
+		log_shown = 0;
+		fresh = rows;
+	} else if (count == log_shown) {
+		return;
+	} else {
+		fresh = count - log_shown < (unsigned long)rows ? (int)(count - log_shown) : rows;
 	}
-}
 
-void (*iterator[])(cairo_t *, int, void (*fn)(cairo_t *, int, int, int, float))= {
-	iterate_north,
-	iterate_east,
-	iterate_south,
-	iterate_west
-};
+	cairo_surface_flush(log_surface);
+	data   = cairo_image_surface_get_data(log_surface);
+	stride = cairo_image_surface_get_stride(log_surface);
+	memmove(data, data + (size_t)fresh * line * stride, (size_t)(rows - fresh) * line * stride);
+	cairo_surface_mark_dirty(log_surface);
 
-int horizontal()
-{
-	return player_facing() == DIRECTION_EAST || player_facing() == DIRECTION_WEST;
-}
-
-int vertical()
-{
-	return player_facing() == DIRECTION_NORTH || player_facing() == DIRECTION_SOUTH;
-}
-
-void draw_flat_back (cairo_t *cr, int hand, int x, int y, float dist)
-{
-	hand = hand;
-	dist += 10.0;
-	switch (map_tile(current_map, x, y)) {
-		case 'X': wall(cr, dist); break;
-		case '|': if (horizontal()) { do_door(cr, dist); } else { wall(cr,dist); }; break;
-		case '-': if (vertical()) { do_door(cr, dist); } else { wall(cr,dist); };  break;
-		case '.': break;
-	}
-}
-
-void draw_flat_front (cairo_t *cr, int hand, int x, int y, float dist)
-{
-	hand = hand;
-	if (dist < 0.0) return;
-	switch (map_tile(current_map, x, y)) {
-		case 'X': break;
-		case '|': if (horizontal()) { do_door(cr, dist); return; } break;
-		case '-': if (vertical()) { do_door(cr, dist); return; }; break;
-		case '.': return;
-		default: return;
-	}
-	wall(cr, dist); 
-}
-
-void draw_core (cairo_t *cr, int hand, int x, int y, float dist)
-{
-	void (*wallfn)(cairo_t*,float) = right_wall;
-	void (*doorfn)(cairo_t*,float) = right_door;
-	if (hand > 0) wallfn = left_wall;
-	if (!hand) wallfn = both_walls;
-	if (!hand) doorfn = both_doors;
-	if (hand > 0) doorfn = left_door;
-
-	switch (map_tile(current_map, x, y)) {
-		case 'T': chest(cr, dist); break;
-		case 'X': wallfn(cr, dist); break;
-		case '|': wallfn(cr, dist); if (vertical ()) { doorfn(cr, dist); }; break;
-		case '-': wallfn(cr, dist); if (horizontal ()) { doorfn(cr, dist); }; break;
-		case 'D': ladder_down(cr, dist); break;
-		case 'U': ladder_up(cr, dist); break;
-		case '.': break;
+	cr = log_cr;
+	cairo_set_source_rgb(cr, 0.0, 0.0, 0.0);
+	cairo_rectangle(cr, 0, (rows - fresh) * line, stats_width(), fresh * line);
+	cairo_fill(cr);
+	cairo_set_source_rgb(cr, 255, 255, 255);
+	cairo_set_font_face(cr, mono_font());
+	cairo_set_font_size(cr, 16.0 * dpi_scale);
+	for (int row = rows - fresh; row < rows; row++) {
+		unsigned long n = count - rows + row;
+		const char   *text = count >= (unsigned long)(rows - row) ? message_log_line(n) : NULL;
+
+		if (text) {
+			cairo_move_to(cr, 10.0 * dpi_scale, row * line + 15.0 * dpi_scale);
+			cairo_show_text(cr, text);
+		}
 	}
-}
-
-void cairoize(SDL_Texture *t, int w, int h, cairo_surface_t **psurface, cairo_t **pcr)
-{
-	void *pixels;
-	int   pitch;
-
-	SDL_LockTexture(t, NULL, &pixels, &pitch);
-	{
-		*psurface =
-			cairo_image_surface_create_for_data(
-				pixels, CAIRO_FORMAT_ARGB32, w, h, pitch);
-		*pcr = cairo_create(*psurface);
+	cairo_surface_flush(log_surface);
+	log_shown = count;
+}
+
+/* The panel is drawn on a surface of its own, kept as long as the panel
+ * stays the same size, and copied to its texture. */
+cairo_surface_t *stats_surface;
+cairo_t         *stats_cr;
+
+void stats_layout(void)
+{
+	if (stats_cr)
+		cairo_destroy(stats_cr);
+	if (stats_surface)
+		cairo_surface_destroy(stats_surface);
+	stats_cr = NULL;
+	stats_surface = NULL;
+}
+
+/* Fit the view and panel to the window's drawable size, remaking only the
+ * textures whose size changed.  The view stays square. */
+void window_layout(void)
+{
+	int points_w, points_h, pixels_w, pixels_h, side, panel;
+	int old_width = display_width(), old_panel = panel_size;
+
+	SDL_GetWindowSize(window, &points_w, &points_h);
+	SDL_GetRendererOutputSize(renderer, &pixels_w, &pixels_h);
+	dpi_scale = points_w > 0 ? (float)pixels_w / points_w : 1.0;
+
+	panel = (int)(PANEL_POINTS * dpi_scale + 0.5);
+	side = pixels_w - panel - 2;
+	if (side > pixels_h - panel - 2)
+		side = pixels_h - panel - 2;
+	if (side < MIN_VIEW)
+		side = MIN_VIEW;
+
+	panel_size = panel;
+	display_set_size(side, side);
+	log_layout();
+	if (!texture || side != old_width)
+		texture = make_texture(texture, side, side);
+	if (!stats_texture || side != old_width || panel != old_panel) {
+		stats_texture = make_texture(stats_texture, stats_width(), stats_height());
+		stats_layout();
 	}
+	mark_dirty();
 }
 
-void decairoize(SDL_Texture *t, cairo_surface_t *cairo_surface, cairo_t *cr)
+void window_setup (void)
 {
-	cairo_destroy(cr);
-	// should I do this?
-	cairo_surface_destroy(cairo_surface);
-	SDL_UnlockTexture(t);
+	SDL_Init(SDL_INIT_EVERYTHING);
+	window   = SDL_CreateWindow("Cairo!", 20, 20,
+		view_points + PANEL_POINTS + 2, view_points + PANEL_POINTS + 2,
+		SDL_WINDOW_RESIZABLE | SDL_WINDOW_ALLOW_HIGHDPI);
+	renderer = SDL_CreateRenderer(window, -1,
+		SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
+	window_layout();
 }
 
 void paint_stats(void)
 {
-	cairo_surface_t *cairo_surface;
-	cairo_t         *cr;
+	cairo_t       *cr;
+	unsigned char *data;
+	int            stride;
 
-	cairoize(stats_texture, stats_width(), stats_height(), &cairo_surface, &cr);
+	if (!stats_surface) {
+		stats_surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32,
+			stats_width(), stats_height());
+		stats_cr = cairo_create(stats_surface);
+	}
+	cr = stats_cr;
 	// clear to black
 	cairo_set_source_rgb(cr, 0.0, 0.0, 0.0);
 	cairo_paint(cr);
 
 	cairo_set_source_rgb(cr, 255, 255, 255);
-	cairo_select_font_face(cr, "Mono", CAIRO_FONT_SLANT_NORMAL,
-		CAIRO_FONT_WEIGHT_NORMAL);
-	cairo_set_font_size(cr, 18.0);
-	cairo_move_to(cr, 10.0, 20.0);
+	cairo_set_font_face(cr, mono_font());
+	cairo_set_font_size(cr, 18.0 * dpi_scale);
+	cairo_move_to(cr, 10.0 * dpi_scale, 20.0 * dpi_scale);
 	{
-		char *buffer = NULL;
-		asprintf(&buffer, "Gold: %i", player_gold());
+		char buffer[32];
+		snprintf(buffer, sizeof buffer, "Gold: %i", player_gold());
 		cairo_show_text(cr, buffer);
-		free(buffer);
 	}
-	cairo_set_source_rgb(cr, 255, 255, 255);
-	decairoize(stats_texture, cairo_surface, cr);
+	cairo_surface_flush(stats_surface);
+	data   = cairo_image_surface_get_data(stats_surface);
+	stride = cairo_image_surface_get_stride(stats_surface);
+	/* the log is as wide as the panel: its rows go straight in */
+	log_update();
+	if (log_surface && data) {
+		int rows = cairo_image_surface_get_height(log_surface);
+
+		if (rows > stats_height() - log_top())
+			rows = stats_height() - log_top();
+		for (int row = 0; row < rows; row++)
+			memcpy(data + (size_t)(log_top() + row) * stride,
+				cairo_image_surface_get_data(log_surface)
+					+ (size_t)row * cairo_image_surface_get_stride(log_surface),
+				(size_t)stats_width() * 4);
+	}
+	if (data)
+		SDL_UpdateTexture(stats_texture, NULL, data, stride);
+	cairo_surface_mark_dirty(stats_surface);
 }
 
-void paint_view(void)
+/* While capturing, copy the view just put on the texture.  The view
+ * thread's frames are only lent until its next one is taken, and the
+ * window may be resized before the next capture, so capture works from a
+ * copy and the size it was taken at. */
+void keep_shown_view(const unsigned char *pixels, int stride, int width, int height)
 {
-	cairo_surface_t *cairo_surface;
-	cairo_t         *cr;
+	size_t need = (size_t)width * 4 * height;
 
-	cairoize(texture, display_width(), display_height(), &cairo_surface, &cr);
-	// clear to black
-	cairo_set_source_rgb(cr, 0.0, 0.0, 0.0);
-	cairo_paint(cr);
+	if (!capture)
+		return;
+	if (shown_view_size < need) {
+		unsigned char *bigger = realloc(shown_view, need);
 
-	cairo_set_source_rgb(cr, 255, 0, 0);
-	cairo_select_font_face(cr, "Sans", CAIRO_FONT_SLANT_NORMAL,
-		CAIRO_FONT_WEIGHT_NORMAL);
-	cairo_set_font_size(cr, 40.0);
-	cairo_move_to(cr, 10.0, 50.0);
-	cairo_show_text(cr, "Hello, world!");
-	cairo_set_source_rgb(cr, 255, 255, 255);
-	for (int steps = 5; steps >= 0; steps--) {
-		set_left_bias(steps * -10.0);
-		iterator[player_facing()] (cr, steps, draw_core);
-		set_left_bias(steps * -10.0);
-		iterator[player_facing()] (cr, steps, draw_flat_front);
+		if (!bigger) {
+			shown_view_width = shown_view_height = 0;
+			return;
+		}
+		shown_view = bigger;
+		shown_view_size = need;
+	}
+	for (int row = 0; row < height; row++)
+		memcpy(shown_view + (size_t)row * width * 4, pixels + (size_t)row * stride,
+			(size_t)width * 4);
+	shown_view_width = width;
+	shown_view_height = height;
+}
+
+/* Show the baked frame for this pose, if the atlas has one that still
+ * matches the map and was baked at the current size. */
+int paint_view_from_atlas(void)
+{
+	static uint32_t *baked;
+	static size_t    baked_size;
+	size_t           need = (size_t)display_width() * display_height();
+	int              pitch = display_width() * 4;
+
+	if (!atlas || atlas_frame_width(atlas) != display_width()
+			|| atlas_frame_height(atlas) != display_height())
+		return 0;
+	if (baked_size < need) {
+		uint32_t *bigger = realloc(baked, need * sizeof *baked);
+
+		if (!bigger)
+			return 0;
+		baked = bigger;
+		baked_size = need;
 	}
-	decairoize(texture, cairo_surface, cr);
+	if (!atlas_draw(atlas, current_map, player_x(), player_y(), player_facing(),
+			baked, pitch))
+		return 0;
+	SDL_UpdateTexture(texture, NULL, baked, pitch);
+	keep_shown_view((const unsigned char *)baked, pitch, display_width(), display_height());
+	return 1;
+}
+
+/* How long a step or a quarter turn takes to play out on screen. */
+#define MOTION_MS 160
+
+int                animating = 0;
+struct view_motion motion;
+Uint32             motion_start;
+/* What the view showed when it was last painted at rest. */
+struct view_cone   shown_cone;
+
+struct view_thread *view_thread;
+/* The renderer the view thread is asked to paint with. */
+int                 view_engine;
+/* The last pose handed to the view thread, the last of its frames put on
+ * screen, and the last handed over before the atlas showed a newer pose. */
+unsigned long       posted_serial = 0, shown_serial = 0, atlas_serial = 0;
+/* What the view thread's frames have allocated since the last report. */
+unsigned long       view_allocations = 0;
+
+/* Show the player's pose straight from the atlas if it has the frame, or
+ * hand it to the view thread to paint.  Nonzero if the view is already
+ * on the texture. */
+int paint_view(void)
+{
+	if (!animating)
+		view_cone_gather(current_map, player_x(), player_y(), player_facing(),
+			view_draw_distance(), &shown_cone);
+	if (!animating && paint_view_from_atlas()) {
+		atlas_serial = posted_serial;
+		return 1;
+	}
+	posted_serial = view_thread_post(view_thread, current_map,
+		player_x(), player_y(), player_facing(), animating ? &motion : NULL,
+		display_width(), display_height(), view_engine);
+	return 0;
+}
+
+/* Put the view thread's newest frame on the texture, unless the atlas has
+ * shown a newer pose or the window has changed size since. */
+int take_view_frame(void)
+{
+	const struct view_frame *frame = view_thread_frame(view_thread);
+
+	if (frame)
+		view_allocations += frame->allocations;
+	if (!frame || !frame->surface || frame->serial <= atlas_serial
+			|| frame->width != display_width() || frame->height != display_height())
+		return 0;
+	SDL_UpdateTexture(texture, NULL, cairo_image_surface_get_data(frame->surface),
+		cairo_image_surface_get_stride(frame->surface));
+	keep_shown_view(cairo_image_surface_get_data(frame->surface),
+		cairo_image_surface_get_stride(frame->surface), frame->width, frame->height);
+	shown_serial = frame->serial;
+	return 1;
 }
 
 void draw_frame (SDL_Rect r)
@@ -313,6 +398,23 @@ void draw_frame (SDL_Rect r)
 	SDL_RenderDrawRect(renderer, &r);
 }
 
+/* Copy what was just shown, the view above the panel, into the capture
+ * queue; the capture's thread does the rest.  Until the view has been
+ * painted at the window's new size, there is nothing to capture. */
+void capture_shown(void)
+{
+	unsigned char *panel = stats_surface ? cairo_image_surface_get_data(stats_surface) : NULL;
+
+	if (!capture || !panel || shown_view_width != display_width()
+			|| shown_view_height != display_height())
+		return;
+	capture_compose(capture, shown_view, shown_view_width * 4,
+		shown_view_width, shown_view_height,
+		panel, cairo_image_surface_get_stride(stats_surface),
+		cairo_image_surface_get_width(stats_surface),
+		cairo_image_surface_get_height(stats_surface), SDL_GetTicks());
+}
+
 void paint(void)
 {
 	SDL_RenderClear(renderer);
@@ -328,10 +430,14 @@ void paint(void)
 		SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
 	}
 	SDL_RenderPresent(renderer);
+	capture_shown();
 }
 
 void window_teardown (void)
 {
+	log_layout();
+	stats_layout();
+	SDL_DestroyTexture(stats_texture);
 	SDL_DestroyTexture(texture);
 	SDL_DestroyRenderer(renderer);
 	SDL_DestroyWindow(window);
@@ -343,127 +449,192 @@ void nap (void)
 	SDL_Delay(5000);
 }
 
-int dirty_flag = 0;
-
-void mark_dirty()
-{
-	dirty_flag = 1;
-}
-
-void mark_clean()
-{
-	dirty_flag = 0;
-}
-
-int is_dirty()
-{
-	return dirty_flag;
-}
-
-void on_moved(int oldx, int oldy, int newx, int newy)
-{
-	if (map_tile(current_map, newx, newy) == 'T') {
-		printf ("Arr, there be treasure here!\n");
-	}
-	if (strchr("|-", map_tile(current_map, oldx, oldy))) {
-		printf("A door creaks closed behind you\n");
-	}
-	if (strchr("|-", map_tile(current_map, newx, newy))) {
-		printf("The door opens\n");
-	}
-}
-
-void move_forward(void)
-{
-	int newx = player_x(), newy = player_y();
-	switch (player_facing()) {
-		case DIRECTION_EAST: newx += 1; break;
-		case DIRECTION_WEST: newx -= 1; break;
-		case DIRECTION_NORTH: newy -= 1; break;
-		case DIRECTION_SOUTH: newy += 1; break;
+int quitflag = 0;
+struct recording *recording;
+Uint32 session_start;
+struct map_watch *map_watch;
+struct journal *journal;
+/* The panel needs painting but the view does not. */
+int stats_stale = 0;
+
+/* Keys pressed since the last frame wait here, oldest first. */
+#define QUEUED_ACTIONS 64
+
+int queued[QUEUED_ACTIONS];
+int queue_count = 0;
+
+int moves_view(int action)
+{
+	return action == ACTION_FORWARD || action == ACTION_BACKWARD
+		|| action == ACTION_TURN_LEFT || action == ACTION_TURN_RIGHT;
+}
+
+/* Play every queued action into the game, each with all of its side
+ * effects, so that the next frame shows only where the burst left the
+ * player.  A single step or turn glides there; a burst that moved the
+ * player more than once, or one that lands while a glide is still playing
+ * out, is shown at rest so the picture never falls behind the keys. */
+void play_queued(void)
+{
+	struct view_motion from = { 0, 0, 0, 0.0 };
+	int moves = 0, glides = 0;
+
+	for (int i = 0; i < queue_count; i++) {
+		struct view_motion before = { player_x(), player_y(), player_facing(), 0.0 };
+
+		recording_add(recording, SDL_GetTicks() - session_start, queued[i]);
+		game_do_action(queued[i]);
+		journal_note_player(journal);
+		if (before.x != player_x() || before.y != player_y()
+				|| before.facing != player_facing()) {
+			from = before;
+			moves++;
+			glides += moves_view(queued[i]);
+		}
 	}
-	if (map_tile(current_map, newx, newy) != 'X') {
-		on_moved(player_x(), player_y(), newx, newy);
-		player_set_x(newx);
-		player_set_y(newy);
+	queue_count = 0;
+	if (moves == 1 && glides == 1 && !animating) {
+		motion = from;
+		motion_start = SDL_GetTicks();
+		animating = 1;
+	} else if (moves) {
+		animating = 0;
 		mark_dirty();
 	}
 }
 
-void move_backward(void)
+void act(int action)
 {
-	int newx = player_x(), newy = player_y();
-	switch (player_facing()) {
-		case DIRECTION_EAST: newx -= 1; break;
-		case DIRECTION_WEST: newx += 1; break;
-		case DIRECTION_NORTH: newy += 1; break;
-		case DIRECTION_SOUTH: newy -= 1; break;
-	}
-	if (map_tile(current_map, newx, newy) != 'X') {
-		on_moved(player_x(), player_y(), newx, newy);
-		player_set_x(newx);
-		player_set_y(newy);
-		mark_dirty();
-	}
+	if (queue_count == QUEUED_ACTIONS)
+		play_queued();
+	queued[queue_count++] = action;
 }
 
-void turn_right(void)
+/* Move the animation on to now. */
+void animate(void)
 {
-	player_turn_right();
+	if (!animating)
+		return;
+	motion.t = (float)(SDL_GetTicks() - motion_start) / MOTION_MS;
+	if (motion.t < 1.0)
+		return;
+	animating = 0;
 	mark_dirty();
 }
 
-void turn_left(void)
+#ifdef ALLOC_DEBUG
+/* Tell stderr about every frame that went to the heap, on this thread or
+ * the view thread. */
+void report_allocations (const struct alloc_count *before)
 {
-	player_turn_left();
-	mark_dirty();
-}
+	struct alloc_count now;
 
-int treasure_max ()
-{
-	return 10;
+	alloc_debug_count(&now);
+	if (now.allocations != before->allocations || view_allocations)
+		fprintf(stderr, "Frame allocated %lu times (%llu bytes), and %lu times painting the view\n",
+			now.allocations - before->allocations, now.bytes - before->bytes,
+			view_allocations);
+	view_allocations = 0;
 }
+#endif
 
-void do_get(void)
+/* Swap between painting the view and casting it, keeping to whichever
+ * painter was chosen on the command line. */
+void toggle_raycast (void)
 {
-	if (map_tile(current_map, player_x(), player_y()) == 'T') {
-		int gold = rand() % treasure_max() + 1;
-		player_modify_gold(gold);
-		message("You found %i gold!\n", gold);
-		map_set_tile(current_map, player_x(), player_y(), '.');
-		mark_dirty();
+	static int painter = VIEW_RENDER_CAIRO;
+
+	if (view_engine == VIEW_RENDER_RAYCAST) {
+		view_engine = painter;
+		message_log_add("Painting the view");
+	} else {
+		painter = view_engine;
+		view_engine = VIEW_RENDER_RAYCAST;
+		message_log_add("Raycasting the view");
 	}
+	mark_dirty();
 }
 
-int quitflag = 0;
-
 void handle_input (void)
 {
 	SDL_Event ev;
 
 	while (SDL_PollEvent(&ev)) {
 		switch (ev.type) {
+			case SDL_WINDOWEVENT:
+				if (ev.window.event == SDL_WINDOWEVENT_SIZE_CHANGED)
+					window_layout();
+				break;
 			case SDL_KEYDOWN: {
 				switch (ev.key.keysym.sym) {
-					case SDLK_UP: move_forward(); break;
-					case SDLK_DOWN: move_backward(); break;
-					case SDLK_LEFT: turn_left(); break;
-					case SDLK_RIGHT: turn_right(); break;
-					case SDLK_q: quitflag = 1;
-					case SDLK_g: do_get(); break;
+					case SDLK_UP: act(ACTION_FORWARD); break;
+					case SDLK_DOWN: act(ACTION_BACKWARD); break;
+					case SDLK_LEFT: act(ACTION_TURN_LEFT); break;
+					case SDLK_RIGHT: act(ACTION_TURN_RIGHT); break;
+					case SDLK_q: quitflag = 1; break;
+					case SDLK_g: act(ACTION_GET); break;
+					case SDLK_u: act(ACTION_UNDO); break;
+					case SDLK_r: toggle_raycast(); break;
 				}
 			}
 		}
 	}
 }
 
-void load_map ()
+void load_map (const char *path)
+{
+	current_map = load_map_from_path(path);
+	if (!current_map) {
+		fprintf(stderr, "Can't open map file: %s\n", path);
+		exit(1);
+	}
+}
+
+/* Take in any edit made to the map file since the last frame.  The view is
+ * repainted only if the edit reached what the player can see; the player
+ * stays where they are unless the map shrank out from under them. */
+void reload_map (void)
+{
+	struct view_cone cone;
+	long             changed = map_watch_update(map_watch, current_map);
+
+	if (!changed)
+		return;
+	if (changed < 0) {
+		message_log_add("Can't read the edited map; keeping this one");
+	} else {
+		message_log_add("Map reloaded, %ld tile%s changed", changed, changed == 1 ? "" : "s");
+		if (player_x() >= map_width(current_map))
+			player_set_x(map_width(current_map) - 1);
+		if (player_y() >= map_height(current_map))
+			player_set_y(map_height(current_map) - 1);
+		view_cone_gather(current_map, player_x(), player_y(), player_facing(),
+			view_draw_distance(), &cone);
+		if (cone.steps != shown_cone.steps
+				|| memcmp(cone.tiles, shown_cone.tiles, (size_t)VIEW_CONE_SIZE(cone.steps)))
+			mark_dirty();
+	}
+	stats_stale = 1;
+}
+
+/* Start an unbounded dungeon, with the player on the first open tile of
+ * the chunk at the origin. */
+void start_world (uint64_t seed)
 {
-	current_map = load_map_from_path("map");
+	current_map = map_new_world(seed);
 	if (!current_map) {
-		fprintf(stderr, "Can't open map file: %s\n", "map");
+		fprintf(stderr, "Can't make a world\n");
 		exit(1);
 	}
+	for (int i = 0; i < WORLD_CHUNK_TILES; i++) {
+		int x = i % WORLD_CHUNK, y = i / WORLD_CHUNK;
+		if (map_tile(current_map, x, y) == '.') {
+			player_set_x(x);
+			player_set_y(y);
+			break;
+		}
+	}
+	map_set_focus(current_map, player_x(), player_y());
 }
 
 void release_map()
@@ -472,24 +643,164 @@ void release_map()
 	current_map = NULL;
 }
 
+void usage(const char *name)
+{
+	fprintf(stderr, "usage: %s [--record file] [--save name] [--seed n] [--size points] [--atlas file]\n"
+		"\t[--renderer immediate|cairo|software|raycast] [--distance rows] [--fog row]\n"
+		"\t[--capture dir|file.y4m|file.rgb] [--log-stdout] [--no-watch] [--world seed | map]\n", name);
+	exit(2);
+}
+
 int main (int argc, char *argv[])
 {
-	if (argc > 1) {
-		printf ("All arguments to %s ignored.\n", argv[0]);
+	const char  *map_path = "map";
+	const char  *record_path = NULL, *capture_path = NULL;
+	const char  *save_path = NULL;
+	const char  *atlas_path = NULL;
+	unsigned int seed = (unsigned int)time(NULL);
+	int          distance = VIEW_STEPS, fog = -1;
+	int          world = 0, watch = 1;
+	uint64_t     world_seed = 0;
+
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "--record") && i + 1 < argc) {
+			record_path = argv[++i];
+		} else if (!strcmp(argv[i], "--save") && i + 1 < argc) {
+			save_path = argv[++i];
+		} else if (!strcmp(argv[i], "--capture") && i + 1 < argc) {
+			capture_path = argv[++i];
+		} else if (!strcmp(argv[i], "--size") && i + 1 < argc) {
+			view_points = atoi(argv[++i]);
+			if (view_points < MIN_VIEW)
+				usage(argv[0]);
+		} else if (!strcmp(argv[i], "--atlas") && i + 1 < argc) {
+			atlas_path = argv[++i];
+		} else if (!strcmp(argv[i], "--distance") && i + 1 < argc) {
+			distance = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "--fog") && i + 1 < argc) {
+			fog = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "--renderer") && i + 1 < argc) {
+			int renderer = view_renderer_from_name(argv[++i]);
+			if (renderer < 0)
+				usage(argv[0]);
+			view_set_renderer(renderer);
+		} else if (!strcmp(argv[i], "--seed") && i + 1 < argc) {
+			seed = (unsigned int)strtoul(argv[++i], NULL, 0);
+		} else if (!strcmp(argv[i], "--world") && i + 1 < argc) {
+			world = 1;
+			world_seed = strtoull(argv[++i], NULL, 0);
+		} else if (!strcmp(argv[i], "--log-stdout")) {
+			message_log_echo_start();
+		} else if (!strcmp(argv[i], "--no-watch")) {
+			watch = 0;
+		} else if (argv[i][0] != '-') {
+			map_path = argv[i];
+		} else {
+			usage(argv[0]);
+		}
 	}
+	if (fog < 0)
+		fog = distance < VIEW_STEPS ? distance : VIEW_STEPS;
+	view_set_draw_distance(distance, fog);
+	game_seed(seed);
 	window_setup();
-	load_map();
+	/* a saved game carries on from the save rather than the map file */
+	if (world)
+		start_world(world_seed);
+	else if (!save_path || !(current_map = journal_load(save_path)))
+		load_map(map_path);
+	/* all are made for a map of known size */
+	if (world && (atlas_path || record_path || save_path)) {
+		fprintf(stderr, "Atlases, recordings and saves need a map file; not using them\n");
+		atlas_path = record_path = save_path = NULL;
+	}
+	if (atlas_path && (distance != VIEW_STEPS || fog != VIEW_STEPS)) {
+		fprintf(stderr, "Atlases are baked at the default draw distance; not using %s\n", atlas_path);
+	} else if (atlas_path) {
+		atlas = atlas_open(atlas_path);
+		if (!atlas) {
+			fprintf(stderr, "Can't open atlas: %s\n", atlas_path);
+		} else if (atlas_frame_width(atlas) != display_width()
+				|| atlas_frame_height(atlas) != display_height()) {
+			fprintf(stderr, "Atlas %s was baked for %dx%d; it is used only at that size\n",
+				atlas_path, atlas_frame_width(atlas), atlas_frame_height(atlas));
+		}
+	}
+	if (record_path) {
+		recording = recording_create(record_path, current_map, seed);
+		if (!recording)
+			fprintf(stderr, "Can't record to %s\n", record_path);
+	}
+	/* a replay starts from the map as it was recorded and knows no edits */
+	if (!world && watch && recording) {
+		fprintf(stderr, "Not watching %s for edits while recording\n", map_path);
+	} else if (!world && watch && save_path) {
+		fprintf(stderr, "Not watching %s for edits while saving to %s\n", map_path, save_path);
+	} else if (!world && watch) {
+		map_watch = map_watch_start(map_path);
+		if (!map_watch)
+			fprintf(stderr, "Can't watch %s for edits\n", map_path);
+	}
+	if (save_path) {
+		journal = journal_start(save_path, current_map);
+		if (!journal)
+			fprintf(stderr, "Can't save to %s\n", save_path);
+	}
+	if (capture_path) {
+		capture = capture_start(capture_path);
+		if (!capture)
+			fprintf(stderr, "Can't capture to %s\n", capture_path);
+	}
+	session_start = SDL_GetTicks();
 	mark_dirty();
+	view_engine = view_renderer();
+	view_thread = view_thread_start();
+	if (!view_thread) {
+		fprintf(stderr, "Can't start painting the view\n");
+		exit(1);
+	}
 	while (!quitflag) {
-		if (is_dirty()) {
-			paint_view();
-			paint_stats();
-			paint();
+		int shown = 0;
+#ifdef ALLOC_DEBUG
+		struct alloc_count before;
+
+		alloc_debug_count(&before);
+#endif
+		handle_input();
+		play_queued();
+		animate();
+		reload_map();
+		/* A move playing out hands over its next pose once the last is on
+		 * screen, so no more frames are painted than vsync shows. */
+		if (is_dirty() || (animating && shown_serial == posted_serial)) {
+			shown = paint_view();
+			if (is_dirty())
+				stats_stale = 1;
 			mark_clean();
 		}
-		handle_input();
-		SDL_Delay(1);
+		shown |= take_view_frame();
+		if (stats_stale) {
+			paint_stats();
+			stats_stale = 0;
+			shown = 1;
+		}
+		if (shown)
+			paint();
+		else
+			SDL_Delay(1);
+#ifdef ALLOC_DEBUG
+		if (shown)
+			report_allocations(&before);
+#endif
 	}
+	view_thread_stop(view_thread);
+	capture_stop(capture);
+	free(shown_view);
+	map_watch_stop(map_watch);
+	recording_close(recording);
+	journal_stop(journal);
+	message_log_echo_stop();
+	atlas_close(atlas);
 	release_map();
 	window_teardown();
 	return 0;
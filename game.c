@@ -0,0 +1,259 @@
+/*
+ *  Copyright 2016 Kendall E. Blake
+ *
+ *  This file is part of cairo-test.
+ *
+ *  cairo-test is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published
+ *  by the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  cairo-test is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with cairo-test.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "direction.h"
+#include "game.h"
+#include "map.h"
+#include "message_log.h"
+#include "player.h"
+
+#define message message_log_add
+_Thread_local struct map * current_map;
+static _Thread_local unsigned int random_state = 1;
+
+static const char *action_names[ACTION_COUNT] = {
+	"none",
+	"forward",
+	"backward",
+	"left",
+	"right",
+	"get",
+	"undo"
+};
+
+const char *action_name(int action)
+{
+	if (action < 0 || action >= ACTION_COUNT)
+		return NULL;
+	return action_names[action];
+}
+
+int action_from_name(const char *name)
+{
+	for (int i = 0; i < ACTION_COUNT; i++)
+	{
+		if (!strcmp(name, action_names[i]))
+			return i;
+	}
+	return ACTION_NONE;
+}
+
+static _Thread_local int dirty_flag = 0;
+
+void mark_dirty()
+{
+	dirty_flag = 1;
+}
+
+void mark_clean()
+{
+	dirty_flag = 0;
+}
+
+int is_dirty()
+{
+	return dirty_flag;
+}
+
+void on_moved(int oldx, int oldy, int newx, int newy)
+{
+	map_set_focus(current_map, newx, newy);
+	if (map_tile(current_map, newx, newy) == 'T') {
+		message("Arr, there be treasure here!");
+	}
+	if (strchr("|-", map_tile(current_map, oldx, oldy))) {
+		message("A door creaks closed behind you");
+	}
+	if (strchr("|-", map_tile(current_map, newx, newy))) {
+		message("The door opens");
+	}
+}
+
+void move_forward(void)
+{
+	int newx = player_x(), newy = player_y();
+	switch (player_facing()) {
+		case DIRECTION_EAST: newx += 1; break;
+		case DIRECTION_WEST: newx -= 1; break;
+		case DIRECTION_NORTH: newy -= 1; break;
+		case DIRECTION_SOUTH: newy += 1; break;
+	}
+	if (map_tile(current_map, newx, newy) != 'X') {
+		on_moved(player_x(), player_y(), newx, newy);
+		player_set_x(newx);
+		player_set_y(newy);
+		mark_dirty();
+	}
+}
+
+void move_backward(void)
+{
+	int newx = player_x(), newy = player_y();
+	switch (player_facing()) {
+		case DIRECTION_EAST: newx -= 1; break;
+		case DIRECTION_WEST: newx += 1; break;
+		case DIRECTION_NORTH: newy += 1; break;
+		case DIRECTION_SOUTH: newy -= 1; break;
+	}
+	if (map_tile(current_map, newx, newy) != 'X') {
+		on_moved(player_x(), player_y(), newx, newy);
+		player_set_x(newx);
+		player_set_y(newy);
+		mark_dirty();
+	}
+}
+
+void turn_right(void)
+{
+	player_turn_right();
+	mark_dirty();
+}
+
+void turn_left(void)
+{
+	player_turn_left();
+	mark_dirty();
+}
+
+void game_seed(unsigned int seed)
+{
+	random_state = seed;
+}
+
+int treasure_max ()
+{
+	return 10;
+}
+
+void do_get(void)
+{
+	if (map_tile(current_map, player_x(), player_y()) == 'T') {
+		int gold = rand_r(&random_state) % treasure_max() + 1;
+		player_modify_gold(gold);
+		message("You found %i gold!", gold);
+		map_set_tile(current_map, player_x(), player_y(), '.');
+		mark_dirty();
+	}
+}
+
+/*@null@*/
+struct game_snapshot *game_snapshot_take(void)
+{
+	struct game_snapshot *snapshot =
+		(struct game_snapshot *)malloc(sizeof(struct game_snapshot));
+	if (snapshot) {
+		snapshot->map = map_snapshot(current_map);
+		if (!snapshot->map) {
+			free(snapshot);
+			return NULL;
+		}
+		snapshot->x      = player_x();
+		snapshot->y      = player_y();
+		snapshot->facing = player_facing();
+		snapshot->gold   = player_gold();
+	}
+	return snapshot;
+}
+
+void game_snapshot_restore(struct game_snapshot *snapshot)
+{
+	map_restore(current_map, snapshot->map);
+	player_set_x(snapshot->x);
+	player_set_y(snapshot->y);
+	player_set_facing(snapshot->facing);
+	player_set_gold(snapshot->gold);
+	mark_dirty();
+}
+
+void game_snapshot_release(struct game_snapshot *snapshot)
+{
+	if (snapshot) {
+		map_delete(snapshot->map);
+		free(snapshot);
+	}
+}
+
+#define GAME_HISTORY 64
+static _Thread_local struct game_snapshot *history[GAME_HISTORY];
+static _Thread_local int history_top = 0;
+
+static void history_push(struct game_snapshot *snapshot)
+{
+	int slot = history_top % GAME_HISTORY;
+	game_snapshot_release(history[slot]);
+	history[slot] = snapshot;
+	history_top++;
+}
+
+static int snapshot_differs(struct game_snapshot *snapshot)
+{
+	return snapshot->x != player_x() || snapshot->y != player_y()
+		|| snapshot->facing != player_facing() || snapshot->gold != player_gold();
+}
+
+int game_undo(void)
+{
+	int slot;
+	if (history_top == 0)
+		return 0;
+	slot = (history_top - 1) % GAME_HISTORY;
+	if (!history[slot])
+		return 0;
+	game_snapshot_restore(history[slot]);
+	game_snapshot_release(history[slot]);
+	history[slot] = NULL;
+	history_top--;
+	return 1;
+}
+
+void game_clear_history(void)
+{
+	for (int i = 0; i < GAME_HISTORY; i++) {
+		game_snapshot_release(history[i]);
+		history[i] = NULL;
+	}
+	history_top = 0;
+}
+
+void game_do_action(int action)
+{
+	struct game_snapshot *before;
+
+	if (action == ACTION_UNDO) {
+		game_undo();
+		return;
+	}
+
+	before = game_snapshot_take();
+	switch (action) {
+		case ACTION_FORWARD: move_forward(); break;
+		case ACTION_BACKWARD: move_backward(); break;
+		case ACTION_TURN_LEFT: turn_left(); break;
+		case ACTION_TURN_RIGHT: turn_right(); break;
+		case ACTION_GET: do_get(); break;
+	}
+	if (before && snapshot_differs(before)) {
+		history_push(before);
+	} else {
+		game_snapshot_release(before);
+	}
+}
@@ -0,0 +1,75 @@
+#ifndef GAME_H
+#define GAME_H
+/*
+ *  Copyright 2016 Kendall E. Blake
+ *
+ *  This file is part of cairo-test.
+ *
+ *  cairo-test is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published
+ *  by the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  cairo-test is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with cairo-test.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "map.h"
+
+/* Everything the player can ask the game to do.  Input handling turns key
+ * presses into these so that a session can be recorded and replayed without
+ * a display. */
+enum {
+	ACTION_NONE = 0,
+	ACTION_FORWARD,
+	ACTION_BACKWARD,
+	ACTION_TURN_LEFT,
+	ACTION_TURN_RIGHT,
+	ACTION_GET,
+	ACTION_UNDO,
+	ACTION_COUNT
+};
+
+/* Everything needed to put the game back the way it was.  The map is a
+ * copy-on-write snapshot, so holding one is cheap however big the map is,
+ * and it can be read from another thread while play carries on. */
+struct game_snapshot
+{
+	struct map *map;
+	int x, y, facing, gold;
+};
+
+/* Each thread plays its own game: the map, dirty flag, undo history and
+ * random numbers are all per thread. */
+extern _Thread_local struct map *current_map;
+
+/*@null@*/
+struct game_snapshot *game_snapshot_take(void);
+void game_snapshot_restore(struct game_snapshot *snapshot);
+void game_snapshot_release(struct game_snapshot *snapshot);
+int game_undo(void);
+void game_clear_history(void);
+void game_seed(unsigned int seed);
+
+const char *action_name(int action);
+int action_from_name(const char *name);
+void game_do_action(int action);
+
+void on_moved(int oldx, int oldy, int newx, int newy);
+void move_forward(void);
+void move_backward(void);
+void turn_right(void);
+void turn_left(void);
+int treasure_max(void);
+void do_get(void);
+
+void mark_dirty(void);
+void mark_clean(void);
+int is_dirty(void);
+
+#endif
@@ -0,0 +1,100 @@
+/*
+ *  Copyright 2016 Kendall E. Blake
+ *
+ *  This file is part of cairo-test.
+ *
+ *  cairo-test is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published
+ *  by the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  cairo-test is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with cairo-test.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "generator.h"
+#include "map.h"
+#include "map_loader.h"
+
+/* Generate a dungeon and write it out as a map file, in text that
+ * dungeon, replay and the rest load as they always have, or in the binary
+ * form that loads much faster at large sizes. */
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "usage: %s [--seed n] [--threads n] [--binary] [-o file] WxH\n", name);
+	exit(2);
+}
+
+int main (int argc, char *argv[])
+{
+	const char *out_path = NULL;
+	uint64_t    seed = 1;
+	int         threads = 0, binary = 0, width = 0, height = 0, fd, ok;
+	struct map *map;
+	double      start, generated;
+
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "--seed") && i + 1 < argc) {
+			seed = strtoull(argv[++i], NULL, 0);
+		} else if (!strcmp(argv[i], "--threads") && i + 1 < argc) {
+			threads = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "--binary")) {
+			binary = 1;
+		} else if (!strcmp(argv[i], "-o") && i + 1 < argc) {
+			out_path = argv[++i];
+		} else if (argv[i][0] != '-' && sscanf(argv[i], "%dx%d", &width, &height) == 2) {
+			continue;
+		} else {
+			usage(argv[0]);
+		}
+	}
+	if (width <= 0 || height <= 0)
+		usage(argv[0]);
+
+	map = map_new(width, height);
+	if (!map) {
+		fprintf(stderr, "Not enough memory for a %dx%d map\n", width, height);
+		return 1;
+	}
+	start = now();
+	generate_dungeon(map, seed, threads);
+	generated = now();
+
+	fd = out_path ? open(out_path, O_WRONLY | O_CREAT | O_TRUNC, 0644) : STDOUT_FILENO;
+	if (fd < 0) {
+		fprintf(stderr, "Can't write %s\n", out_path);
+		return 1;
+	}
+	ok = save_map_to_fd(map, fd, binary);
+	if (out_path)
+		ok = !close(fd) && ok;
+	if (!ok) {
+		fprintf(stderr, "Couldn't write all of the map\n");
+		return 1;
+	}
+	fprintf(stderr, "%dx%d\tgenerated in %.3fs\twritten in %.3fs\n", width, height,
+		generated - start, now() - generated);
+	map_delete(map);
+	return 0;
+}
@@ -0,0 +1,344 @@
+/*
+ *  Copyright 2016 Kendall E. Blake
+ *
+ *  This file is part of cairo-test.
+ *
+ *  cairo-test is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published
+ *  by the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  cairo-test is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with cairo-test.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "generator.h"
+
+/* The dungeon is a grid of regions, each laid out from the seed and its
+ * position alone.  Inside its region every room keeps two tiles clear of
+ * the region's edge; corridors run in that margin out to a point on each
+ * shared edge that both regions work out the same way.  A bounded map
+ * stretches its regions to fill it exactly; the unbounded dungeon's are
+ * all GENERATOR_REGION square, with region (0, 0) at the origin.
+ *
+ * For a bounded map, rows of regions are laid out in a buffer per thread
+ * and copied into the map a line at a time, so threads only ever share
+ * the map. */
+
+#define MARGIN   2
+#define ROOM_MIN 3
+#define ROOM_MAX 14
+
+enum { EDGE_EAST, EDGE_SOUTH, EDGE_SOUTH_OPEN, ROOM };
+
+struct grid
+{
+	uint64_t seed;
+	int64_t  width, height; /* 0 if unbounded */
+	int64_t  cols, rows;
+};
+
+/* Where tiles are being laid out: the buffer holds rows of stride tiles,
+ * the first of them at (left, top). */
+struct band
+{
+	char    *tiles;
+	int64_t  stride;
+	int64_t  left, top;
+};
+
+struct region
+{
+	int64_t x0, y0, w, h;
+	int64_t room_x0, room_y0, room_x1, room_y1;
+	int     has_room;
+};
+
+struct job
+{
+	struct map   *map;
+	struct grid   grid;
+	atomic_size_t next_row;
+};
+
+static uint64_t mix(uint64_t z)
+{
+	z += 0x9e3779b97f4a7c15ull;
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+	return z ^ (z >> 31);
+}
+
+static uint64_t region_hash(uint64_t seed, int64_t rx, int64_t ry, int what)
+{
+	return mix(seed ^ mix((uint64_t)rx ^ mix((uint64_t)ry ^ mix((uint64_t)what))));
+}
+
+/* A stream of numbers from one hash, for a region's room and contents. */
+static uint64_t next_random(uint64_t *state)
+{
+	*state += 0x9e3779b97f4a7c15ull;
+	return mix(*state);
+}
+
+static int64_t span_start(int64_t total, int64_t count, int64_t i)
+{
+	/* sizes are ints, so the product fits */
+	return total * i / count;
+}
+
+static void region_bounds(const struct grid *grid, int64_t rx, int64_t ry, struct region *r)
+{
+	if (grid->width) {
+		r->x0 = span_start(grid->width, grid->cols, rx);
+		r->y0 = span_start(grid->height, grid->rows, ry);
+		r->w  = span_start(grid->width, grid->cols, rx + 1) - r->x0;
+		r->h  = span_start(grid->height, grid->rows, ry + 1) - r->y0;
+	} else {
+		r->x0 = rx * GENERATOR_REGION;
+		r->y0 = ry * GENERATOR_REGION;
+		r->w  = r->h = GENERATOR_REGION;
+	}
+	r->has_room = r->w > 2 * MARGIN + 2 && r->h > 2 * MARGIN + 2;
+}
+
+static int has_east(const struct grid *grid, int64_t rx, int64_t ry)
+{
+	(void)ry;
+	return !grid->width || rx + 1 < grid->cols;
+}
+
+/* Every row is joined along itself and column 0 joins the rows, so some
+ * south edges can be left shut without cutting anything off. */
+static int has_south(const struct grid *grid, int64_t rx, int64_t ry)
+{
+	return (!grid->width || ry + 1 < grid->rows)
+		&& (rx == 0 || region_hash(grid->seed, rx, ry, EDGE_SOUTH_OPEN) % 5 < 2);
+}
+
+/* Where the corridor crosses the east edge, as a row of the map. */
+static int64_t east_point(const struct grid *grid, const struct region *r, int64_t rx, int64_t ry)
+{
+	return r->y0 + MARGIN
+		+ (int64_t)(region_hash(grid->seed, rx, ry, EDGE_EAST) % (uint64_t)(r->h - 2 * MARGIN));
+}
+
+/* and the south edge, as a column. */
+static int64_t south_point(const struct grid *grid, const struct region *r, int64_t rx, int64_t ry)
+{
+	return r->x0 + MARGIN
+		+ (int64_t)(region_hash(grid->seed, rx, ry, EDGE_SOUTH) % (uint64_t)(r->w - 2 * MARGIN));
+}
+
+static char *tile(struct band *band, int64_t x, int64_t y)
+{
+	return band->tiles + (y - band->top) * band->stride + (x - band->left);
+}
+
+static void carve_row(struct band *band, int64_t y, int64_t x0, int64_t x1)
+{
+	if (x0 > x1) {
+		int64_t t = x0;
+		x0 = x1;
+		x1 = t;
+	}
+	memset(tile(band, x0, y), '.', (size_t)(x1 - x0 + 1));
+}
+
+static void carve_column(struct band *band, int64_t x, int64_t y0, int64_t y1)
+{
+	if (y0 > y1) {
+		int64_t t = y0;
+		y0 = y1;
+		y1 = t;
+	}
+	for (int64_t y = y0; y <= y1; y++)
+		*tile(band, x, y) = '.';
+}
+
+static int64_t clamp(int64_t v, int64_t lo, int64_t hi)
+{
+	return v < lo ? lo : v > hi ? hi : v;
+}
+
+static int64_t random_below(uint64_t *random, int64_t n)
+{
+	return (int64_t)(next_random(random) % (uint64_t)n);
+}
+
+/* How long a side of the room is and where along the region it starts;
+ * the room's own walls sit just inside the margin. */
+static void place_side(int64_t start, int64_t size, int64_t *from, int64_t *to, uint64_t *random)
+{
+	int64_t room = size - 2 * MARGIN - 2;
+	int64_t most = room < ROOM_MAX ? room : ROOM_MAX;
+	int64_t least = most < ROOM_MIN ? most : ROOM_MIN;
+	int64_t side = least + random_below(random, most - least + 1);
+
+	*from = start + MARGIN + 1 + random_below(random, room - side + 1);
+	*to   = *from + side;
+}
+
+/* Lay out region (rx, ry) into band, which must cover all of it. */
+static void fill_region(const struct grid *grid, struct band *band, int64_t rx, int64_t ry)
+{
+	struct region r, west, north;
+	uint64_t      random = region_hash(grid->seed, rx, ry, ROOM);
+	int64_t       doors[4][2];
+	char          door_tiles[4];
+	int           ndoors = 0;
+
+	region_bounds(grid, rx, ry, &r);
+	if (!r.has_room)
+		return;
+	place_side(r.x0, r.w, &r.room_x0, &r.room_x1, &random);
+	place_side(r.y0, r.h, &r.room_y0, &r.room_y1, &random);
+	for (int64_t y = r.room_y0; y < r.room_y1; y++)
+		carve_row(band, y, r.room_x0, r.room_x1 - 1);
+
+	if (has_east(grid, rx, ry)) {
+		int64_t ye = east_point(grid, &r, rx, ry);
+		int64_t dy = clamp(ye, r.room_y0, r.room_y1 - 1);
+
+		carve_column(band, r.room_x1 + 1, dy, ye);
+		carve_row(band, ye, r.room_x1 + 1, r.x0 + r.w - 1);
+		doors[ndoors][0] = r.room_x1;
+		doors[ndoors][1] = dy;
+		door_tiles[ndoors++] = '|';
+	}
+	if (!grid->width || rx > 0) {
+		region_bounds(grid, rx - 1, ry, &west);
+		if (west.has_room && has_east(grid, rx - 1, ry)) {
+			int64_t yw = east_point(grid, &west, rx - 1, ry);
+			int64_t dy = clamp(yw, r.room_y0, r.room_y1 - 1);
+
+			carve_column(band, r.room_x0 - 2, dy, yw);
+			carve_row(band, yw, r.x0, r.room_x0 - 2);
+			doors[ndoors][0] = r.room_x0 - 1;
+			doors[ndoors][1] = dy;
+			door_tiles[ndoors++] = '|';
+		}
+	}
+	if (has_south(grid, rx, ry)) {
+		int64_t xs = south_point(grid, &r, rx, ry);
+		int64_t dx = clamp(xs, r.room_x0, r.room_x1 - 1);
+
+		carve_row(band, r.room_y1 + 1, dx, xs);
+		carve_column(band, xs, r.room_y1 + 1, r.y0 + r.h - 1);
+		doors[ndoors][0] = dx;
+		doors[ndoors][1] = r.room_y1;
+		door_tiles[ndoors++] = '-';
+	}
+	if (!grid->width || ry > 0) {
+		region_bounds(grid, rx, ry - 1, &north);
+		if (north.has_room && has_south(grid, rx, ry - 1)) {
+			int64_t xn = south_point(grid, &north, rx, ry - 1);
+			int64_t dx = clamp(xn, r.room_x0, r.room_x1 - 1);
+
+			carve_row(band, r.room_y0 - 2, dx, xn);
+			carve_column(band, xn, r.y0, r.room_y0 - 2);
+			doors[ndoors][0] = dx;
+			doors[ndoors][1] = r.room_y0 - 1;
+			door_tiles[ndoors++] = '-';
+		}
+	}
+	/* some ways in are open archways rather than doors */
+	for (int i = 0; i < ndoors; i++)
+		*tile(band, doors[i][0], doors[i][1]) = next_random(&random) % 4 ? door_tiles[i] : '.';
+
+	for (int chests = (int)random_below(&random, 3); chests > 0; chests--) {
+		int64_t x = r.room_x0 + random_below(&random, r.room_x1 - r.room_x0);
+		int64_t y = r.room_y0 + random_below(&random, r.room_y1 - r.room_y0);
+		*tile(band, x, y) = 'T';
+	}
+	switch (next_random(&random) % 16) {
+		case 0: *tile(band, r.room_x0, r.room_y0) = 'D'; break;
+		case 1: *tile(band, r.room_x1 - 1, r.room_y1 - 1) = 'U'; break;
+	}
+}
+
+void generate_region(uint64_t seed, long rx, long ry, char *tiles)
+{
+	struct grid grid = { seed, 0, 0, 0, 0 };
+	struct band band = { tiles, GENERATOR_REGION,
+		(int64_t)rx * GENERATOR_REGION, (int64_t)ry * GENERATOR_REGION };
+
+	memset(tiles, 'X', GENERATOR_REGION * GENERATOR_REGION);
+	fill_region(&grid, &band, rx, ry);
+}
+
+static void fill_band(struct job *job, int64_t ry, char *buffer)
+{
+	struct region r;
+	struct band   band;
+
+	region_bounds(&job->grid, 0, ry, &r);
+	band.tiles  = buffer;
+	band.stride = job->grid.width;
+	band.left   = 0;
+	band.top    = r.y0;
+	memset(buffer, 'X', (size_t)(band.stride * r.h));
+	for (int64_t rx = 0; rx < job->grid.cols; rx++)
+		fill_region(&job->grid, &band, rx, ry);
+	for (int64_t y = 0; y < r.h; y++)
+		map_write_row(job->map, 0, (int)(r.y0 + y), buffer + y * band.stride, (size_t)band.stride);
+}
+
+static void *generate_main(void *arg)
+{
+	struct job *job = (struct job *)arg;
+	int64_t     rows_per_band = span_start(job->grid.height, job->grid.rows, 1) + 1;
+	char       *buffer = (char *)malloc((size_t)(job->grid.width * rows_per_band));
+	size_t      ry;
+
+	if (!buffer)
+		return NULL;
+	while ((ry = atomic_fetch_add(&job->next_row, 1)) < (size_t)job->grid.rows)
+		fill_band(job, (int64_t)ry, buffer);
+	free(buffer);
+	return NULL;
+}
+
+void generate_dungeon(struct map *map, uint64_t seed, int threads)
+{
+	struct job job;
+	pthread_t *workers;
+	int        started = 0;
+
+	job.map         = map;
+	job.grid.seed   = seed;
+	job.grid.width  = map_width(map);
+	job.grid.height = map_height(map);
+	job.grid.cols   = job.grid.width / GENERATOR_REGION ? job.grid.width / GENERATOR_REGION : 1;
+	job.grid.rows   = job.grid.height / GENERATOR_REGION ? job.grid.height / GENERATOR_REGION : 1;
+	atomic_init(&job.next_row, 0);
+	if (!job.grid.width || !job.grid.height)
+		return;
+
+	if (threads <= 0)
+		threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	if (threads > job.grid.rows)
+		threads = (int)job.grid.rows;
+	workers = threads > 1 ? (pthread_t *)malloc(sizeof(pthread_t) * (threads - 1)) : NULL;
+	for (int i = 0; workers && i < threads - 1; i++) {
+		if (pthread_create(&workers[started], NULL, generate_main, &job))
+			break;
+		started++;
+	}
+	/* this thread works too, and finishes the job alone if it must */
+	generate_main(&job);
+	for (int i = 0; i < started; i++)
+		pthread_join(workers[i], NULL);
+	free(workers);
+}
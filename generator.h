@@ -0,0 +1,43 @@
+#ifndef GENERATOR_H
+#define GENERATOR_H
+/*
+ *  Copyright 2016 Kendall E. Blake
+ *
+ *  This file is part of cairo-test.
+ *
+ *  cairo-test is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published
+ *  by the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  cairo-test is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with cairo-test.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+
+#include "map.h"
+
+/* The map is cut into regions about this many tiles on a side, each with
+ * a room joined to its neighbours' by corridors. */
+#define GENERATOR_REGION 32
+
+/* Fill map with a dungeon of rooms and corridors, doors, chests and
+ * ladders, using up to threads threads (0 for one per processor).  Every
+ * region is worked out from the seed and its position alone, so the same
+ * seed gives the same map whatever the thread count.  Every open tile can
+ * be reached from every other; maps under 7x7 come out solid.  Nothing may
+ * have been snapshotted from map. */
+void generate_dungeon(struct map *map, uint64_t seed, int threads);
+/* Lay out region (rx, ry) of the unbounded dungeon, the square of
+ * GENERATOR_REGION tiles on a side from (rx, ry) * GENERATOR_REGION, into
+ * tiles row by row.  Regions fit together the same way a bounded map's do,
+ * and every row of them is joined to the next through column 0. */
+void generate_region(uint64_t seed, long rx, long ry, char *tiles);
+
+#endif
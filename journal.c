@@ -0,0 +1,542 @@
+/*
+ *  Copyright 2016 Kendall E. Blake
+ *
+ *  This file is part of cairo-test.
+ *
+ *  cairo-test is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published
+ *  by the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  cairo-test is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with cairo-test.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "journal.h"
+#include "map_loader.h"
+#include "player.h"
+
+/* Records, after the header's magic and player:
+
+	'T' x y n tiles[n] check     n tiles written along row y from column x
+	'P' x y facing gold check    the player's new state
+
+   Numbers are little-endian, 32 bits but for n, which is 16.  The check
+   byte covers the rest of the record, so a record cut short by a crash,
+   or garbage past the end of what was synced, stops the replay. */
+#define TILE_RECORD(n)  (12 + (size_t)(n))
+#define PLAYER_RECORD   18
+#define MAX_RUN         0xffff
+
+struct journal_player
+{
+	int32_t x, y, facing, gold;
+};
+
+struct journal
+{
+	char                 *map_path, *journal_path, *map_temp, *journal_temp, *directory;
+	struct map           *map;
+	/* The game's own: the player as last journaled, and how much has
+	 * been journaled since the last snapshot was asked for. */
+	struct journal_player player;
+	size_t                since_snapshot;
+	pthread_t             thread;
+
+	/* The rest is shared with the thread. */
+	pthread_mutex_t       lock;
+	pthread_cond_t        wake, synced;
+	int                   stopping, failed;
+	/* records appended by the game, waiting for the thread */
+	char                 *pending;
+	size_t                length, size;
+	/* a snapshot of the map taken compact_at bytes into pending */
+	/*@null@*/ struct map *snapshot;
+	struct journal_player snapshot_player;
+	size_t                compact_at;
+	/* records and snapshots ever asked for, and how many are on disk */
+	unsigned long long    appended, durable;
+
+	/* The thread's own: the journal file, and the buffer it is writing
+	 * while the game fills the other. */
+	int                   fd;
+	char                 *writing;
+	size_t                writing_size;
+};
+
+static void put_le32(unsigned char *bytes, uint32_t value)
+{
+	for (int i = 0; i < 4; i++, value >>= 8)
+		bytes[i] = (unsigned char)value;
+}
+
+static uint32_t get_le32(const unsigned char *bytes)
+{
+	return bytes[0] | bytes[1] << 8 | bytes[2] << 16 | (uint32_t)bytes[3] << 24;
+}
+
+static unsigned char check(const unsigned char *bytes, size_t n)
+{
+	unsigned char sum = 0xa5;
+
+	while (n--)
+		sum = (unsigned char)((sum << 1 | sum >> 7) ^ *bytes++);
+	return sum;
+}
+
+static void put_player(unsigned char *bytes, const struct journal_player *player)
+{
+	put_le32(bytes, (uint32_t)player->x);
+	put_le32(bytes + 4, (uint32_t)player->y);
+	put_le32(bytes + 8, (uint32_t)player->facing);
+	put_le32(bytes + 12, (uint32_t)player->gold);
+}
+
+static void use_player(const unsigned char *bytes)
+{
+	player_set_x((int32_t)get_le32(bytes));
+	player_set_y((int32_t)get_le32(bytes + 4));
+	player_set_facing((int32_t)get_le32(bytes + 8));
+	player_set_gold((int32_t)get_le32(bytes + 12));
+}
+
+static void current_player(struct journal_player *player)
+{
+	player->x = player_x();
+	player->y = player_y();
+	player->facing = player_facing();
+	player->gold = player_gold();
+}
+
+/* How many bytes at the start of a journal are its header and whole
+ * records; 0 if it has no header.  If map isn't NULL they are replayed
+ * onto it and the calling thread's player. */
+static size_t replay(const unsigned char *data, size_t size, /*@null@*/ struct map *map)
+{
+	size_t at = JOURNAL_HEADER;
+
+	if (size < JOURNAL_HEADER || memcmp(data, JOURNAL_MAGIC, 8))
+		return 0;
+	if (map)
+		use_player(data + 8);
+	while (at < size) {
+		const unsigned char *record = data + at;
+		size_t               length;
+
+		if (record[0] == 'T' && size - at >= TILE_RECORD(0))
+			length = TILE_RECORD(record[9] | record[10] << 8);
+		else if (record[0] == 'P')
+			length = PLAYER_RECORD;
+		else
+			break;
+		if (length > size - at || check(record, length - 1) != record[length - 1])
+			break;
+		if (map && record[0] == 'T')
+			map_write_row(map, (int32_t)get_le32(record + 1), (int32_t)get_le32(record + 5),
+				(const char *)record + 11, length - TILE_RECORD(0));
+		else if (map)
+			use_player(record + 1);
+		at += length;
+	}
+	return at;
+}
+
+static char *path_with(const char *path, const char *suffix)
+{
+	char *joined = (char *)malloc(strlen(path) + strlen(suffix) + 1);
+
+	if (joined) {
+		strcpy(joined, path);
+		strcat(joined, suffix);
+	}
+	return joined;
+}
+
+/*@null@*/
+struct map *journal_load(const char *path)
+{
+	char        *map_path = path_with(path, ".map");
+	char        *journal_path = path_with(path, ".journal");
+	struct map  *map = NULL;
+	struct stat  stat_buf;
+	int          fd;
+
+	if (map_path && journal_path)
+		map = load_map_from_path(map_path);
+	if (map && (fd = open(journal_path, O_RDONLY)) >= 0) {
+		if (fstat(fd, &stat_buf) == 0 && stat_buf.st_size > 0) {
+			void *data = mmap(NULL, (size_t)stat_buf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+			if (data != MAP_FAILED) {
+				replay((const unsigned char *)data, (size_t)stat_buf.st_size, map);
+				munmap(data, (size_t)stat_buf.st_size);
+			}
+		}
+		close(fd);
+	}
+	free(map_path);
+	free(journal_path);
+	return map;
+}
+
+static int write_fully(int fd, const char *buffer, size_t length)
+{
+	while (length) {
+		ssize_t n = write(fd, buffer, length);
+		if (n <= 0)
+			return 0;
+		buffer += n;
+		length -= (size_t)n;
+	}
+	return 1;
+}
+
+static int sync_directory(struct journal *journal)
+{
+	int fd = open(journal->directory, O_RDONLY);
+	int ok = fd >= 0 && !fsync(fd);
+
+	if (fd >= 0)
+		close(fd);
+	return ok;
+}
+
+/* Write snapshot out as the new path.map, and start a new journal on it.
+ * The map goes in first: the old journal, replayed onto the new map,
+ * only writes what the map already says, so stopping between the two
+ * renames loses nothing. */
+static int compact(struct journal *journal, struct map *snapshot,
+	const struct journal_player *player)
+{
+	unsigned char header[JOURNAL_HEADER];
+	int           map_fd, journal_fd = -1, ok;
+
+	map_fd = open(journal->map_temp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	ok = map_fd >= 0 && save_map_to_fd(snapshot, map_fd, 1) && !fsync(map_fd);
+	if (map_fd >= 0 && close(map_fd))
+		ok = 0;
+	memcpy(header, JOURNAL_MAGIC, 8);
+	put_player(header + 8, player);
+	if (ok)
+		journal_fd = open(journal->journal_temp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	ok = ok && journal_fd >= 0 && write_fully(journal_fd, (const char *)header, sizeof header)
+		&& !fsync(journal_fd)
+		&& !rename(journal->map_temp, journal->map_path)
+		&& !rename(journal->journal_temp, journal->journal_path)
+		&& sync_directory(journal);
+	if (!ok) {
+		if (journal_fd >= 0)
+			close(journal_fd);
+		unlink(journal->map_temp);
+		unlink(journal->journal_temp);
+		return 0;
+	}
+	if (journal->fd >= 0)
+		close(journal->fd);
+	journal->fd = journal_fd;
+	return 1;
+}
+
+static int write_records(struct journal *journal, const char *records, size_t length)
+{
+	return journal->fd >= 0 && write_fully(journal->fd, records, length);
+}
+
+/* Each time round, take everything the game has appended, write it and
+ * sync it once: a group commit of whatever came in during the last. */
+static void *journal_thread(void *arg)
+{
+	struct journal *journal = (struct journal *)arg;
+
+	pthread_mutex_lock(&journal->lock);
+	for (;;) {
+		struct journal_player player;
+		struct map           *snapshot;
+		char                 *records;
+		size_t                length, compact_at, size;
+		unsigned long long    upto;
+		int                   ok;
+
+		while (!journal->stopping && !journal->length && !journal->snapshot)
+			pthread_cond_wait(&journal->wake, &journal->lock);
+		if (!journal->length && !journal->snapshot)
+			break;
+		records = journal->pending;
+		size = journal->size;
+		journal->pending = journal->writing;
+		journal->size = journal->writing_size;
+		journal->writing = records;
+		journal->writing_size = size;
+		length = journal->length;
+		journal->length = 0;
+		snapshot = journal->snapshot;
+		journal->snapshot = NULL;
+		player = journal->snapshot_player;
+		compact_at = snapshot ? journal->compact_at : length;
+		upto = journal->appended;
+		pthread_mutex_unlock(&journal->lock);
+
+		ok = !compact_at || write_records(journal, records, compact_at);
+		if (snapshot) {
+			/* the old journal has to hold all the new map does
+			 * before the new map can replace the old */
+			if (journal->fd >= 0 && fsync(journal->fd))
+				ok = 0;
+			if (!compact(journal, snapshot, &player))
+				ok = 0;
+			map_delete(snapshot);
+		}
+		if (length > compact_at)
+			ok = write_records(journal, records + compact_at, length - compact_at) && ok;
+		if (journal->fd < 0 || fsync(journal->fd))
+			ok = 0;
+
+		pthread_mutex_lock(&journal->lock);
+		if (!ok && !journal->failed) {
+			fprintf(stderr, "Can't save to %s\n", journal->journal_path);
+			journal->failed = 1;
+		}
+		journal->durable = upto;
+		pthread_cond_broadcast(&journal->synced);
+	}
+	pthread_mutex_unlock(&journal->lock);
+	return NULL;
+}
+
+/* Ask for a snapshot to compact onto.  The map is snapshotted here, on
+ * the game's thread, in O(1); the thread does the writing.  A change of
+ * size replaces a snapshot still waiting, which the records after it no
+ * longer fit.  Call with the lock held. */
+static void request_snapshot(struct journal *journal, int resized)
+{
+	if (journal->snapshot && !resized)
+		return;
+	if (journal->snapshot) {
+		map_delete(journal->snapshot);
+		journal->appended--;
+	}
+	journal->snapshot = map_snapshot(journal->map);
+	if (!journal->snapshot) {
+		if (resized)
+			journal->failed = 1;
+		return;
+	}
+	journal->snapshot_player = journal->player;
+	journal->compact_at = journal->length;
+	journal->since_snapshot = 0;
+	journal->appended++;
+	pthread_cond_signal(&journal->wake);
+}
+
+/* Room for n more bytes of records; NULL (and the save marked failed) if
+ * there is none.  Call with the lock held. */
+static unsigned char *reserve(struct journal *journal, size_t n)
+{
+	if (journal->length + n > journal->size) {
+		size_t size = journal->size ? journal->size : 4096;
+		char  *bigger;
+
+		while (size < journal->length + n)
+			size *= 2;
+		bigger = (char *)realloc(journal->pending, size);
+		if (!bigger) {
+			journal->failed = 1;
+			return NULL;
+		}
+		journal->pending = bigger;
+		journal->size = size;
+	}
+	return (unsigned char *)journal->pending + journal->length;
+}
+
+/* Call with the lock held, once the record is in place. */
+static void appended(struct journal *journal, size_t n)
+{
+	journal->length += n;
+	journal->appended++;
+	journal->since_snapshot += n;
+	if (journal->since_snapshot >= JOURNAL_COMPACT_BYTES)
+		request_snapshot(journal, 0);
+	pthread_cond_signal(&journal->wake);
+}
+
+static void observe(void *context, int x, int y, const char *tiles, size_t n)
+{
+	struct journal *journal = (struct journal *)context;
+
+	pthread_mutex_lock(&journal->lock);
+	/* a change of size can't be journaled; the map starts over */
+	if (!tiles)
+		request_snapshot(journal, 1);
+	while (tiles && n) {
+		size_t         run = n < MAX_RUN ? n : MAX_RUN;
+		unsigned char *record = reserve(journal, TILE_RECORD(run));
+
+		if (!record)
+			break;
+		record[0] = 'T';
+		put_le32(record + 1, (uint32_t)x);
+		put_le32(record + 5, (uint32_t)y);
+		record[9] = (unsigned char)run;
+		record[10] = (unsigned char)(run >> 8);
+		memcpy(record + 11, tiles, run);
+		record[11 + run] = check(record, 11 + run);
+		appended(journal, TILE_RECORD(run));
+		x += (int)run;
+		tiles += run;
+		n -= run;
+	}
+	pthread_mutex_unlock(&journal->lock);
+}
+
+void journal_note_player(struct journal *journal)
+{
+	struct journal_player now;
+	unsigned char        *record;
+
+	if (!journal)
+		return;
+	current_player(&now);
+	if (!memcmp(&now, &journal->player, sizeof now))
+		return;
+	pthread_mutex_lock(&journal->lock);
+	journal->player = now;
+	record = reserve(journal, PLAYER_RECORD);
+	if (record) {
+		record[0] = 'P';
+		put_player(record + 1, &now);
+		record[PLAYER_RECORD - 1] = check(record, PLAYER_RECORD - 1);
+		appended(journal, PLAYER_RECORD);
+	}
+	pthread_mutex_unlock(&journal->lock);
+}
+
+int journal_sync(struct journal *journal)
+{
+	int ok;
+
+	if (!journal)
+		return 1;
+	pthread_mutex_lock(&journal->lock);
+	while (journal->durable < journal->appended)
+		pthread_cond_wait(&journal->synced, &journal->lock);
+	ok = !journal->failed;
+	pthread_mutex_unlock(&journal->lock);
+	return ok;
+}
+
+static void journal_free(struct journal *journal)
+{
+	free(journal->map_path);
+	free(journal->journal_path);
+	free(journal->map_temp);
+	free(journal->journal_temp);
+	free(journal->directory);
+	free(journal->pending);
+	free(journal->writing);
+	free(journal);
+}
+
+/* Open the journal at path for appending after its last whole record.
+ * -1 if there is no save to go on with. */
+static int reopen(struct journal *journal)
+{
+	struct stat stat_buf;
+	void       *data;
+	size_t      valid = 0;
+	int         fd;
+
+	if (access(journal->map_path, R_OK))
+		return -1;
+	fd = open(journal->journal_path, O_RDWR);
+	if (fd < 0)
+		return -1;
+	if (fstat(fd, &stat_buf) == 0 && stat_buf.st_size > 0) {
+		data = mmap(NULL, (size_t)stat_buf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (data != MAP_FAILED) {
+			valid = replay((const unsigned char *)data, (size_t)stat_buf.st_size, NULL);
+			munmap(data, (size_t)stat_buf.st_size);
+		}
+	}
+	if (!valid || ftruncate(fd, (off_t)valid) || lseek(fd, (off_t)valid, SEEK_SET) < 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+/*@null@*/
+struct journal *journal_start(const char *path, struct map *map)
+{
+	struct journal *journal = (struct journal *)calloc(1, sizeof(struct journal));
+	const char     *slash = strrchr(path, '/');
+
+	if (!journal)
+		return NULL;
+	journal->map_path = path_with(path, ".map");
+	journal->journal_path = path_with(path, ".journal");
+	journal->map_temp = path_with(path, ".map.new");
+	journal->journal_temp = path_with(path, ".journal.new");
+	journal->directory = slash ? strndup(path, (size_t)(slash - path + 1)) : strdup(".");
+	if (!journal->map_path || !journal->journal_path || !journal->map_temp
+			|| !journal->journal_temp || !journal->directory) {
+		journal_free(journal);
+		return NULL;
+	}
+	journal->map = map;
+	current_player(&journal->player);
+	journal->fd = reopen(journal);
+	pthread_mutex_init(&journal->lock, NULL);
+	pthread_cond_init(&journal->wake, NULL);
+	pthread_cond_init(&journal->synced, NULL);
+	if (pthread_create(&journal->thread, NULL, journal_thread, journal)) {
+		if (journal->fd >= 0)
+			close(journal->fd);
+		pthread_cond_destroy(&journal->synced);
+		pthread_cond_destroy(&journal->wake);
+		pthread_mutex_destroy(&journal->lock);
+		journal_free(journal);
+		return NULL;
+	}
+	/* a new save starts from a snapshot of the map as it is */
+	if (journal->fd < 0) {
+		pthread_mutex_lock(&journal->lock);
+		request_snapshot(journal, 0);
+		pthread_mutex_unlock(&journal->lock);
+	}
+	map_observe(map, observe, journal);
+	return journal;
+}
+
+void journal_stop(struct journal *journal)
+{
+	if (!journal)
+		return;
+	map_observe(journal->map, NULL, NULL);
+	pthread_mutex_lock(&journal->lock);
+	journal->stopping = 1;
+	pthread_cond_signal(&journal->wake);
+	pthread_mutex_unlock(&journal->lock);
+	pthread_join(journal->thread, NULL);
+	if (journal->fd >= 0)
+		close(journal->fd);
+	pthread_cond_destroy(&journal->synced);
+	pthread_cond_destroy(&journal->wake);
+	pthread_mutex_destroy(&journal->lock);
+	journal_free(journal);
+}
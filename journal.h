@@ -0,0 +1,64 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+/*
+ *  Copyright 2016 Kendall E. Blake
+ *
+ *  This file is part of cairo-test.
+ *
+ *  cairo-test is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published
+ *  by the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  cairo-test is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with cairo-test.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "map.h"
+
+/* A saved game is two files.  path.map is the map as it stood when the
+ * journal was last compacted, as a binary map file.  path.journal starts
+ * with the player as they stood then, and each change made since follows:
+ * runs of tiles written to the map and the player's new state.  Every
+ * record holds the new value outright, so replaying a record twice does
+ * no harm. */
+#define JOURNAL_MAGIC  "DJOURN01"
+#define JOURNAL_HEADER 24
+/* Once this much has been journaled since the last snapshot, a new
+ * snapshot is written and the journal starts over. */
+#define JOURNAL_COMPACT_BYTES (1 << 20)
+
+struct journal;
+
+/* The game saved at path, with the calling thread's player put back
+ * where it was, or NULL if there is no save there.  The snapshot is
+ * mapped into memory rather than read, and only the whole records of
+ * the journal are replayed: a record cut short by a crash is dropped. */
+/*@null@*/
+struct map *journal_load(const char *path);
+
+/* Save every change made to map, and each player state noted, at path.
+ * map must be what journal_load() gave for path, if it gave anything;
+ * otherwise the map as it is now becomes the first snapshot.  Writing,
+ * syncing and compacting all happen on a thread of the journal's own:
+ * the game only ever appends to a buffer, and a snapshot of the map is
+ * O(1) to take however big the map is.  Records that arrive while the
+ * thread is syncing are synced together after it, so however fast they
+ * come there is at most one fsync() in flight. */
+/*@null@*/
+struct journal *journal_start(const char *path, struct map *map);
+/* Stop watching the map, write out and sync everything, and stop. */
+void journal_stop(/*@null@*/ struct journal *journal);
+
+/* Journal the calling thread's player if it has changed since last time. */
+void journal_note_player(/*@null@*/ struct journal *journal);
+/* Wait until everything journaled so far is on disk.  Zero if any of it
+ * could not be written. */
+int journal_sync(/*@null@*/ struct journal *journal);
+
+#endif
@@ -0,0 +1,251 @@
+/*
+ *  Copyright 2016 Kendall E. Blake
+ *
+ *  This file is part of cairo-test.
+ *
+ *  cairo-test is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published
+ *  by the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  cairo-test is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with cairo-test.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "game.h"
+#include "protocol.h"
+
+/* Drives dungeon_server with many concurrent clients, each playing a
+ * series of short random-walk sessions, and reports how many sessions and
+ * actions a second the server gets through and how long each frame took.
+ * Only replies that carry a frame count as frames. */
+
+struct worker
+{
+	pthread_t thread;
+	unsigned int seed;
+	long     sessions;
+	long     failures;
+	long     actions;
+	long     nlatencies;
+	double  *latencies;
+};
+
+static const char *socket_path = PROTOCOL_DEFAULT_SOCKET;
+static long sessions_per_worker = 100;
+static long actions_per_session = 50;
+static int  want_frames = 1;
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int read_all(int fd, void *buf, size_t len)
+{
+	char *p = (char *)buf;
+	while (len) {
+		ssize_t n = read(fd, p, len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return 0;
+		p += n;
+		len -= (size_t)n;
+	}
+	return 1;
+}
+
+static int connect_server(void)
+{
+	struct sockaddr_un addr;
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+	if (fd < 0)
+		return -1;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, socket_path, sizeof(addr.sun_path) - 1);
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static int play_session(struct worker *w, char **frame, size_t *frame_size)
+{
+	int fd = connect_server();
+	if (fd < 0)
+		return 0;
+
+	for (long i = 0; i < actions_per_session; i++) {
+		struct protocol_request request;
+		struct protocol_reply   reply;
+		double start = now();
+
+		/* mostly walk forward, turn now and then */
+		switch (rand_r(&w->seed) % 8) {
+			case 0: request.action = ACTION_TURN_LEFT; break;
+			case 1: request.action = ACTION_TURN_RIGHT; break;
+			case 2: request.action = ACTION_GET; break;
+			default: request.action = ACTION_FORWARD; break;
+		}
+		request.flags = want_frames ? PROTOCOL_WANT_FRAME : PROTOCOL_STATE_ONLY;
+		if (write(fd, &request, sizeof(request)) != sizeof(request)
+			|| !read_all(fd, &reply, sizeof(reply)))
+			goto fail;
+		if (reply.stride) {
+			size_t size = (size_t)reply.stride * reply.height;
+			if (size > *frame_size) {
+				char *bigger = (char *)realloc(*frame, size);
+				if (!bigger)
+					goto fail;
+				*frame = bigger;
+				*frame_size = size;
+			}
+			if (!read_all(fd, *frame, size))
+				goto fail;
+			w->latencies[w->nlatencies++] = now() - start;
+		}
+		w->actions++;
+	}
+	close(fd);
+	return 1;
+
+	fail:
+	close(fd);
+	return 0;
+}
+
+static void *run_worker(void *arg)
+{
+	struct worker *w = (struct worker *)arg;
+	char  *frame = NULL;
+	size_t frame_size = 0;
+
+	for (long i = 0; i < sessions_per_worker; i++) {
+		if (play_session(w, &frame, &frame_size))
+			w->sessions++;
+		else
+			w->failures++;
+	}
+	free(frame);
+	return NULL;
+}
+
+static int compare_doubles(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+	return (x > y) - (x < y);
+}
+
+static double percentile(double *sorted, long n, double p)
+{
+	long i = (long)(p * (n - 1) + 0.5);
+	return n ? sorted[i] : 0.0;
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "usage: %s [--socket path] [--clients n] [--sessions n]"
+		" [--actions n] [--state-only]\n", name);
+	exit(2);
+}
+
+int main (int argc, char *argv[])
+{
+	struct worker *workers;
+	int     clients = 8;
+	long    total_sessions = 0, total_failures = 0, total_actions = 0, n = 0;
+	int     started;
+	double *all, start, elapsed;
+
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "--socket") && i + 1 < argc) {
+			socket_path = argv[++i];
+		} else if (!strcmp(argv[i], "--clients") && i + 1 < argc) {
+			clients = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "--sessions") && i + 1 < argc) {
+			sessions_per_worker = atol(argv[++i]);
+		} else if (!strcmp(argv[i], "--actions") && i + 1 < argc) {
+			actions_per_session = atol(argv[++i]);
+		} else if (!strcmp(argv[i], "--state-only")) {
+			want_frames = 0;
+		} else {
+			usage(argv[0]);
+		}
+	}
+	if (clients < 1 || sessions_per_worker < 1 || actions_per_session < 1)
+		usage(argv[0]);
+
+	workers = (struct worker *)calloc((size_t)clients, sizeof(struct worker));
+	if (!workers)
+		return 1;
+	for (int i = 0; i < clients; i++) {
+		workers[i].seed = (unsigned int)i + 1;
+		workers[i].latencies = (double *)malloc(
+			sizeof(double) * sessions_per_worker * actions_per_session);
+		if (!workers[i].latencies)
+			return 1;
+	}
+
+	start = now();
+	for (started = 0; started < clients; started++) {
+		if (pthread_create(&workers[started].thread, NULL, run_worker, &workers[started])) {
+			fprintf(stderr, "Could only start %i of %i clients\n", started, clients);
+			break;
+		}
+	}
+	for (int i = 0; i < started; i++)
+		pthread_join(workers[i].thread, NULL);
+	elapsed = now() - start;
+	if (!started)
+		return 1;
+
+	all = (double *)malloc(sizeof(double) * clients * sessions_per_worker * actions_per_session);
+	if (!all)
+		return 1;
+	for (int i = 0; i < clients; i++) {
+		total_sessions += workers[i].sessions;
+		total_failures += workers[i].failures;
+		total_actions += workers[i].actions;
+		memcpy(all + n, workers[i].latencies, sizeof(double) * workers[i].nlatencies);
+		n += workers[i].nlatencies;
+		free(workers[i].latencies);
+	}
+	qsort(all, (size_t)n, sizeof(double), compare_doubles);
+
+	printf("clients\t%i\n", started);
+	printf("sessions\t%li\n", total_sessions);
+	printf("failed_sessions\t%li\n", total_failures);
+	printf("seconds\t%.3f\n", elapsed);
+	printf("sessions_per_second\t%.1f\n", total_sessions / elapsed);
+	printf("actions_per_second\t%.1f\n", total_actions / elapsed);
+	printf("frames_per_second\t%.1f\n", n / elapsed);
+	printf("latency_p50_ms\t%.3f\n", percentile(all, n, 0.50) * 1e3);
+	printf("latency_p99_ms\t%.3f\n", percentile(all, n, 0.99) * 1e3);
+	printf("latency_max_ms\t%.3f\n", n ? all[n - 1] * 1e3 : 0.0);
+
+	free(all);
+	free(workers);
+	return total_failures != 0 || started != clients;
+}
@@ -17,38 +17,449 @@
  *  along with cairo-test.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <stdatomic.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
 #include "map.h"
+#include "world.h"
+
+/* Tiles live in fixed-size pages reached through a two-level directory:
+
+	map -> root -> dirs[] -> pages[] -> tiles[]
+
+   Every level is reference counted, so a snapshot only has to share the
+   root.  Whoever writes first copies the root, the directory and the page
+   on the path to the tile, leaving everything else shared.  Taking a
+   snapshot is O(1) and the copying afterwards is proportional to the
+   pages touched, not to the size of the map.
+
+   A map (or snapshot) may only be used from one thread at a time, but
+   snapshots can be handed to other threads and deleted there.  The one
+   exception is filling a map nothing has been snapshotted from: then
+   only the tiles change, and threads may write different tiles at once.
+
+   An unbounded map has no pages.  Its tiles come from a world, shared by
+   the map and its snapshots, except in chunks the map has changed: a
+   changed chunk is copied out whole into a delta, and only deltas are
+   kept for good.  The deltas hang off a hash table shared and copied on
+   write in the same way as the directory.
+
+   A small map's pages hold runs of tiles in row order.  A large one is
+   tiled instead: each page holds a MAP_BLOCK x MAP_BLOCK square, one
+   cache line to a row, so walking down a column stays as close in memory
+   as walking along a row.  The blocks sit in a grid with a ring of blocks
+   of 'X' around the map, all the same shared, never written page, and
+   the cells of edge blocks that overhang the map are 'X' too: anything
+   within a block of the map can be read without looking at the edges.
+   The blocks the map starts with are carved out of one slab, aligned so
+   the kernel can back it with huge pages. */
+
+#define MAP_PAGE_SHIFT 12
+#define MAP_PAGE_TILES (1 << MAP_PAGE_SHIFT)
+#define MAP_DIR_SHIFT  9
+#define MAP_DIR_PAGES  (1 << MAP_DIR_SHIFT)
+#define MAP_BLOCK_SHIFT 6
+#define MAP_BLOCK       (1 << MAP_BLOCK_SHIFT)
+/* Maps at least this wide and tall are tiled. */
+#define MAP_TILED_SIDE  256
+#define MAP_HUGE_PAGE   ((size_t)2 << 20)
+#define MAP_SMALL_PAGE  ((size_t)4 << 10)
+
+_Static_assert(MAP_BLOCK * MAP_BLOCK == MAP_PAGE_TILES, "a block fills a page");
+
+/* Pages cut from a slab are freed all together, with the last of them. */
+struct map_slab
+{
+	atomic_int refs;
+	void      *memory;
+};
+
+struct map_page
+{
+	atomic_int       refs;
+	struct map_slab *slab;                  /* NULL if allocated alone */
+	_Alignas(64) char tiles[MAP_PAGE_TILES];
+};
+
+struct map_dir
+{
+	atomic_int       refs;
+	struct map_page *pages[MAP_DIR_PAGES];
+};
+
+struct map_root
+{
+	atomic_int      refs;
+	size_t          ndirs;
+	struct map_dir *dirs[];
+};
+
+struct map_delta
+{
+	atomic_int refs;
+	long       cx, cy;
+	char       tiles[WORLD_CHUNK_TILES];
+};
+
+struct map_deltas
+{
+	atomic_int        refs;
+	size_t            count, size;      /* size is a power of two */
+	struct map_delta *slots[];
+};
 
 struct map
 {
 	size_t width;
 	size_t height;
-	char *data;
+	struct map_root *root;
+	int               tiled;
+	size_t            blocks_across;    /* tiled: the grid, apron and all */
+	size_t            span_x, span_y;   /* tiled: the grid's size in tiles */
+	struct world      *world;           /* NULL unless unbounded */
+	struct map_deltas *deltas;
+	map_observer_fn   observer;
+	void             *observer_context;
 };
 
+static void slab_release(struct map_slab *slab)
+{
+	if (atomic_fetch_sub(&slab->refs, 1) == 1) {
+		free(slab->memory);
+		free(slab);
+	}
+}
+
+static void page_release(struct map_page *page)
+{
+	if (page && atomic_fetch_sub(&page->refs, 1) == 1) {
+		if (page->slab)
+			slab_release(page->slab);
+		else
+			free(page);
+	}
+}
+
+/*@null@*/
+static struct map_page *page_alloc(void)
+{
+	struct map_page *page = (struct map_page *)aligned_alloc(_Alignof(struct map_page),
+		sizeof(struct map_page));
+	if (page) {
+		atomic_init(&page->refs, 1);
+		page->slab = NULL;
+	}
+	return page;
+}
+
+static struct map_page *page_at(struct map *map, size_t n)
+{
+	return map->root->dirs[n >> MAP_DIR_SHIFT]->pages[n & (MAP_DIR_PAGES - 1)];
+}
+
+static void dir_release(struct map_dir *dir)
+{
+	if (dir && atomic_fetch_sub(&dir->refs, 1) == 1) {
+		for (int i = 0; i < MAP_DIR_PAGES; i++)
+			page_release(dir->pages[i]);
+		free(dir);
+	}
+}
+
+static void root_release(struct map_root *root)
+{
+	if (root && atomic_fetch_sub(&root->refs, 1) == 1) {
+		for (size_t i = 0; i < root->ndirs; i++)
+			dir_release(root->dirs[i]);
+		free(root);
+	}
+}
+
+static struct map_root *root_alloc(size_t ndirs)
+{
+	struct map_root *root = (struct map_root *)calloc(1,
+		sizeof(struct map_root) + ndirs * sizeof(struct map_dir *));
+	if (root) {
+		atomic_init(&root->refs, 1);
+		root->ndirs = ndirs;
+	}
+	return root;
+}
+
+/* Give map a root with empty directories for npages pages. */
+static int map_new_dirs(struct map *map, size_t npages)
+{
+	size_t ndirs = (npages + MAP_DIR_PAGES - 1) >> MAP_DIR_SHIFT;
+
+	map->root = root_alloc(ndirs);
+	if (!map->root)
+		return 0;
+	for (size_t d = 0; d < ndirs; d++)
+	{
+		struct map_dir *dir = (struct map_dir *)calloc(1, sizeof(struct map_dir));
+		if (!dir)
+			return 0;
+		atomic_init(&dir->refs, 1);
+		map->root->dirs[d] = dir;
+	}
+	return 1;
+}
+
+/* Lay map out as a grid of blocks: the map's own blocks from a slab, and
+ * the apron around them all one sentinel page. */
+static int map_new_tiled(struct map *map)
+{
+	size_t across = (map->width + MAP_BLOCK - 1) / MAP_BLOCK + 2;
+	size_t down   = (map->height + MAP_BLOCK - 1) / MAP_BLOCK + 2;
+	size_t inner  = (across - 2) * (down - 2);
+	size_t bytes  = inner * sizeof(struct map_page);
+	size_t align  = bytes >= MAP_HUGE_PAGE ? MAP_HUGE_PAGE : MAP_SMALL_PAGE;
+	struct map_page *sentinel, *pages;
+	struct map_slab *slab;
+	size_t k = 0;
+
+	map->tiled = 1;
+	map->blocks_across = across;
+	map->span_x = across * MAP_BLOCK;
+	map->span_y = down * MAP_BLOCK;
+	if (!map_new_dirs(map, across * down))
+		return 0;
+
+	bytes = (bytes + align - 1) / align * align;
+	sentinel = page_alloc();
+	slab = (struct map_slab *)malloc(sizeof(struct map_slab));
+	pages = (struct map_page *)aligned_alloc(align, bytes);
+	if (!sentinel || !slab || !pages) {
+		free(sentinel);
+		free(slab);
+		free(pages);
+		return 0;
+	}
+#ifdef MADV_HUGEPAGE
+	if (align == MAP_HUGE_PAGE)
+		madvise(pages, bytes, MADV_HUGEPAGE);
+#endif
+	memset(sentinel->tiles, 'X', MAP_PAGE_TILES);
+	atomic_init(&sentinel->refs, (int)(across * down - inner));
+	atomic_init(&slab->refs, (int)inner);
+	slab->memory = pages;
+
+	for (size_t by = 0; by < down; by++)
+	for (size_t bx = 0; bx < across; bx++)
+	{
+		struct map_page *page = sentinel;
+
+		if (bx > 0 && by > 0 && bx < across - 1 && by < down - 1) {
+			page = &pages[k++];
+			atomic_init(&page->refs, 1);
+			page->slab = slab;
+			/* wall off whatever overhangs the map */
+			if ((bx == across - 2 && map->width % MAP_BLOCK)
+					|| (by == down - 2 && map->height % MAP_BLOCK))
+				memset(page->tiles, 'X', MAP_PAGE_TILES);
+		}
+		map->root->dirs[(by * across + bx) >> MAP_DIR_SHIFT]
+			->pages[(by * across + bx) & (MAP_DIR_PAGES - 1)] = page;
+	}
+	return 1;
+}
+
 /*@null@*/
 struct map *map_new(size_t width, size_t height)
 {
 	struct map *map = (struct map *)malloc(sizeof(struct map));
 	if (map)
 	{
+		size_t npages = (width * height + MAP_PAGE_TILES - 1) >> MAP_PAGE_SHIFT;
+
 		map->width = width;
 		map->height = height;
-		map->data = (char *)malloc(width * height * sizeof(char));
+		map->tiled = 0;
+		map->world = NULL;
+		map->deltas = NULL;
+		map->observer = NULL;
+		if (width >= MAP_TILED_SIDE && height >= MAP_TILED_SIDE) {
+			if (!map_new_tiled(map))
+				goto fail;
+			return map;
+		}
+		if (!map_new_dirs(map, npages))
+			goto fail;
+		for (size_t p = 0; p < npages; p++)
+		{
+			struct map_page *page = page_alloc();
+			if (!page)
+				goto fail;
+			map->root->dirs[p >> MAP_DIR_SHIFT]->pages[p & (MAP_DIR_PAGES - 1)] = page;
+		}
+	}
+
+	return map;
+
+	fail:
+	map_delete(map);
+	return NULL;
+}
+
+static void delta_release(struct map_delta *delta)
+{
+	if (delta && atomic_fetch_sub(&delta->refs, 1) == 1)
+		free(delta);
+}
+
+static void deltas_release(struct map_deltas *deltas)
+{
+	if (deltas && atomic_fetch_sub(&deltas->refs, 1) == 1) {
+		for (size_t i = 0; i < deltas->size; i++)
+			delta_release(deltas->slots[i]);
+		free(deltas);
 	}
+}
 
+static struct map_deltas *deltas_alloc(size_t size)
+{
+	struct map_deltas *deltas = (struct map_deltas *)calloc(1,
+		sizeof(struct map_deltas) + size * sizeof(struct map_delta *));
+	if (deltas) {
+		atomic_init(&deltas->refs, 1);
+		deltas->size = size;
+	}
+	return deltas;
+}
+
+/*@null@*/
+struct map *map_new_world(uint64_t seed)
+{
+	struct map *map = (struct map *)malloc(sizeof(struct map));
+	if (map) {
+		map->width = map->height = 0;
+		map->root = NULL;
+		map->tiled = 0;
+		map->observer = NULL;
+		map->world = world_new(seed);
+		map->deltas = deltas_alloc(16);
+		if (!map->world || !map->deltas) {
+			map_delete(map);
+			return NULL;
+		}
+	}
 	return map;
 }
 
 void map_delete (struct map *map)
 {
 	if (map) {
-		if (map->data) free(map->data);
+		root_release(map->root);
+		deltas_release(map->deltas);
+		world_release(map->world);
 		free (map);
 	}
 }
 
+/*@null@*/
+struct map *map_snapshot(struct map *map)
+{
+	struct map *snapshot = (struct map *)malloc(sizeof(struct map));
+	if (snapshot) {
+		*snapshot = *map;
+		snapshot->observer = NULL;
+		if (map->root)
+			atomic_fetch_add(&map->root->refs, 1);
+		if (map->world) {
+			world_retain(map->world);
+			atomic_fetch_add(&map->deltas->refs, 1);
+		}
+	}
+	return snapshot;
+}
+
+void map_observe(struct map *map, map_observer_fn observer, void *context)
+{
+	map->observer = observer;
+	map->observer_context = context;
+}
+
+/* Report each run of tiles in page n that differs between old and new. */
+static void notify_page(struct map *map, size_t n, const struct map_page *old,
+	const struct map_page *new)
+{
+	size_t end = MAP_PAGE_TILES;
+
+	/* the last page of a small map runs past its last tile */
+	if (!map->tiled && map->width * map->height - (n << MAP_PAGE_SHIFT) < end)
+		end = map->width * map->height - (n << MAP_PAGE_SHIFT);
+	for (size_t k = 0; k < end; k++) {
+		size_t run = 1, x, y, row_left;
+
+		if (old->tiles[k] == new->tiles[k])
+			continue;
+		if (map->tiled) {
+			x = n % map->blocks_across * MAP_BLOCK + (k & (MAP_BLOCK - 1)) - MAP_BLOCK;
+			y = n / map->blocks_across * MAP_BLOCK + (k >> MAP_BLOCK_SHIFT) - MAP_BLOCK;
+			row_left = MAP_BLOCK - (k & (MAP_BLOCK - 1));
+		} else {
+			size_t i = (n << MAP_PAGE_SHIFT) + k;
+
+			x = i % map->width;
+			y = i / map->width;
+			row_left = map->width - x;
+		}
+		/* the cells of a block that overhang the map are 'X' on both
+		 * sides, so a run never reaches them */
+		while (run < row_left && k + run < end
+				&& old->tiles[k + run] != new->tiles[k + run])
+			run++;
+		map->observer(map->observer_context, (int)x, (int)y, new->tiles + k, run);
+		k += run - 1;
+	}
+}
+
+/* Tell map's observer what a restore changed, given the root it had. */
+static void notify_restore(struct map *map, struct map_root *old,
+	size_t old_width, size_t old_height)
+{
+	if (!map->observer || old == map->root)
+		return;
+	if (map->world || !old || !map->root
+			|| old_width != map->width || old_height != map->height) {
+		map->observer(map->observer_context, 0, 0, NULL, 0);
+		return;
+	}
+	for (size_t d = 0; d < map->root->ndirs; d++) {
+		struct map_dir *from = old->dirs[d], *to = map->root->dirs[d];
+
+		if (from == to)
+			continue;
+		for (size_t p = 0; p < MAP_DIR_PAGES; p++)
+			if (from->pages[p] != to->pages[p] && from->pages[p] && to->pages[p])
+				notify_page(map, (d << MAP_DIR_SHIFT) + p, from->pages[p], to->pages[p]);
+	}
+}
+
+void map_restore(struct map *map, struct map *snapshot)
+{
+	struct map_root   *old = map->root;
+	struct map_deltas *old_deltas = map->deltas;
+	size_t             old_width = map->width, old_height = map->height;
+
+	if (snapshot->root)
+		atomic_fetch_add(&snapshot->root->refs, 1);
+	if (snapshot->deltas)
+		atomic_fetch_add(&snapshot->deltas->refs, 1);
+	map->width  = snapshot->width;
+	map->height = snapshot->height;
+	map->root   = snapshot->root;
+	map->tiled  = snapshot->tiled;
+	map->blocks_across = snapshot->blocks_across;
+	map->span_x = snapshot->span_x;
+	map->span_y = snapshot->span_y;
+	map->deltas = snapshot->deltas;
+	notify_restore(map, old, old_width, old_height);
+	root_release(old);
+	deltas_release(old_deltas);
+}
+
 int map_width (struct map *map)
 {
 	return (int)map->width;
@@ -59,16 +470,335 @@ int map_height (struct map *map)
 	return (int)map->height;
 }
 
+static size_t delta_slot(struct map_deltas *deltas, long cx, long cy)
+{
+	uint64_t h = (uint64_t)cx * 0x9e3779b97f4a7c15ull ^ (uint64_t)cy * 0xc2b2ae3d27d4eb4full;
+	size_t   i = (size_t)(h ^ h >> 29) & (deltas->size - 1);
+
+	while (deltas->slots[i] && (deltas->slots[i]->cx != cx || deltas->slots[i]->cy != cy))
+		i = (i + 1) & (deltas->size - 1);
+	return i;
+}
+
+static char world_map_tile(struct map *map, int x, int y)
+{
+	long              cx = world_chunk_of(x), cy = world_chunk_of(y);
+	struct map_delta *delta = map->deltas->slots[delta_slot(map->deltas, cx, cy)];
+
+	if (delta)
+		return delta->tiles[(y - cy * WORLD_CHUNK) * WORLD_CHUNK + (x - cx * WORLD_CHUNK)];
+	return world_tile(map->world, x, y);
+}
+
+/* Copy a row out a chunk's span at a time, from the delta where there is
+ * one and from the world where there is not. */
+static void world_map_read_row(struct map *map, long x, long y, char *tiles, size_t n)
+{
+	long cy = world_chunk_of(y);
+
+	while (n) {
+		long              cx = world_chunk_of(x), offset = x - cx * WORLD_CHUNK;
+		size_t            span = (size_t)(WORLD_CHUNK - offset);
+		struct map_delta *delta = map->deltas->slots[delta_slot(map->deltas, cx, cy)];
+
+		if (span > n)
+			span = n;
+		if (delta)
+			memcpy(tiles, delta->tiles + (y - cy * WORLD_CHUNK) * WORLD_CHUNK + offset, span);
+		else
+			world_read_row(map->world, x, y, tiles, span);
+		tiles += span;
+		x += (long)span;
+		n -= span;
+	}
+}
+
+/* Make the table ours alone, with room for one more delta. */
+static struct map_deltas *writable_deltas(struct map *map)
+{
+	struct map_deltas *old = map->deltas, *copy;
+	size_t             size = old->size;
+
+	if (atomic_load(&old->refs) == 1 && (old->count + 1) * 2 <= size)
+		return old;
+	if ((old->count + 1) * 2 > size)
+		size *= 2;
+	copy = deltas_alloc(size);
+	if (!copy)
+		return NULL;
+	for (size_t i = 0; i < old->size; i++) {
+		struct map_delta *delta = old->slots[i];
+		if (delta) {
+			atomic_fetch_add(&delta->refs, 1);
+			copy->slots[delta_slot(copy, delta->cx, delta->cy)] = delta;
+			copy->count++;
+		}
+	}
+	deltas_release(old);
+	return map->deltas = copy;
+}
+
+static void world_map_set_tile(struct map *map, int x, int y, char tile)
+{
+	long               cx = world_chunk_of(x), cy = world_chunk_of(y);
+	struct map_deltas *deltas = writable_deltas(map);
+	struct map_delta  *delta, *copy;
+	size_t             slot;
+
+	if (!deltas)
+		return;
+	slot = delta_slot(deltas, cx, cy);
+	delta = deltas->slots[slot];
+	if (!delta || atomic_load(&delta->refs) > 1) {
+		copy = (struct map_delta *)malloc(sizeof(struct map_delta));
+		if (!copy)
+			return;
+		atomic_init(&copy->refs, 1);
+		copy->cx = cx;
+		copy->cy = cy;
+		if (delta)
+			memcpy(copy->tiles, delta->tiles, sizeof(copy->tiles));
+		else
+			world_chunk(map->world, cx, cy, copy->tiles);
+		if (!delta)
+			deltas->count++;
+		delta_release(delta);
+		deltas->slots[slot] = delta = copy;
+	}
+	delta->tiles[(y - cy * WORLD_CHUNK) * WORLD_CHUNK + (x - cx * WORLD_CHUNK)] = tile;
+}
+
+int map_contains(struct map *map, int x, int y)
+{
+	return map->world
+		|| (x >= 0 && y >= 0 && x < map_width(map) && y < map_height(map));
+}
+
+void map_set_focus(struct map *map, int x, int y)
+{
+	if (map->world)
+		world_set_focus(map->world, x, y);
+}
+
+/* Where the tile at (gx, gy) on a tiled map's grid lives: the block's
+ * page number, and the tile's place in the page. */
+static size_t block_of(struct map *map, size_t gx, size_t gy)
+{
+	return (gy >> MAP_BLOCK_SHIFT) * map->blocks_across + (gx >> MAP_BLOCK_SHIFT);
+}
+
+static size_t block_offset(size_t gx, size_t gy)
+{
+	return (gy & (MAP_BLOCK - 1)) << MAP_BLOCK_SHIFT | (gx & (MAP_BLOCK - 1));
+}
+
 char map_tile (struct map *map, int x, int y)
 {
+	size_t i;
+
+	if (map->tiled) {
+		/* the grid starts a block up and left of the map, so off the
+		 * top or left edge wraps round to past the end */
+		size_t gx = (size_t)x + MAP_BLOCK, gy = (size_t)y + MAP_BLOCK;
+
+		if (gx >= map->span_x || gy >= map->span_y)
+			return 'X';
+		return page_at(map, block_of(map, gx, gy))->tiles[block_offset(gx, gy)];
+	}
 	if (x < 0 || y < 0 || x >= map_width(map) || y >= map_height(map))
-		return 'X';
-	return map->data[x + y * map_width(map)];
+		return map->world ? world_map_tile(map, x, y) : 'X';
+	i = (size_t)x + (size_t)y * map->width;
+	return page_at(map, i >> MAP_PAGE_SHIFT)->tiles[i & (MAP_PAGE_TILES - 1)];
+}
+
+/* Make sure the path from map down to page n is ours alone, copying any
+ * level that is still shared with a snapshot. */
+static struct map_page *writable_page(struct map *map, size_t n)
+{
+	size_t d = n >> MAP_DIR_SHIFT;
+	size_t p = n & (MAP_DIR_PAGES - 1);
+	struct map_dir  *dir;
+	struct map_page *page;
+
+	if (atomic_load(&map->root->refs) > 1) {
+		struct map_root *copy = root_alloc(map->root->ndirs);
+		if (!copy)
+			return NULL;
+		for (size_t j = 0; j < copy->ndirs; j++) {
+			copy->dirs[j] = map->root->dirs[j];
+			atomic_fetch_add(&copy->dirs[j]->refs, 1);
+		}
+		root_release(map->root);
+		map->root = copy;
+	}
+
+	dir = map->root->dirs[d];
+	if (atomic_load(&dir->refs) > 1) {
+		struct map_dir *copy = (struct map_dir *)malloc(sizeof(struct map_dir));
+		if (!copy)
+			return NULL;
+		atomic_init(&copy->refs, 1);
+		for (int j = 0; j < MAP_DIR_PAGES; j++) {
+			copy->pages[j] = dir->pages[j];
+			if (copy->pages[j])
+				atomic_fetch_add(&copy->pages[j]->refs, 1);
+		}
+		dir_release(dir);
+		map->root->dirs[d] = dir = copy;
+	}
+
+	page = dir->pages[p];
+	if (atomic_load(&page->refs) > 1) {
+		struct map_page *copy = page_alloc();
+		if (!copy)
+			return NULL;
+		memcpy(copy->tiles, page->tiles, sizeof(copy->tiles));
+		page_release(page);
+		dir->pages[p] = page = copy;
+	}
+	return page;
 }
 
 void map_set_tile(struct map *map, int x, int y, char tile)
 {
-	if (x < 0 || y < 0 || x >= map_width(map) || y >= map_height(map))
+	struct map_page *page;
+	size_t i;
+
+	if (x < 0 || y < 0 || x >= map_width(map) || y >= map_height(map)) {
+		if (!map->world)
+			return;
+		world_map_set_tile(map, x, y, tile);
+	} else if (map->tiled) {
+		size_t gx = (size_t)x + MAP_BLOCK, gy = (size_t)y + MAP_BLOCK;
+
+		page = writable_page(map, block_of(map, gx, gy));
+		if (page)
+			page->tiles[block_offset(gx, gy)] = tile;
+	} else {
+		i = (size_t)x + (size_t)y * map->width;
+		page = writable_page(map, i >> MAP_PAGE_SHIFT);
+		if (page)
+			page->tiles[i & (MAP_PAGE_TILES - 1)] = tile;
+	}
+	if (map->observer)
+		map->observer(map->observer_context, x, y, &tile, 1);
+}
+
+/* Read a row of a tiled map a block at a time.  Everything in the grid
+ * can be copied as it is; only beyond the apron is filled in. */
+static void tiled_read_row(struct map *map, int x, int y, char *tiles, size_t n)
+{
+	size_t gx, gy = (size_t)y + MAP_BLOCK;
+
+	if (gy >= map->span_y) {
+		memset(tiles, 'X', n);
+		return;
+	}
+	for (; x < -MAP_BLOCK && n; x++, n--)
+		*tiles++ = 'X';
+	gx = (size_t)x + MAP_BLOCK;
+	while (n && gx < map->span_x) {
+		size_t offset = block_offset(gx, gy);
+		size_t chunk = MAP_BLOCK - (gx & (MAP_BLOCK - 1));
+
+		if (chunk > n)
+			chunk = n;
+		memcpy(tiles, page_at(map, block_of(map, gx, gy))->tiles + offset, chunk);
+		tiles += chunk;
+		gx += chunk;
+		n -= chunk;
+	}
+	memset(tiles, 'X', n);
+}
+
+void map_read_row(struct map *map, int x, int y, char *tiles, size_t n)
+{
+	size_t i, chunk;
+
+	if (map->world) {
+		world_map_read_row(map, x, y, tiles, n);
+		return;
+	}
+	if (map->tiled) {
+		tiled_read_row(map, x, y, tiles, n);
+		return;
+	}
+	if (y < 0 || y >= map_height(map) || x >= map_width(map)) {
+		memset(tiles, 'X', n);
+		return;
+	}
+	for (; x < 0 && n; x++, n--)
+		*tiles++ = 'X';
+	i = (size_t)x + (size_t)y * map->width;
+	chunk = map->width - (size_t)x;
+	if (n > chunk) {
+		memset(tiles + chunk, 'X', n - chunk);
+		n = chunk;
+	}
+	while (n) {
+		struct map_page *page = page_at(map, i >> MAP_PAGE_SHIFT);
+		size_t offset = i & (MAP_PAGE_TILES - 1);
+
+		chunk = MAP_PAGE_TILES - offset < n ? MAP_PAGE_TILES - offset : n;
+		memcpy(tiles, page->tiles + offset, chunk);
+		tiles += chunk;
+		i += chunk;
+		n -= chunk;
+	}
+}
+
+/* Copy n tiles, all on the map, into row y from column x. */
+static void write_tiles(struct map *map, int x, int y, const char *tiles, size_t n)
+{
+	size_t i, chunk;
+
+	if (map->tiled) {
+		size_t gx = (size_t)x + MAP_BLOCK, gy = (size_t)y + MAP_BLOCK;
+
+		while (n) {
+			struct map_page *page = writable_page(map, block_of(map, gx, gy));
+
+			if (!page)
+				return;
+			chunk = MAP_BLOCK - (gx & (MAP_BLOCK - 1));
+			if (chunk > n)
+				chunk = n;
+			memcpy(page->tiles + block_offset(gx, gy), tiles, chunk);
+			tiles += chunk;
+			gx += chunk;
+			n -= chunk;
+		}
+		return;
+	}
+	i = (size_t)x + (size_t)y * map->width;
+	while (n) {
+		struct map_page *page = writable_page(map, i >> MAP_PAGE_SHIFT);
+		size_t offset = i & (MAP_PAGE_TILES - 1);
+
+		if (!page)
+			return;
+		chunk = MAP_PAGE_TILES - offset < n ? MAP_PAGE_TILES - offset : n;
+		memcpy(page->tiles + offset, tiles, chunk);
+		tiles += chunk;
+		i += chunk;
+		n -= chunk;
+	}
+}
+
+void map_write_row(struct map *map, int x, int y, const char *tiles, size_t n)
+{
+	if (map->world) {
+		for (size_t k = 0; k < n; k++)
+			map_set_tile(map, x + (int)k, y, tiles[k]);
+		return;
+	}
+	if (y < 0 || y >= map_height(map) || x >= map_width(map))
 		return;
-	map->data[x + y * map_width(map)] = tile;
+	for (; x < 0 && n; x++, n--)
+		tiles++;
+	if (n > map->width - (size_t)x)
+		n = map->width - (size_t)x;
+	write_tiles(map, x, y, tiles, n);
+	if (map->observer && n)
+		map->observer(map->observer_context, x, y, tiles, n);
 }
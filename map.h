@@ -19,14 +19,46 @@
  *  along with cairo-test.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <stddef.h>
+#include <stdint.h>
+
 struct map;
 
 int map_width(struct map *map);
 int map_height(struct map *map);
 char map_tile(struct map *map, int x, int y);
 void map_set_tile(struct map *map, int x, int y, char tile);
+/* Copy n tiles along row y starting at column x out of or into the map.
+ * Reading past the edge gives 'X'; writing past it is ignored. */
+void map_read_row(struct map *map, int x, int y, char *tiles, size_t n);
+void map_write_row(struct map *map, int x, int y, const char *tiles, size_t n);
 /*@null@*/
 struct map *map_new(size_t width, size_t height);
+/* A map with no edges, generated from seed as it is looked at.  Its width
+ * and height are 0 but every tile is on it. */
+/*@null@*/
+struct map *map_new_world(uint64_t seed);
 void map_delete(struct map *map);
+/* Nonzero if (x, y) is a tile of the map rather than beyond its edge. */
+int map_contains(struct map *map, int x, int y);
+/* Where the player is, so that an unbounded map can get ready around it. */
+void map_set_focus(struct map *map, int x, int y);
+
+/* A frozen copy of map that shares its tiles until one side is written
+ * to.  Delete it with map_delete() like any other map. */
+/*@null@*/
+struct map *map_snapshot(struct map *map);
+/* Roll map back to the contents of snapshot. */
+void map_restore(struct map *map, struct map *snapshot);
+
+/* Called after each run of tiles written to map, whether by
+ * map_set_tile(), map_write_row() or map_restore(): n tiles along row y
+ * from column x now read tiles[0..n).  A restore only reports the tiles
+ * it changed, and finds them without looking at pages the two maps still
+ * share.  A restore that changes the map's size, or one on an unbounded
+ * map, is reported as a single call with tiles NULL.  Snapshots of map
+ * are not observed.  Pass NULL to stop. */
+typedef void (*map_observer_fn)(void *context, int x, int y, const char *tiles, size_t n);
+void map_observe(struct map *map, /*@null@*/ map_observer_fn observer, void *context);
 
 #endif
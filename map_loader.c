@@ -18,15 +18,18 @@
  */
 
 #include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
 
 #include "map_loader.h"
 
-static char * read_line_from(char *buffer, int buflen, int *line_width)
+static char * read_line_from(char *buffer, size_t buflen, int *line_width)
 {
 	*line_width = 0;
 	while ((buflen != 0) && (*buffer != '\r') && (*buffer != '\n')) {
@@ -48,6 +51,87 @@ static char * read_line_from(char *buffer, int buflen, int *line_width)
 	return buffer;
 }
 
+/* read() and write() stop short of 2GB at a time. */
+static int read_fully(int fd, char *buffer, size_t length)
+{
+	while (length) {
+		ssize_t n = read(fd, buffer, length);
+		if (n <= 0)
+			return 0;
+		buffer += n;
+		length -= (size_t)n;
+	}
+	return 1;
+}
+
+static int write_fully(int fd, const char *buffer, size_t length)
+{
+	while (length) {
+		ssize_t n = write(fd, buffer, length);
+		if (n <= 0)
+			return 0;
+		buffer += n;
+		length -= (size_t)n;
+	}
+	return 1;
+}
+
+static uint64_t get_le64(const unsigned char *bytes)
+{
+	uint64_t value = 0;
+	for (int i = 7; i >= 0; i--)
+		value = value << 8 | bytes[i];
+	return value;
+}
+
+static void put_le64(unsigned char *bytes, uint64_t value)
+{
+	for (int i = 0; i < 8; i++, value >>= 8)
+		bytes[i] = (unsigned char)value;
+}
+
+/* Map a binary map file into memory and copy its rows straight into the
+ * map, or read it a row at a time if it can't be mapped. */
+static struct map *load_binary_map(int fd, const unsigned char *header, size_t file_size)
+{
+	uint64_t    width  = get_le64(header + 8);
+	uint64_t    height = get_le64(header + 16);
+	struct map *map;
+	char       *row, *file;
+
+	if (width > INT_MAX || height > INT_MAX
+			|| (width && height > (file_size - MAP_BINARY_HEADER) / width)
+			|| width * height != file_size - MAP_BINARY_HEADER)
+		return NULL;
+	map = map_new(width, height);
+	if (!map)
+		return NULL;
+	file = mmap(NULL, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (file != MAP_FAILED) {
+		madvise(file, file_size, MADV_SEQUENTIAL);
+		for (uint64_t y = 0; y < height; y++)
+			map_write_row(map, 0, (int)y, file + MAP_BINARY_HEADER + y * width, width);
+		munmap(file, file_size);
+		return map;
+	}
+	row = (char *)malloc(width ? width : 1);
+	if (!map || !row) {
+		map_delete(map);
+		free(row);
+		return NULL;
+	}
+	for (uint64_t y = 0; y < height; y++) {
+		if (!read_fully(fd, row, width)) {
+			map_delete(map);
+			map = NULL;
+			break;
+		}
+		map_write_row(map, 0, (int)y, row, width);
+	}
+	free(row);
+	return map;
+}
+
 /* Should I put in a max map file size here? 
 	Load a map file one line at a time.  For now the contents of a map file
    look like this (this is subject to change):
@@ -76,14 +160,25 @@ struct map * load_map_from_path (const char *path)
 	if ((fd = open(path, O_RDONLY)) >= 0 && fstat(fd, &stat_buf) == 0) {
 		int linewidth = 0;
 		char *current = 0;
-		int buflen    = stat_buf.st_size;
+		size_t buflen = (size_t)stat_buf.st_size;
+		unsigned char header[MAP_BINARY_HEADER];
 
-		buffer = (char *)malloc((size_t)buflen + 1);
+		if (buflen >= MAP_BINARY_HEADER && read_fully(fd, (char *)header, MAP_BINARY_HEADER)
+				&& !memcmp(header, MAP_BINARY_MAGIC, 8)) {
+			map = load_binary_map(fd, header, buflen);
+			goto cleanup;
+		}
+		if (lseek(fd, 0, SEEK_SET) != 0) {
+			goto cleanup;
+		}
+		buffer = (char *)malloc(buflen + 1);
 		if (!buffer) {
 			goto cleanup;
 		}
-		read(fd, buffer, (size_t)buflen);
 		original = buffer;
+		if (!read_fully(fd, buffer, buflen)) {
+			goto cleanup;
+		}
 
 		while (original + stat_buf.st_size > buffer) {
 			current = read_line_from(buffer, buflen, &linewidth);
@@ -101,7 +196,7 @@ struct map * load_map_from_path (const char *path)
 			} else {
 				width = linewidth;
 			}
-			memmove(original+((height+1)*width), current, width);
+			memmove(original+((size_t)(height+1)*width), current, width);
 			end_of_line:
 			height++;
 			buffer = current;
@@ -112,13 +207,37 @@ struct map * load_map_from_path (const char *path)
 			for (int x = 0; x < width; x++)
 			for (int y = 0; y < height; y++)
 			{
-				map_set_tile(map, x, y, original[x + y * width]);
+				map_set_tile(map, x, y, original[x + (size_t)y * width]);
 			}
 		}
 	}
 
 	cleanup:
 	if (original) free(original);
+	if (fd >= 0) close(fd);
 
 	return map;
 }
+
+int save_map_to_fd (struct map *map, int fd, int binary)
+{
+	size_t width = map_width(map);
+	char  *row = (char *)malloc(width + 1);
+	int    ok = row != NULL;
+
+	if (ok && binary) {
+		unsigned char header[MAP_BINARY_HEADER];
+
+		memcpy(header, MAP_BINARY_MAGIC, 8);
+		put_le64(header + 8, width);
+		put_le64(header + 16, (uint64_t)map_height(map));
+		ok = write_fully(fd, (const char *)header, sizeof(header));
+	}
+	for (int y = 0; ok && y < map_height(map); y++) {
+		map_read_row(map, 0, y, row, width);
+		row[width] = '\n';
+		ok = write_fully(fd, row, binary ? width : width + 1);
+	}
+	free(row);
+	return ok;
+}
@@ -21,6 +21,16 @@
 
 #include "map.h"
 
+/* Maps are kept as text, one line of tiles per row, or in binary: the
+ * eight bytes of MAP_BINARY_MAGIC, the width and the height as 64-bit
+ * little-endian numbers, then the tiles row by row.  Binary maps load
+ * without a pass over every line, which matters once they run to GB. */
+#define MAP_BINARY_MAGIC  "MAPBIN01"
+#define MAP_BINARY_HEADER 24
+
+/* Reads either kind. */
 struct map * load_map_from_path (const char *path);
+/* Nonzero if the whole map was written. */
+int save_map_to_fd (struct map *map, int fd, int binary);
 
 #endif
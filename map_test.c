@@ -17,9 +17,23 @@
  *  along with cairo-test.  If not, see <http://www.gnu.org/licenses/>.
  */
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
+#include "components.h"
+#include "direction.h"
+#include "game.h"
+#include "generator.h"
+#include "journal.h"
 #include "map.h"
 #include "map_loader.h"
+#include "map_watch.h"
+#include "message_log.h"
+#include "player.h"
+#include "recording.h"
+#include "world.h"
 
 struct map *demo_map_setup ()
 {
@@ -97,6 +111,797 @@ TEST(test_loaded_map_correct_coordinates)
 	return res;
 }
 
+TEST(test_snapshot_is_frozen)
+{
+	struct map *map = demo_map_setup();
+	struct map *snapshot = map_snapshot(map);
+	int res = (snapshot != NULL);
+
+	if (res) {
+		map_set_tile(map, 3, 4, '.');
+		map_set_tile(snapshot, 1, 1, 'T');
+		res = map_tile(snapshot, 3, 4) == '|' && map_tile(map, 3, 4) == '.'
+			&& map_tile(map, 1, 1) == '.' && map_tile(snapshot, 1, 1) == 'T';
+	}
+
+	map_delete(snapshot);
+	map_delete(map);
+	return res;
+}
+
+TEST(test_snapshot_restore)
+{
+	struct map *map = demo_map_setup();
+	struct map *snapshot = map_snapshot(map);
+	int res;
+
+	map_set_tile(map, 3, 4, '.');
+	map_restore(map, snapshot);
+	map_delete(snapshot);
+	res = map_tile(map, 3, 4) == '|';
+	map_delete(map);
+	return res;
+}
+
+TEST(test_snapshot_large_map)
+{
+	/* spans several pages and directories */
+	struct map *map = map_new(5000, 3000);
+	struct map *snapshot;
+	int res = (map != NULL);
+
+	if (res) {
+		map_set_tile(map, 0, 0, 'A');
+		map_set_tile(map, 4999, 2999, 'B');
+		snapshot = map_snapshot(map);
+		map_set_tile(map, 4999, 2999, 'C');
+		res = map_tile(map, 0, 0) == 'A' && map_tile(map, 4999, 2999) == 'C'
+			&& map_tile(snapshot, 4999, 2999) == 'B';
+		map_delete(snapshot);
+	}
+	map_delete(map);
+	return res;
+}
+
+TEST(test_row_copy)
+{
+	/* crosses a page boundary and runs off both ends */
+	struct map *map = map_new(5000, 3);
+	char        row[6000], back[6000];
+	int         res = (map != NULL);
+
+	if (res) {
+		for (int i = 0; i < 6000; i++)
+			row[i] = 'a' + i % 26;
+		map_write_row(map, -10, 1, row, 6000);
+		map_read_row(map, -10, 1, back, 6000);
+		res = map_tile(map, 0, 1) == row[10] && map_tile(map, 4999, 1) == row[5009]
+			&& !memcmp(back + 10, row + 10, 5000)
+			&& back[0] == 'X' && back[9] == 'X' && back[5010] == 'X' && back[5999] == 'X';
+	}
+	map_delete(map);
+	return res;
+}
+
+TEST(test_tiled_map)
+{
+	/* big enough to be tiled, with blocks overhanging the right and
+	 * bottom edges */
+	struct map *map = map_new(300, 270);
+	struct map *snapshot;
+	char        row[500], back[500];
+	int         res = (map != NULL);
+
+	if (res) {
+		for (int y = 0; y < 270; y++)
+		for (int x = 0; x < 300; x++)
+			map_set_tile(map, x, y, 'a' + (x * 7 + y) % 26);
+		map_set_tile(map, 300, 5, '.');
+		map_set_tile(map, -1, 5, '.');
+		for (int y = 0; y < 270 && res; y++)
+		for (int x = 0; x < 300 && res; x++)
+			res = map_tile(map, x, y) == 'a' + (x * 7 + y) % 26;
+		res = res && map_tile(map, 300, 5) == 'X' && map_tile(map, -1, 5) == 'X'
+			&& map_tile(map, 319, 269) == 'X' && map_tile(map, 5, 270) == 'X'
+			&& map_tile(map, -65, 0) == 'X' && map_tile(map, 0, -200) == 'X'
+			&& map_tile(map, 10000, 10000) == 'X';
+
+		for (int i = 0; i < 500; i++)
+			row[i] = 'A' + i % 26;
+		snapshot = map_snapshot(map);
+		map_write_row(map, -100, 200, row, 500);
+		map_read_row(map, -100, 200, back, 500);
+		res = res && !memcmp(back + 100, row + 100, 300)
+			&& !memcmp(back, "XXXXXXXXXX", 10) && back[99] == 'X'
+			&& back[400] == 'X' && back[499] == 'X'
+			&& map_tile(map, 299, 200) == row[399] && map_tile(map, 0, 199) == 'a' + 199 % 26
+			&& map_tile(snapshot, 0, 200) == 'a' + 200 % 26;
+		map_restore(map, snapshot);
+		map_delete(snapshot);
+		res = res && map_tile(map, 0, 200) == 'a' + 200 % 26;
+	}
+	map_delete(map);
+	return res;
+}
+
+static int maps_match(struct map *a, struct map *b)
+{
+	if (map_width(a) != map_width(b) || map_height(a) != map_height(b))
+		return 0;
+	for (int y = 0; y < map_height(a); y++)
+	for (int x = 0; x < map_width(a); x++)
+		if (map_tile(a, x, y) != map_tile(b, x, y))
+			return 0;
+	return 1;
+}
+
+TEST(test_generate_any_thread_count)
+{
+	struct map *one = map_new(300, 200), *many = map_new(300, 200);
+	int res = one && many;
+
+	if (res) {
+		generate_dungeon(one, 42, 1);
+		generate_dungeon(many, 42, 4);
+		res = maps_match(one, many) && map_tile(one, 0, 0) == 'X';
+	}
+	map_delete(one);
+	map_delete(many);
+	return res;
+}
+
+static int round_trip(struct map *map, int binary)
+{
+	char        path[] = "/tmp/map_test.XXXXXX";
+	int         fd = mkstemp(path);
+	struct map *loaded = NULL;
+	int         res = fd >= 0 && save_map_to_fd(map, fd, binary);
+
+	if (fd >= 0)
+		close(fd);
+	if (res) {
+		loaded = load_map_from_path(path);
+		res = loaded && maps_match(map, loaded);
+	}
+	map_delete(loaded);
+	unlink(path);
+	return res;
+}
+
+TEST(test_save_and_load)
+{
+	struct map *map = map_new(97, 61);
+	int res = (map != NULL);
+
+	if (res) {
+		generate_dungeon(map, 7, 0);
+		res = round_trip(map, 0) && round_trip(map, 1);
+	}
+	map_delete(map);
+	return res;
+}
+
+TEST(test_world_is_seeded)
+{
+	struct map *a = map_new_world(5), *b = map_new_world(5);
+	int res = a && b, open = 0;
+
+	for (int y = -40000; res && y < -40000 + 3 * WORLD_CHUNK; y++)
+	for (int x = 70000; res && x < 70000 + 3 * WORLD_CHUNK; x++) {
+		res = map_contains(a, x, y) && map_tile(a, x, y) == map_tile(b, x, y);
+		open += map_tile(a, x, y) != 'X';
+	}
+	map_delete(a);
+	map_delete(b);
+	return res && open > 0;
+}
+
+TEST(test_world_keeps_changes)
+{
+	/* walk far enough that every chunk seen is evicted more than once */
+	struct map *map = map_new_world(11);
+	struct map *snapshot;
+	int res = (map != NULL);
+
+	if (res) {
+		map_set_tile(map, -5, -7, 'T');
+		snapshot = map_snapshot(map);
+		map_set_tile(map, -5, -7, '.');
+		for (int x = 0; x < 4 * WORLD_CHUNKS * WORLD_CHUNK; x += WORLD_CHUNK / 2) {
+			map_set_focus(map, x, 3);
+			map_tile(map, x, 3);
+			map_tile(map, x, 3 + WORLD_CHUNK);
+		}
+		res = map_tile(map, -5, -7) == '.' && map_tile(snapshot, -5, -7) == 'T';
+		map_restore(map, snapshot);
+		map_delete(snapshot);
+		res = res && map_tile(map, -5, -7) == 'T';
+	}
+	map_delete(map);
+	return res;
+}
+
+TEST(test_world_rows)
+{
+	/* rows across chunks, changed ones among them, read as tile by tile */
+	struct map *map = map_new_world(7);
+	char        row[3 * WORLD_CHUNK + 5], tiles[WORLD_CHUNK_TILES];
+	int         res = (map != NULL);
+
+	if (res) {
+		map_set_tile(map, -1, -3, 'T');
+		map_set_tile(map, WORLD_CHUNK, 2, 'T');
+	}
+	for (int y = -3; res && y < 3; y++) {
+		map_read_row(map, -WORLD_CHUNK - 2, y, row, sizeof row);
+		for (int k = 0; res && k < (int)sizeof row; k++)
+			res = row[k] == map_tile(map, k - WORLD_CHUNK - 2, y);
+	}
+	res = res && map_tile(map, -1, -3) == 'T' && map_tile(map, WORLD_CHUNK, 2) == 'T';
+	map_delete(map);
+
+	/* a new world's chunks are its own, wherever it is allocated */
+	map = map_new_world(8);
+	res = res && map != NULL;
+	if (res) {
+		generate_region(8, -1, 0, tiles);
+		map_read_row(map, -WORLD_CHUNK, 1, row, WORLD_CHUNK);
+		res = !memcmp(row, tiles + WORLD_CHUNK, WORLD_CHUNK)
+			&& map_tile(map, -1, 0) == tiles[WORLD_CHUNK - 1];
+	}
+	map_delete(map);
+	return res;
+}
+
+TEST(test_map_diff)
+{
+	struct map        *a = map_new(70, 9), *b;
+	struct map_change *changes = NULL;
+	long               count = -1;
+	int                res = (a != NULL);
+
+	if (res) {
+		generate_dungeon(a, 3, 0);
+		b = map_snapshot(a);
+		res = b && map_diff(a, b, &changes) == 0 && !changes;
+		if (res) {
+			map_set_tile(b, 69, 2, 'T');
+			map_set_tile(b, 0, 8, '|');
+			count = map_diff(a, b, &changes);
+		}
+		res = res && count == 2
+			&& changes[0].x == 69 && changes[0].y == 2 && changes[0].tile == 'T'
+			&& changes[1].x == 0 && changes[1].y == 8 && changes[1].tile == '|';
+		free(changes);
+		map_delete(b);
+	}
+	map_delete(a);
+	return res;
+}
+
+/* Edit the file the way an editor would, by renaming a new one over it. */
+static int save_as(struct map *map, const char *path)
+{
+	char temporary[] = "/tmp/map_test.XXXXXX";
+	int  fd = mkstemp(temporary);
+	int  res = fd >= 0 && save_map_to_fd(map, fd, 0);
+
+	if (fd >= 0)
+		close(fd);
+	res = res && rename(temporary, path) == 0;
+	if (!res)
+		unlink(temporary);
+	return res;
+}
+
+TEST(test_watch_reload)
+{
+	char              path[] = "/tmp/map_test.XXXXXX";
+	int               fd = mkstemp(path);
+	struct map       *live = map_new(50, 40), *edited = NULL;
+	struct map_watch *watch = NULL;
+	long              changed = 0;
+	int               res = fd >= 0 && live && save_map_to_fd(live, fd, 0);
+
+	if (fd >= 0)
+		close(fd);
+	if (res) {
+		generate_dungeon(live, 9, 0);
+		edited = map_snapshot(live);
+		watch = map_watch_start(path);
+		res = edited && watch;
+	}
+	if (res) {
+		map_set_tile(edited, 10, 20, 'T');
+		map_set_tile(edited, 49, 39, '.');
+		res = save_as(edited, path);
+		/* the live map is mostly the same as the new file already */
+		for (int i = 0; res && !changed && i < 2000; i++) {
+			usleep(1000);
+			changed = map_watch_update(watch, live);
+		}
+		res = res && changed > 0 && maps_match(live, edited);
+	}
+	map_watch_stop(watch);
+	map_delete(edited);
+	map_delete(live);
+	unlink(path);
+	return res;
+}
+
+/* Nonzero if both put the same tiles together, whatever the labels. */
+static int same_components(struct components *a, struct components *b, int width, int height)
+{
+	size_t    tiles = (size_t)width * height;
+	uint32_t *a_to_b = malloc(tiles * sizeof(uint32_t)), *b_to_a = malloc(tiles * sizeof(uint32_t));
+	int       res = a_to_b && b_to_a && components_count(a) == components_count(b);
+
+	for (size_t i = 0; res && i < tiles; i++)
+		a_to_b[i] = b_to_a[i] = COMPONENT_NONE;
+	for (int y = 0; res && y < height; y++)
+	for (int x = 0; res && x < width; x++) {
+		uint32_t la = components_label(a, x, y), lb = components_label(b, x, y);
+
+		if (la == COMPONENT_NONE || lb == COMPONENT_NONE) {
+			res = la == lb;
+		} else if (la >= tiles || lb >= tiles) {
+			res = 0;
+		} else {
+			if (a_to_b[la] == COMPONENT_NONE)
+				a_to_b[la] = lb;
+			if (b_to_a[lb] == COMPONENT_NONE)
+				b_to_a[lb] = la;
+			res = a_to_b[la] == lb && b_to_a[lb] == la;
+		}
+	}
+	free(a_to_b);
+	free(b_to_a);
+	return res;
+}
+
+/* Flood fill from each tile in turn and check every tile reached shares
+ * its label, and only those do. */
+static int components_by_flood(struct components *components, struct map *map)
+{
+	int     width = map_width(map), height = map_height(map);
+	size_t  tiles = (size_t)width * height, found = 0;
+	int    *stack = malloc(tiles * sizeof(int));
+	char   *seen = calloc(tiles, 1);
+	int     res = stack && seen;
+
+	for (size_t start = 0; res && start < tiles; start++) {
+		uint32_t label = components_label(components, (int)(start % width), (int)(start / width));
+		size_t   reached = 0;
+		int      top = 0;
+
+		if (seen[start] || map_tile(map, (int)(start % width), (int)(start / width)) == 'X') {
+			res = seen[start] || label == COMPONENT_NONE;
+			continue;
+		}
+		seen[start] = 1;
+		stack[top++] = (int)start;
+		found++;
+		while (res && top) {
+			int c = stack[--top], x = c % width, y = c / width;
+			int next[4][2] = { {x - 1, y}, {x + 1, y}, {x, y - 1}, {x, y + 1} };
+
+			reached++;
+			res = components_label(components, x, y) == label;
+			for (int i = 0; i < 4; i++) {
+				int nx = next[i][0], ny = next[i][1];
+
+				if (nx < 0 || ny < 0 || nx >= width || ny >= height
+						|| seen[(size_t)ny * width + nx] || map_tile(map, nx, ny) == 'X')
+					continue;
+				seen[(size_t)ny * width + nx] = 1;
+				stack[top++] = ny * width + nx;
+			}
+		}
+		res = res && components_size(components, label) == reached;
+	}
+	res = res && components_count(components) == found;
+	free(stack);
+	free(seen);
+	return res;
+}
+
+TEST(test_components_match_flood)
+{
+	struct map        *map = map_new(301, 203);
+	struct components *one = NULL, *many;
+	int                res = (map != NULL);
+
+	if (res) {
+		generate_dungeon(map, 21, 0);
+		/* wall some corridors up to make more than one component */
+		for (int i = 0; i < 3000; i++)
+			map_set_tile(map, (i * 7919) % 301, (i * 104729) % 203, 'X');
+		one = components_new(map, 1);
+		res = one && components_by_flood(one, map) && components_count(one) > 1;
+	}
+	for (int threads = 2; res && threads < 9; threads += 3) {
+		many = components_new(map, threads);
+		res = many && same_components(one, many, 301, 203);
+		components_delete(many);
+	}
+	components_delete(one);
+	map_delete(map);
+	return res;
+}
+
+TEST(test_components_follow_changes)
+{
+	struct map        *map = map_new(41, 29);
+	struct components *live = NULL, *fresh;
+	unsigned int       random = 12345;
+	int                res = (map != NULL);
+
+	if (res) {
+		generate_dungeon(map, 4, 1);
+		live = components_new(map, 2);
+		res = live != NULL;
+	}
+	for (int i = 0; res && i < 4000; i++) {
+		int x, y;
+
+		random = random * 1103515245 + 12345;
+		x = (int)(random >> 16) % 41;
+		random = random * 1103515245 + 12345;
+		y = (int)(random >> 16) % 29;
+		map_set_tile(map, x, y, map_tile(map, x, y) == 'X' ? '.' : 'X');
+		res = components_update(live, map, x, y);
+		if (res && i % 40 == 0) {
+			fresh = components_new(map, 1);
+			res = fresh && same_components(live, fresh, 41, 29)
+				&& components_by_flood(live, map);
+			components_delete(fresh);
+		}
+	}
+	components_delete(live);
+	map_delete(map);
+	return res;
+}
+
+/* A directory to save into, and a save path inside it. */
+static int save_dir(char *dir, char *path, size_t size)
+{
+	if (!mkdtemp(dir))
+		return 0;
+	snprintf(path, size, "%s/save", dir);
+	return 1;
+}
+
+static void remove_save(const char *dir, const char *path)
+{
+	char name[256];
+
+	snprintf(name, sizeof name, "%s.map", path);
+	unlink(name);
+	snprintf(name, sizeof name, "%s.journal", path);
+	unlink(name);
+	rmdir(dir);
+}
+
+static off_t file_size(const char *path, const char *suffix)
+{
+	char        name[256];
+	struct stat stat_buf;
+
+	snprintf(name, sizeof name, "%s%s", path, suffix);
+	return stat(name, &stat_buf) ? -1 : stat_buf.st_size;
+}
+
+TEST(test_journal_round_trip)
+{
+	char                dir[] = "/tmp/map_test.XXXXXX", path[200], name[256];
+	struct map         *map = demo_map_setup(), *snapshot, *loaded = NULL;
+	struct journal     *journal = NULL;
+	int                 res = save_dir(dir, path, sizeof path) && !journal_load(path);
+
+	player_set_x(1);
+	player_set_y(1);
+	player_set_gold(0);
+	if (res) {
+		journal = journal_start(path, map);
+		res = journal != NULL;
+	}
+	if (res) {
+		map_set_tile(map, 3, 4, '.');
+		player_set_x(2);
+		player_set_gold(7);
+		journal_note_player(journal);
+		/* an undo is journaled as the tiles it puts back */
+		snapshot = map_snapshot(map);
+		map_set_tile(map, 1, 1, 'T');
+		map_set_tile(map, 2, 1, 'T');
+		map_restore(map, snapshot);
+		map_delete(snapshot);
+		map_set_tile(map, 4, 1, 'T');
+		res = journal_sync(journal);
+		journal_stop(journal);
+
+		player_set_x(1);
+		player_set_gold(0);
+		loaded = journal_load(path);
+		res = res && loaded && maps_match(map, loaded)
+			&& player_x() == 2 && player_y() == 1 && player_gold() == 7;
+		map_delete(loaded);
+	}
+	if (res) {
+		/* cut the last record short, as a crash might, then go on */
+		snprintf(name, sizeof name, "%s.journal", path);
+		res = !truncate(name, file_size(path, ".journal") - 1);
+		loaded = journal_load(path);
+		res = res && loaded && map_tile(loaded, 4, 1) == '.' && map_tile(loaded, 3, 4) == '.';
+		journal = loaded ? journal_start(path, loaded) : NULL;
+		if (journal) {
+			map_set_tile(loaded, 1, 2, 'T');
+			journal_stop(journal);
+		}
+		map_delete(loaded);
+		loaded = journal_load(path);
+		res = res && journal && loaded && map_tile(loaded, 1, 2) == 'T'
+			&& map_tile(loaded, 4, 1) == '.' && map_tile(loaded, 3, 4) == '.';
+		map_delete(loaded);
+	}
+	remove_save(dir, path);
+	map_delete(map);
+	return res;
+}
+
+TEST(test_journal_compacts)
+{
+	char            dir[] = "/tmp/map_test.XXXXXX", path[200];
+	struct map     *map = map_new(300, 300), *loaded = NULL;
+	struct journal *journal = NULL;
+	int             res = map && save_dir(dir, path, sizeof path);
+
+	if (res) {
+		generate_dungeon(map, 3, 0);
+		journal = journal_start(path, map);
+		res = journal != NULL;
+	}
+	if (res) {
+		/* well past JOURNAL_COMPACT_BYTES of single tiles */
+		for (int i = 0; i < 200000; i++)
+			map_set_tile(map, i % 300, i / 300 % 300, "TX."[i % 3]);
+		res = journal_sync(journal);
+		journal_stop(journal);
+		loaded = journal_load(path);
+		res = res && loaded && maps_match(map, loaded)
+			&& file_size(path, ".journal") < JOURNAL_COMPACT_BYTES
+			&& file_size(path, ".map") == MAP_BINARY_HEADER + 300 * 300;
+		map_delete(loaded);
+	}
+	remove_save(dir, path);
+	map_delete(map);
+	return res;
+}
+
+/* Restore to a map of another size just as a compaction is asked for,
+ * while the thread is still busy with the records before it. */
+TEST(test_journal_resize_while_compacting)
+{
+	char            dir[] = "/tmp/map_test.XXXXXX", path[200];
+	struct map     *map = map_new(300, 300), *small = map_new(40, 30);
+	struct map     *sizes[2] = { NULL, NULL }, *loaded = NULL;
+	struct journal *journal = NULL;
+	int             res = map && small && save_dir(dir, path, sizeof path);
+
+	if (res) {
+		generate_dungeon(map, 3, 0);
+		generate_dungeon(small, 5, 0);
+		sizes[0] = map_snapshot(small);
+		sizes[1] = map_snapshot(map);
+		journal = journal_start(path, map);
+		res = sizes[0] && sizes[1] && journal;
+	}
+	for (int round = 0; res && round < 8; round++) {
+		int width = map_width(map), height = map_height(map);
+
+		/* just past JOURNAL_COMPACT_BYTES of single tiles, 13 bytes each */
+		for (int i = 0; i < JOURNAL_COMPACT_BYTES / 13 + 1; i++)
+			map_set_tile(map, i % width, i / width % height, "TX."[i % 3]);
+		map_restore(map, sizes[round % 2]);
+		for (int i = 0; i < 100; i++)
+			map_set_tile(map, i % 37, i % 29, "TX."[i % 3]);
+	}
+	if (res) {
+		res = journal_sync(journal);
+		journal_stop(journal);
+		loaded = journal_load(path);
+		res = res && loaded && maps_match(map, loaded);
+		map_delete(loaded);
+	}
+	remove_save(dir, path);
+	map_delete(sizes[0]);
+	map_delete(sizes[1]);
+	map_delete(small);
+	map_delete(map);
+	return res;
+}
+
+TEST(test_message_log_ring)
+{
+	unsigned long added = MESSAGE_LOG_LINES + 6, first = added - MESSAGE_LOG_LINES;
+	char          expected[32], long_line[2 * MESSAGE_LOG_WIDTH];
+	int           res;
+
+	message_log_clear();
+	for (unsigned long i = 0; i < added; i++)
+		message_log_add(i % 2 ? "line %lu\n" : "line %lu", i);
+	/* the ring has gone round: the oldest lines are gone */
+	res = message_log_count() == added
+		&& !message_log_line(first - 1) && message_log_line(first)
+		&& !message_log_line(added);
+	for (unsigned long n = first; res && n < added; n++) {
+		snprintf(expected, sizeof expected, "line %lu", n);
+		res = !strcmp(message_log_line(n), expected);
+	}
+	memset(long_line, 'x', sizeof long_line - 1);
+	long_line[sizeof long_line - 1] = '\0';
+	message_log_add("%s", long_line);
+	res = res && strlen(message_log_line(added)) == MESSAGE_LOG_WIDTH - 1;
+	message_log_clear();
+	return res && message_log_count() == 0 && !message_log_line(0);
+}
+
+/* Echo into a file while stdout is held, so the echo thread falls behind
+ * and has to drop lines. */
+TEST(test_message_log_echo)
+{
+	enum { ADDED = 1000 };
+	char          path[] = "/tmp/map_test.XXXXXX", line[MESSAGE_LOG_WIDTH + 2];
+	int           fd = mkstemp(path), saved = -1, res = fd >= 0;
+	long          echoed = 0, empty = 0, next = 1, in_order = 1;
+	unsigned long dropped = 0, n;
+	FILE         *file = NULL;
+
+	fflush(stdout);
+	if (res) {
+		saved = dup(1);
+		res = saved >= 0 && dup2(fd, 1) >= 0 && message_log_echo_start();
+	}
+	if (res) {
+		flockfile(stdout);
+		message_log_add("%s", "");
+		for (int i = 1; i < ADDED; i++)
+			message_log_add("echo %i", i);
+		funlockfile(stdout);
+		message_log_echo_stop();
+	}
+	fflush(stdout);
+	if (saved >= 0) {
+		dup2(saved, 1);
+		close(saved);
+	}
+	if (res)
+		res = (file = fopen(path, "r")) != NULL;
+	while (res && fgets(line, sizeof line, file)) {
+		long i;
+
+		if (sscanf(line, "(%lu messages dropped)", &n) == 1) {
+			dropped += n;
+		} else if (!strcmp(line, "\n")) {
+			empty++;
+			echoed++;
+		} else if (sscanf(line, "echo %li", &i) == 1) {
+			in_order = in_order && i >= next;
+			next = i + 1;
+			echoed++;
+		}
+	}
+	if (file)
+		fclose(file);
+	if (fd >= 0) {
+		close(fd);
+		unlink(path);
+	}
+	message_log_clear();
+	return res && in_order && empty == 1 && dropped > 0 && echoed + (long)dropped == ADDED;
+}
+
+/* Put the player back on the demo map's top corridor with treasure along it. */
+static struct map *treasure_map_setup(void)
+{
+	struct map *map = demo_map_setup();
+
+	map_set_tile(map, 2, 1, 'T');
+	map_set_tile(map, 3, 1, 'T');
+	map_set_tile(map, 4, 2, 'T');
+	player_set_x(1);
+	player_set_y(1);
+	player_set_facing(DIRECTION_EAST);
+	player_set_gold(0);
+	return map;
+}
+
+TEST(test_seed_makes_gold_repeat)
+{
+	int gold[2], res = 1;
+
+	for (int i = 0; i < 2; i++) {
+		current_map = treasure_map_setup();
+		player_set_x(2);
+		game_seed(1476113042);
+		do_get();
+		gold[i] = player_gold();
+		res = res && map_tile(current_map, 2, 1) == '.';
+		map_delete(current_map);
+		current_map = NULL;
+	}
+	return res && gold[0] == gold[1] && gold[0] >= 1 && gold[0] <= treasure_max();
+}
+
+TEST(test_recording_replays)
+{
+	static const int actions[] = {
+		ACTION_FORWARD, ACTION_GET, ACTION_FORWARD, ACTION_GET, ACTION_UNDO,
+		ACTION_GET, ACTION_FORWARD, ACTION_TURN_RIGHT, ACTION_FORWARD, ACTION_GET,
+		ACTION_BACKWARD, ACTION_TURN_LEFT
+	};
+	char                    path[] = "/tmp/map_test.XXXXXX";
+	int                     fd = mkstemp(path), n = 0, res = fd >= 0;
+	struct recording       *rec = NULL;
+	struct recording_event  ev;
+	uint64_t                played = 0;
+	enum { COUNT = sizeof(actions) / sizeof(actions[0]) };
+	int                     gold[COUNT];
+
+	if (fd >= 0)
+		close(fd);
+	current_map = treasure_map_setup();
+	if (res) {
+		game_seed(1476113042);
+		rec = recording_create(path, current_map, 1476113042);
+		res = rec != NULL;
+	}
+	if (res) {
+		for (int i = 0; i < COUNT; i++) {
+			game_do_action(actions[i]);
+			recording_add(rec, 100 * i, actions[i]);
+			gold[i] = player_gold();
+		}
+		recording_close(rec);
+		played = game_state_checksum(current_map);
+		res = gold[COUNT - 1] > 0;
+	}
+	game_clear_history();
+	map_delete(current_map);
+	current_map = NULL;
+
+	if (res) {
+		/* start from somewhere else entirely: the recording puts it right */
+		player_set_x(4);
+		player_set_y(4);
+		player_set_gold(99);
+		game_seed(1);
+		rec = recording_open(path);
+		res = rec != NULL;
+	}
+	if (res) {
+		current_map = recording_take_map(rec);
+		recording_restore_player(rec);
+		game_seed(recording_seed(rec));
+		/* every pick-up finds the same gold as it did in play */
+		while (res && recording_next(rec, &ev)) {
+			game_do_action(ev.action);
+			res = n < COUNT && ev.ticks == 100u * n && ev.action == actions[n]
+				&& player_gold() == gold[n];
+			n++;
+		}
+		recording_close(rec);
+		res = res && n == COUNT
+			&& game_state_checksum(current_map) == played;
+		game_clear_history();
+		map_delete(current_map);
+		current_map = NULL;
+	}
+	if (fd >= 0)
+		unlink(path);
+	return res;
+}
+
 int main (int argc, char *argv[])
 {
 	int passes = 0;
@@ -106,7 +911,28 @@ int main (int argc, char *argv[])
 		test_coordinates,
 		test_set_get_cycle,
 		test_load_map,
-		test_loaded_map_correct_coordinates
+		test_loaded_map_correct_coordinates,
+		test_snapshot_is_frozen,
+		test_snapshot_restore,
+		test_snapshot_large_map,
+		test_row_copy,
+		test_tiled_map,
+		test_generate_any_thread_count,
+		test_save_and_load,
+		test_world_is_seeded,
+		test_world_keeps_changes,
+		test_world_rows,
+		test_map_diff,
+		test_watch_reload,
+		test_components_match_flood,
+		test_components_follow_changes,
+		test_journal_round_trip,
+		test_journal_compacts,
+		test_journal_resize_while_compacting,
+		test_message_log_ring,
+		test_message_log_echo,
+		test_seed_makes_gold_repeat,
+		test_recording_replays
 	};
 
 	if (argc > 1) {
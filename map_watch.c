@@ -0,0 +1,316 @@
+/*
+ *  Copyright 2016 Kendall E. Blake
+ *
+ *  This file is part of cairo-test.
+ *
+ *  cairo-test is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published
+ *  by the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  cairo-test is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with cairo-test.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#include "map_loader.h"
+#include "map_watch.h"
+
+/* Saves often come as several writes; wait until the file has been quiet
+ * this long before reading it. */
+#define QUIET_MS 50
+
+struct map_watch
+{
+	char           *path, *directory, *name;
+	int             inotify, wake[2];
+	pthread_t       thread;
+
+	/* The rest is shared with the thread. */
+	pthread_mutex_t lock;
+	pthread_cond_t  handed_over;
+	int             stopping;
+	int             wants_snapshot;
+	/*@null@*/ struct map *snapshot;
+	/* what the thread found, waiting for map_watch_update() */
+	int             ready, failed;
+	/*@null@*/ struct map *replacement;
+	/*@null@*/ struct map_change *changes;
+	long            change_count;
+};
+
+long map_diff(struct map *from, struct map *to, struct map_change **changes)
+{
+	int    width = map_width(to), height = map_height(to);
+	char  *old_row, *new_row;
+	long   count = 0, size = 0;
+
+	*changes = NULL;
+	old_row = malloc((size_t)width + 1);
+	new_row = malloc((size_t)width + 1);
+	if (!old_row || !new_row) {
+		free(old_row);
+		free(new_row);
+		return -1;
+	}
+	for (int y = 0; y < height; y++) {
+		map_read_row(from, 0, y, old_row, (size_t)width);
+		map_read_row(to, 0, y, new_row, (size_t)width);
+		if (!memcmp(old_row, new_row, (size_t)width))
+			continue;
+		for (int x = 0; x < width; x++) {
+			if (old_row[x] == new_row[x])
+				continue;
+			if (count == size) {
+				struct map_change *bigger;
+
+				size = size ? size * 2 : 64;
+				bigger = realloc(*changes, (size_t)size * sizeof **changes);
+				if (!bigger) {
+					free(*changes);
+					*changes = NULL;
+					count = -1;
+					goto done;
+				}
+				*changes = bigger;
+			}
+			(*changes)[count].x = x;
+			(*changes)[count].y = y;
+			(*changes)[count].tile = new_row[x];
+			count++;
+		}
+	}
+done:
+	free(old_row);
+	free(new_row);
+	return count;
+}
+
+/* Wait for an event about the map file, then for it to go quiet.  Zero
+ * once the watch is stopping. */
+static int wait_for_edit(struct map_watch *watch)
+{
+	char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	int  edited = 0;
+
+	for (;;) {
+		struct pollfd fds[2] = {
+			{ watch->inotify, POLLIN, 0 },
+			{ watch->wake[0], POLLIN, 0 }
+		};
+		ssize_t length;
+
+		if (poll(fds, 2, edited ? QUIET_MS : -1) < 0)
+			continue;
+		if (fds[1].revents)
+			return 0;
+		if (!fds[0].revents) {
+			if (edited)
+				return 1;
+			continue;
+		}
+		length = read(watch->inotify, buffer, sizeof buffer);
+		for (char *p = buffer; length > 0 && p < buffer + length; ) {
+			struct inotify_event *event = (struct inotify_event *)p;
+
+			if (event->len && !strcmp(event->name, watch->name))
+				edited = 1;
+			p += sizeof *event + event->len;
+		}
+	}
+}
+
+/* Ask the game for a snapshot of its map to compare with. */
+/*@null@*/
+static struct map *take_snapshot(struct map_watch *watch)
+{
+	struct map *snapshot;
+
+	pthread_mutex_lock(&watch->lock);
+	watch->wants_snapshot = 1;
+	while (!watch->snapshot && !watch->stopping)
+		pthread_cond_wait(&watch->handed_over, &watch->lock);
+	snapshot = watch->snapshot;
+	watch->snapshot = NULL;
+	watch->wants_snapshot = 0;
+	pthread_mutex_unlock(&watch->lock);
+	return snapshot;
+}
+
+/* Hand what was found over to map_watch_update(). */
+static void publish(struct map_watch *watch, /*@null@*/ struct map *replacement,
+	/*@null@*/ struct map_change *changes, long count)
+{
+	pthread_mutex_lock(&watch->lock);
+	if (watch->replacement)
+		map_delete(watch->replacement);
+	free(watch->changes);
+	watch->replacement = replacement;
+	watch->changes = changes;
+	watch->change_count = count;
+	watch->ready = 1;
+	pthread_mutex_unlock(&watch->lock);
+}
+
+static void *watch_main(void *argument)
+{
+	struct map_watch *watch = argument;
+
+	while (wait_for_edit(watch)) {
+		struct map        *loaded = load_map_from_path(watch->path), *snapshot;
+		struct map_change *changes = NULL;
+		long               count = -1;
+
+		if (!loaded) {
+			pthread_mutex_lock(&watch->lock);
+			watch->failed = 1;
+			pthread_mutex_unlock(&watch->lock);
+			continue;
+		}
+		snapshot = take_snapshot(watch);
+		if (!snapshot) {
+			map_delete(loaded);
+			break;
+		}
+		if (map_width(snapshot) == map_width(loaded)
+				&& map_height(snapshot) == map_height(loaded))
+			count = map_diff(snapshot, loaded, &changes);
+		map_delete(snapshot);
+		/* A few tiles are written one by one; past that, or if the map
+		 * changed size, the whole of it is swapped in. */
+		if (count >= 0 && count <= MAP_WATCH_MAX_CHANGES) {
+			map_delete(loaded);
+			loaded = NULL;
+		} else {
+			free(changes);
+			changes = NULL;
+			if (count < 0)
+				count = (long)map_width(loaded) * map_height(loaded);
+		}
+		publish(watch, loaded, changes, count);
+	}
+	return NULL;
+}
+
+/*@null@*/
+struct map_watch *map_watch_start(const char *path)
+{
+	struct map_watch *watch = calloc(1, sizeof *watch);
+	char             *slash;
+
+	if (!watch)
+		return NULL;
+	watch->inotify = watch->wake[0] = watch->wake[1] = -1;
+	watch->path = strdup(path);
+	slash = strrchr(path, '/');
+	watch->directory = slash ? strndup(path, (size_t)(slash - path + (slash == path))) : strdup(".");
+	watch->name = strdup(slash ? slash + 1 : path);
+	if (!watch->path || !watch->directory || !watch->name || !watch->name[0])
+		goto fail;
+	/* The directory rather than the file, since a save may replace it. */
+	watch->inotify = inotify_init1(IN_CLOEXEC);
+	if (watch->inotify < 0 || inotify_add_watch(watch->inotify, watch->directory,
+			IN_CLOSE_WRITE | IN_MOVED_TO) < 0)
+		goto fail;
+	if (pipe2(watch->wake, O_CLOEXEC) < 0)
+		goto fail;
+	pthread_mutex_init(&watch->lock, NULL);
+	pthread_cond_init(&watch->handed_over, NULL);
+	if (pthread_create(&watch->thread, NULL, watch_main, watch)) {
+		pthread_cond_destroy(&watch->handed_over);
+		pthread_mutex_destroy(&watch->lock);
+		goto fail;
+	}
+	return watch;
+fail:
+	if (watch->wake[0] >= 0) {
+		close(watch->wake[0]);
+		close(watch->wake[1]);
+	}
+	if (watch->inotify >= 0)
+		close(watch->inotify);
+	free(watch->path);
+	free(watch->directory);
+	free(watch->name);
+	free(watch);
+	return NULL;
+}
+
+void map_watch_stop(/*@null@*/ struct map_watch *watch)
+{
+	if (!watch)
+		return;
+	pthread_mutex_lock(&watch->lock);
+	watch->stopping = 1;
+	pthread_cond_signal(&watch->handed_over);
+	pthread_mutex_unlock(&watch->lock);
+	if (write(watch->wake[1], "", 1) < 0)
+		(void)0;
+	pthread_join(watch->thread, NULL);
+	if (watch->replacement)
+		map_delete(watch->replacement);
+	free(watch->changes);
+	pthread_cond_destroy(&watch->handed_over);
+	pthread_mutex_destroy(&watch->lock);
+	close(watch->wake[0]);
+	close(watch->wake[1]);
+	close(watch->inotify);
+	free(watch->path);
+	free(watch->directory);
+	free(watch->name);
+	free(watch);
+}
+
+long map_watch_update(/*@null@*/ struct map_watch *watch, struct map *map)
+{
+	struct map        *replacement = NULL;
+	struct map_change *changes = NULL;
+	long               count = 0;
+
+	if (!watch)
+		return 0;
+	pthread_mutex_lock(&watch->lock);
+	if (watch->ready) {
+		replacement = watch->replacement;
+		changes = watch->changes;
+		count = watch->change_count;
+		watch->replacement = NULL;
+		watch->changes = NULL;
+		watch->ready = 0;
+	} else if (watch->failed) {
+		count = -1;
+		watch->failed = 0;
+	}
+	pthread_mutex_unlock(&watch->lock);
+
+	if (replacement) {
+		map_restore(map, replacement);
+		map_delete(replacement);
+	} else {
+		for (long i = 0; i < count; i++)
+			map_set_tile(map, changes[i].x, changes[i].y, changes[i].tile);
+	}
+	free(changes);
+
+	/* Only once the last edit is in, so the next is compared with it. */
+	pthread_mutex_lock(&watch->lock);
+	if (watch->wants_snapshot && !watch->snapshot) {
+		watch->snapshot = map_snapshot(map);
+		pthread_cond_signal(&watch->handed_over);
+	}
+	pthread_mutex_unlock(&watch->lock);
+	return count;
+}
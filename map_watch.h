@@ -0,0 +1,60 @@
+#ifndef MAP_WATCH_H
+#define MAP_WATCH_H
+/*
+ *  Copyright 2016 Kendall E. Blake
+ *
+ *  This file is part of cairo-test.
+ *
+ *  cairo-test is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published
+ *  by the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  cairo-test is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with cairo-test.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stddef.h>
+
+#include "map.h"
+
+/* One tile that differs between two maps. */
+struct map_change
+{
+	int  x, y;
+	char tile;
+};
+
+/* Where to differs from from, which must be the same size: the tiles of
+ * to, row by row.  Returns how many there are, with the array (NULL if
+ * there are none) in *changes for the caller to free, or -1 if it could
+ * not be allocated. */
+long map_diff(struct map *from, struct map *to, struct map_change **changes);
+
+/* Past this many changed tiles a reload replaces the whole map at once
+ * rather than writing tile by tile. */
+#define MAP_WATCH_MAX_CHANGES 65536
+
+struct map_watch;
+
+/* Watch the map file at path for edits.  The file is read and compared
+ * with the map on a thread of the watch's own, so that however big it
+ * is, the game never waits on it.  Editors that save by writing a new
+ * file and renaming it over the old are seen too. */
+/*@null@*/
+struct map_watch *map_watch_start(const char *path);
+void map_watch_stop(/*@null@*/ struct map_watch *watch);
+
+/* Bring map up to date with the last edit read, if any: only the tiles
+ * that changed are written, so whatever depends on the rest of the map
+ * stays good.  Call it once a frame from the thread that plays on map; it
+ * never blocks on the file.  Returns how many tiles changed, 0 if nothing
+ * is ready yet, or -1 if the edited file could not be read. */
+long map_watch_update(/*@null@*/ struct map_watch *watch, struct map *map);
+
+#endif
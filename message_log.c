@@ -0,0 +1,153 @@
+/*
+ *  Copyright 2016 Kendall E. Blake
+ *
+ *  This file is part of cairo-test.
+ *
+ *  cairo-test is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published
+ *  by the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  cairo-test is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with cairo-test.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "message_log.h"
+
+static _Thread_local char          lines[MESSAGE_LOG_LINES][MESSAGE_LOG_WIDTH];
+static _Thread_local unsigned long count = 0;
+
+/* Lines waiting for the echo thread, shared by every thread.  echoing is
+ * also read without the lock, so that adding a line takes no lock at all
+ * while nothing is echoed. */
+#define ECHO_LINES 256
+
+static pthread_mutex_t echo_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  echo_wake = PTHREAD_COND_INITIALIZER;
+static pthread_t       echo_thread;
+static atomic_int      echoing = 0;
+static int             echo_stopping = 0;
+static char            echo_lines[ECHO_LINES][MESSAGE_LOG_WIDTH];
+static unsigned long   echo_head = 0, echo_tail = 0, echo_dropped = 0;
+
+static void echo_queue(const char *line)
+{
+	if (!atomic_load(&echoing))
+		return;
+	pthread_mutex_lock(&echo_lock);
+	if (atomic_load(&echoing)) {
+		if (echo_tail - echo_head < ECHO_LINES) {
+			memcpy(echo_lines[echo_tail % ECHO_LINES], line, MESSAGE_LOG_WIDTH);
+			echo_tail++;
+			pthread_cond_signal(&echo_wake);
+		} else {
+			echo_dropped++;
+		}
+	}
+	pthread_mutex_unlock(&echo_lock);
+}
+
+static void *echo_main(void *unused)
+{
+	char          line[MESSAGE_LOG_WIDTH];
+	unsigned long dropped;
+	int           have_line;
+
+	(void)unused;
+	pthread_mutex_lock(&echo_lock);
+	for (;;) {
+		while (echo_head == echo_tail && !echo_dropped && !echo_stopping)
+			pthread_cond_wait(&echo_wake, &echo_lock);
+		if (echo_head == echo_tail && !echo_dropped)
+			break;
+		dropped = echo_dropped;
+		echo_dropped = 0;
+		have_line = echo_head != echo_tail;
+		if (have_line) {
+			memcpy(line, echo_lines[echo_head % ECHO_LINES], MESSAGE_LOG_WIDTH);
+			echo_head++;
+		}
+		pthread_mutex_unlock(&echo_lock);
+		if (dropped)
+			printf("(%lu messages dropped)\n", dropped);
+		if (have_line)
+			puts(line);
+		pthread_mutex_lock(&echo_lock);
+	}
+	pthread_mutex_unlock(&echo_lock);
+	fflush(stdout);
+	return NULL;
+}
+
+void message_log_add(const char *format, ...)
+{
+	char   *line = lines[count % MESSAGE_LOG_LINES];
+	va_list args;
+	size_t  length;
+
+	va_start(args, format);
+	vsnprintf(line, MESSAGE_LOG_WIDTH, format, args);
+	va_end(args);
+	length = strlen(line);
+	if (length && line[length - 1] == '\n')
+		line[length - 1] = '\0';
+	count++;
+	echo_queue(line);
+}
+
+unsigned long message_log_count(void)
+{
+	return count;
+}
+
+/*@null@*/
+const char *message_log_line(unsigned long n)
+{
+	if (n >= count || count - n > MESSAGE_LOG_LINES)
+		return NULL;
+	return lines[n % MESSAGE_LOG_LINES];
+}
+
+void message_log_clear(void)
+{
+	count = 0;
+}
+
+int message_log_echo_start(void)
+{
+	int started = 1;
+
+	pthread_mutex_lock(&echo_lock);
+	if (!atomic_load(&echoing)) {
+		echo_stopping = 0;
+		started = !pthread_create(&echo_thread, NULL, echo_main, NULL);
+		atomic_store(&echoing, started);
+	}
+	pthread_mutex_unlock(&echo_lock);
+	return started;
+}
+
+void message_log_echo_stop(void)
+{
+	pthread_mutex_lock(&echo_lock);
+	if (!atomic_load(&echoing)) {
+		pthread_mutex_unlock(&echo_lock);
+		return;
+	}
+	atomic_store(&echoing, 0);
+	echo_stopping = 1;
+	pthread_cond_signal(&echo_wake);
+	pthread_mutex_unlock(&echo_lock);
+	pthread_join(echo_thread, NULL);
+}
@@ -0,0 +1,43 @@
+#ifndef MESSAGE_LOG_H
+#define MESSAGE_LOG_H
+/*
+ *  Copyright 2016 Kendall E. Blake
+ *
+ *  This file is part of cairo-test.
+ *
+ *  cairo-test is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published
+ *  by the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  cairo-test is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with cairo-test.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* What the game has to tell the player, kept per thread in a fixed ring of
+ * the last MESSAGE_LOG_LINES lines.  Adding a line allocates nothing and
+ * does no I/O, so it is safe on the input path. */
+#define MESSAGE_LOG_LINES 64
+#define MESSAGE_LOG_WIDTH 80    /* longer lines are cut short */
+
+void message_log_add(const char *format, ...)
+	__attribute__((format(printf, 1, 2)));
+/* How many lines this thread has ever added; line n is the (n+1)th. */
+unsigned long message_log_count(void);
+/* Line n, or NULL if it has not been added yet or has been overwritten. */
+/*@null@*/
+const char *message_log_line(unsigned long n);
+void message_log_clear(void);
+
+/* Copy every line added on any thread to stdout, from a thread of its own
+ * so that nothing blocks the caller.  If stdout falls too far behind, lines
+ * are dropped and counted.  Stopping writes out what is still queued. */
+int message_log_echo_start(void);
+void message_log_echo_stop(void);
+
+#endif
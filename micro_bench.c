@@ -0,0 +1,483 @@
+/*
+ *  Copyright 2016 Kendall E. Blake
+ *
+ *  This file is part of cairo-test.
+ *
+ *  cairo-test is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published
+ *  by the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  cairo-test is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with cairo-test.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <cairo.h>
+
+#include "components.h"
+#include "drawing.h"
+#include "generator.h"
+#include "map.h"
+#include "map_loader.h"
+
+/* Time the hot functions under the view one at a time.  Each benchmark
+ * runs its loop in laps: laps are lengthened until one takes LAP_SECONDS,
+ * a few are thrown away to warm up, and then laps are timed until
+ * --seconds (1 by default) have gone by, at least MIN_LAPS and at most
+ * MAX_LAPS of them.  The per-operation times of the laps give the min,
+ * median and p99; output is one tab-separated line per benchmark.  The
+ * big map is 2GB unless --big-map-mb says otherwise (0 skips it). */
+
+#define LAP_SECONDS   0.01
+#define WARMUP_LAPS   3
+#define MIN_LAPS      5
+#define MAX_LAPS      200
+
+struct bench
+{
+	long   i, n;        /* operation within the lap, operations per lap */
+	int    laps, warmup, max_laps;
+	double lap_start, elapsed;
+	double per_op[MAX_LAPS];
+};
+
+typedef void (*bench_fn)(void);
+
+static double bench_seconds = 1.0;
+static long   big_map_mb = 2048;
+static const char *small_map_path = "map";
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void bench_begin(struct bench *b)
+{
+	b->i = 0;
+	b->n = 1;
+	b->laps = 0;
+	b->warmup = -1;     /* still finding the lap length */
+	b->elapsed = 0.0;
+	if (!b->max_laps)
+		b->max_laps = MAX_LAPS;
+	b->lap_start = now();
+}
+
+/* End a lap; nonzero if there is another to run. */
+static int bench_lap(struct bench *b)
+{
+	double lap = now() - b->lap_start;
+
+	if (b->warmup < 0 && lap < LAP_SECONDS) {
+		b->n *= 2;
+	} else if (b->warmup < 0 && !(b->n == 1 && lap > bench_seconds / MIN_LAPS)) {
+		b->warmup = WARMUP_LAPS;
+	} else if (b->warmup > 0) {
+		b->warmup--;
+	} else {
+		/* a single operation this slow is timed from the start */
+		b->warmup = 0;
+		b->per_op[b->laps++] = lap / b->n;
+		b->elapsed += lap;
+		if (b->laps >= b->max_laps
+				|| (b->laps >= MIN_LAPS && b->elapsed >= bench_seconds))
+			return 0;
+	}
+	b->i = 0;
+	b->lap_start = now();
+	return 1;
+}
+
+static inline int bench_next(struct bench *b)
+{
+	return ++b->i < b->n || bench_lap(b);
+}
+
+/* Run the block once per operation; b->i counts operations in the lap. */
+#define BENCH_LOOP(b) for (bench_begin(b); (b)->i < (b)->n; bench_next(b))
+
+static int compare_doubles(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+	return (x > y) - (x < y);
+}
+
+static void bench_report(const char *name, struct bench *b)
+{
+	double total_ops = 0.0;
+
+	if (!b->laps) {
+		printf("%s\t0\t\t\t\t\n", name);
+		return;
+	}
+	for (int lap = 0; lap < b->laps; lap++)
+		total_ops += b->n;
+	qsort(b->per_op, b->laps, sizeof(b->per_op[0]), compare_doubles);
+	printf("%s\t%.0f\t%.1f\t%.1f\t%.1f\t%.2f\n", name, total_ops,
+		b->per_op[0] * 1e9, b->per_op[b->laps / 2] * 1e9,
+		b->per_op[(b->laps * 99 + 99) / 100 - 1] * 1e9,
+		b->elapsed > 0.0 ? total_ops / b->elapsed : 0.0);
+	fflush(stdout);
+}
+
+#define BENCH(name) \
+void inner_##name(struct bench *b); \
+void name (void) { \
+	struct bench b = { 0 }; \
+	inner_##name(&b); \
+	bench_report(#name, &b); \
+} \
+void inner_##name(struct bench *b)
+
+/* Keeps results live so the compiler cannot drop the work. */
+static volatile int sink;
+
+#define MAP_SIDE 256
+
+static struct map *filled_map(int side)
+{
+	struct map *map = map_new(side, side);
+
+	for (int y = 0; y < side; y++)
+	for (int x = 0; x < side; x++)
+		map_set_tile(map, x, y, (x ^ y) & 3 ? '.' : 'X');
+	return map;
+}
+
+BENCH(bench_map_tile)
+{
+	struct map *map = filled_map(MAP_SIDE);
+
+	BENCH_LOOP(b) {
+		sink += map_tile(map, b->i % MAP_SIDE, (b->i / MAP_SIDE) % MAP_SIDE);
+	}
+	map_delete(map);
+}
+
+/* Hops about the map so that each read is likely on a different page. */
+BENCH(bench_map_tile_scattered)
+{
+	struct map *map = filled_map(MAP_SIDE);
+
+	BENCH_LOOP(b) {
+		unsigned long k = (unsigned long)b->i * 2654435761u;
+		sink += map_tile(map, k % MAP_SIDE, (k >> 16) % MAP_SIDE);
+	}
+	map_delete(map);
+}
+
+BENCH(bench_map_set_tile)
+{
+	struct map *map = filled_map(MAP_SIDE);
+
+	BENCH_LOOP(b) {
+		map_set_tile(map, b->i % MAP_SIDE, (b->i / MAP_SIDE) % MAP_SIDE, 'T');
+	}
+	map_delete(map);
+}
+
+/* A map too big for the cache, walked a row at a time and a column at a
+ * time; a tiled map should take the same time either way. */
+#define WALK_SIDE 4096
+
+BENCH(bench_map_walk_rows)
+{
+	struct map *map = filled_map(WALK_SIDE);
+
+	BENCH_LOOP(b) {
+		sink += map_tile(map, b->i % WALK_SIDE, (b->i / WALK_SIDE) % WALK_SIDE);
+	}
+	map_delete(map);
+}
+
+BENCH(bench_map_walk_columns)
+{
+	struct map *map = filled_map(WALK_SIDE);
+
+	BENCH_LOOP(b) {
+		sink += map_tile(map, (b->i / WALK_SIDE) % WALK_SIDE, b->i % WALK_SIDE);
+	}
+	map_delete(map);
+}
+
+/* Writes under a live snapshot, so pages are copied as they are touched. */
+BENCH(bench_map_set_tile_snapshot)
+{
+	struct map *map = filled_map(MAP_SIDE);
+	struct map *snapshot = NULL;
+
+	BENCH_LOOP(b) {
+		if (b->i % (MAP_SIDE * MAP_SIDE) == 0) {
+			map_delete(snapshot);
+			snapshot = map_snapshot(map);
+		}
+		map_set_tile(map, b->i % MAP_SIDE, (b->i / MAP_SIDE) % MAP_SIDE, 'T');
+	}
+	map_delete(snapshot);
+	map_delete(map);
+}
+
+BENCH(bench_load_small_map)
+{
+	BENCH_LOOP(b) {
+		struct map *map = load_map_from_path(small_map_path);
+		if (!map)
+			return;
+		sink += map_width(map);
+		map_delete(map);
+	}
+}
+
+/* Write a square map of about megabytes MB to a temporary file.  If that
+ * fails part way, as it may with the disk full, the file is removed. */
+static int write_big_map(char *path, long megabytes)
+{
+	long  side = 1;
+	char *line;
+	FILE *file;
+	int   fd, ok = 1;
+
+	while ((side + 1) * (side + 2) <= megabytes * 1024 * 1024)
+		side++;
+	fd = mkstemp(path);
+	if (fd < 0)
+		return 0;
+	if (!(file = fdopen(fd, "w"))) {
+		close(fd);
+		unlink(path);
+		return 0;
+	}
+	line = malloc(side + 1);
+	if (!line) {
+		fclose(file);
+		unlink(path);
+		return 0;
+	}
+	for (long y = 0; y < side && ok; y++) {
+		for (long x = 0; x < side; x++)
+			line[x] = x == 0 || y == 0 || x == side - 1 || y == side - 1
+				|| !((x * 7 + y * 13) % 11) ? 'X' : '.';
+		line[side] = '\n';
+		ok = fwrite(line, side + 1, 1, file) == 1;
+	}
+	free(line);
+	if (fclose(file) || !ok) {
+		unlink(path);
+		return 0;
+	}
+	return 1;
+}
+
+BENCH(bench_load_big_map)
+{
+	char path[] = "/tmp/micro_bench_map.XXXXXX";
+
+	if (big_map_mb <= 0 || !write_big_map(path, big_map_mb))
+		return;
+	b->max_laps = 3;
+	BENCH_LOOP(b) {
+		struct map *map = load_map_from_path(path);
+		if (!map)
+			break;
+		sink += map_width(map);
+		map_delete(map);
+	}
+	unlink(path);
+}
+
+/* A generated dungeon, for the reachability index. */
+#define DUNGEON_SIDE 1024
+
+static struct map *dungeon_map(void)
+{
+	struct map *map = map_new(DUNGEON_SIDE, DUNGEON_SIDE);
+
+	if (map)
+		generate_dungeon(map, 1, 0);
+	return map;
+}
+
+BENCH(bench_components_new)
+{
+	struct map *map = dungeon_map();
+
+	BENCH_LOOP(b) {
+		struct components *components = components_new(map, 0);
+
+		sink += (int)components_count(components);
+		components_delete(components);
+	}
+	map_delete(map);
+}
+
+BENCH(bench_components_connected)
+{
+	struct map        *map = dungeon_map();
+	struct components *components = components_new(map, 0);
+
+	BENCH_LOOP(b) {
+		long i = b->i * 7919;
+
+		sink += components_connected(components, i % DUNGEON_SIDE, (i / 3) % DUNGEON_SIDE,
+			(i / 5) % DUNGEON_SIDE, (i / 11) % DUNGEON_SIDE);
+	}
+	components_delete(components);
+	map_delete(map);
+}
+
+/* Wall up an open tile and open it again: a split, or the search that
+ * shows there was none, and then the join. */
+BENCH(bench_components_update)
+{
+	struct map        *map = dungeon_map();
+	struct components *components = components_new(map, 0);
+
+	BENCH_LOOP(b) {
+		long i = b->i * 7919;
+		int  x = (int)(i % DUNGEON_SIDE), y = (int)((i / 13) % DUNGEON_SIDE);
+		char tile = map_tile(map, x, y);
+
+		if (tile == 'X')
+			continue;
+		map_set_tile(map, x, y, 'X');
+		components_update(components, map, x, y);
+		map_set_tile(map, x, y, tile);
+		components_update(components, map, x, y);
+	}
+	components_delete(components);
+	map_delete(map);
+}
+
+BENCH(bench_eye_3_to_2)
+{
+	float x, y;
+
+	BENCH_LOOP(b) {
+		eye_3_to_2((b->i & 15) * 0.625, 10.0, (b->i & 63) * 1.0, &x, &y);
+		sink += (int)x + (int)y;
+	}
+}
+
+/* Each drawing primitive draws a row out into an offscreen surface of the
+ * design size. */
+static cairo_surface_t *surface;
+static cairo_t         *cr;
+
+#define DRAWING_BENCH(name, call) \
+BENCH(name) \
+{ \
+	set_left_bias(0.0); \
+	BENCH_LOOP(b) { \
+		call; \
+	} \
+}
+
+DRAWING_BENCH(bench_wall,            wall(cr, 10.0))
+DRAWING_BENCH(bench_wall_span,       wall_span(cr, 10.0, 30.0))
+DRAWING_BENCH(bench_left_wall,       left_wall(cr, 10.0))
+DRAWING_BENCH(bench_left_wall_span,  left_wall_span(cr, 10.0, 30.0))
+DRAWING_BENCH(bench_right_wall,      right_wall(cr, 10.0))
+DRAWING_BENCH(bench_right_wall_span, right_wall_span(cr, 10.0, 30.0))
+DRAWING_BENCH(bench_left_door,       left_door(cr, 10.0))
+DRAWING_BENCH(bench_right_door,      right_door(cr, 10.0))
+DRAWING_BENCH(bench_door,            door(cr, 10.0))
+DRAWING_BENCH(bench_open_door,       open_door(cr, 0.0))
+DRAWING_BENCH(bench_do_door,         do_door(cr, 10.0))
+DRAWING_BENCH(bench_both_walls,      both_walls(cr, 10.0))
+DRAWING_BENCH(bench_both_doors,      both_doors(cr, 10.0))
+DRAWING_BENCH(bench_chest,           chest(cr, 10.0))
+DRAWING_BENCH(bench_ladder_down,     ladder_down(cr, 10.0))
+DRAWING_BENCH(bench_ladder_up,       ladder_up(cr, 10.0))
+
+static const struct {
+	const char *name;
+	bench_fn    fn;
+} benches[] = {
+	{ "bench_map_tile",              bench_map_tile },
+	{ "bench_map_tile_scattered",    bench_map_tile_scattered },
+	{ "bench_map_walk_rows",         bench_map_walk_rows },
+	{ "bench_map_walk_columns",      bench_map_walk_columns },
+	{ "bench_map_set_tile",          bench_map_set_tile },
+	{ "bench_map_set_tile_snapshot", bench_map_set_tile_snapshot },
+	{ "bench_load_small_map",        bench_load_small_map },
+	{ "bench_load_big_map",          bench_load_big_map },
+	{ "bench_components_new",        bench_components_new },
+	{ "bench_components_connected",  bench_components_connected },
+	{ "bench_components_update",     bench_components_update },
+	{ "bench_eye_3_to_2",            bench_eye_3_to_2 },
+	{ "bench_wall",                  bench_wall },
+	{ "bench_wall_span",             bench_wall_span },
+	{ "bench_left_wall",             bench_left_wall },
+	{ "bench_left_wall_span",        bench_left_wall_span },
+	{ "bench_right_wall",            bench_right_wall },
+	{ "bench_right_wall_span",       bench_right_wall_span },
+	{ "bench_left_door",             bench_left_door },
+	{ "bench_right_door",            bench_right_door },
+	{ "bench_door",                  bench_door },
+	{ "bench_open_door",             bench_open_door },
+	{ "bench_do_door",               bench_do_door },
+	{ "bench_both_walls",            bench_both_walls },
+	{ "bench_both_doors",            bench_both_doors },
+	{ "bench_chest",                 bench_chest },
+	{ "bench_ladder_down",           bench_ladder_down },
+	{ "bench_ladder_up",             bench_ladder_up }
+};
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "usage: %s [--seconds s] [--map file] [--big-map-mb n] [name ...]\n", name);
+	exit(2);
+}
+
+int main (int argc, char *argv[])
+{
+	int first_name = argc;
+
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "--seconds") && i + 1 < argc) {
+			bench_seconds = atof(argv[++i]);
+		} else if (!strcmp(argv[i], "--map") && i + 1 < argc) {
+			small_map_path = argv[++i];
+		} else if (!strcmp(argv[i], "--big-map-mb") && i + 1 < argc) {
+			big_map_mb = atol(argv[++i]);
+		} else if (argv[i][0] != '-') {
+			first_name = i;
+			break;
+		} else {
+			usage(argv[0]);
+		}
+	}
+
+	surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, display_width(), display_height());
+	cr = cairo_create(surface);
+	cairo_set_line_width(cr, DISPLAY_LINE_WIDTH);
+
+	printf("name\toperations\tmin_ns\tmedian_ns\tp99_ns\toperations_per_second\n");
+	for (size_t i = 0; i < sizeof(benches) / sizeof(benches[0]); i++) {
+		int wanted = first_name == argc;
+
+		for (int a = first_name; a < argc && !wanted; a++)
+			wanted = strstr(benches[i].name, argv[a]) != NULL;
+		if (wanted)
+			benches[i].fn();
+	}
+
+	cairo_destroy(cr);
+	cairo_surface_destroy(surface);
+	return 0;
+}
@@ -17,64 +17,101 @@
  *  along with cairo-test.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <stdlib.h>
+
 #include "direction.h"
 #include "player.h"
 
-static int _player_x = 1, _player_y = 1;
-static int _player_facing = DIRECTION_EAST;
-static int gold = 0;
+struct player
+{
+	int x, y;
+	int facing;
+	int gold;
+};
+
+/* The functions below act on whichever player the calling thread last
+ * picked with player_use().  Single player code never has to. */
+static struct player default_player = { 1, 1, DIRECTION_EAST, 0 };
+static _Thread_local struct player *current = &default_player;
+
+/*@null@*/
+struct player *player_new(void)
+{
+	struct player *player = (struct player *)malloc(sizeof(struct player));
+	if (player)
+		*player = default_player;
+	return player;
+}
+
+void player_delete(struct player *player)
+{
+	if (player == current)
+		current = &default_player;
+	if (player != &default_player)
+		free(player);
+}
+
+void player_use(struct player *player)
+{
+	current = player ? player : &default_player;
+}
 
 void player_set_x(int x)
 {
-	_player_x = x;
+	current->x = x;
 }
 
 void player_set_y(int y)
 {
-	_player_y = y;
+	current->y = y;
 }
 
 int player_x()
 {
-	return _player_x;
+	return current->x;
 }
 
 int player_y()
 {
-	return _player_y;
+	return current->y;
 }
 
 int player_facing()
 {
-	return _player_facing;
+	return current->facing;
+}
+
+void player_set_facing(int facing)
+{
+	current->facing = facing;
 }
 
 int player_gold()
 {
-	return gold;
+	return current->gold;
 }
 
 int player_modify_gold(int amount)
 {
-	gold += amount;
-	return gold;
+	current->gold += amount;
+	return current->gold;
 }
 
 int player_set_gold(int amount)
 {
-	return gold = amount;
+	return current->gold = amount;
 }
 
 void player_turn_right(void)
 {
-	_player_facing += 1;
+	current->facing += 1;
 	if (player_facing() > DIRECTION_WEST)
-		_player_facing = DIRECTION_NORTH;
+		current->facing = DIRECTION_NORTH;
 }
 
 void player_turn_left(void)
 {
-	_player_facing -= 1;
+	current->facing -= 1;
 	if (player_facing() < DIRECTION_NORTH)
-		_player_facing = DIRECTION_WEST;
+		current->facing = DIRECTION_WEST;
 }
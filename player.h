@@ -19,10 +19,20 @@
  *  along with cairo-test.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+struct player;
+
+/*@null@*/
+struct player *player_new(void);
+void player_delete(struct player *player);
+/* Make the calling thread's player_* calls act on player.  NULL goes back
+ * to the built-in single player. */
+void player_use(struct player *player);
+
 int player_set_gold(int amount);
 int player_modify_gold(int amount);
 int player_gold();
 int player_facing();
+void player_set_facing(int facing);
 int player_y();
 int player_x();
 void player_set_y(int x);
@@ -0,0 +1,53 @@
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+/*
+ *  Copyright 2016 Kendall E. Blake
+ *
+ *  This file is part of cairo-test.
+ *
+ *  cairo-test is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published
+ *  by the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  cairo-test is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with cairo-test.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+
+/* Messages between dungeon_server and its clients over a local Unix
+ * socket.  Both ends run on the same machine, so everything is sent in
+ * native byte order.
+
+   The client sends a request per action (ACTION_NONE just asks for the
+   current state).  The server answers with the state after the action
+   and, if asked for and the view changed, the pixels of the new frame:
+   height rows of stride bytes of ARGB32. */
+
+#define PROTOCOL_DEFAULT_SOCKET "dungeon.sock"
+
+enum {
+	PROTOCOL_STATE_ONLY = 0,
+	PROTOCOL_WANT_FRAME = 1
+};
+
+struct protocol_request
+{
+	uint8_t action;
+	uint8_t flags;
+};
+
+struct protocol_reply
+{
+	int32_t  x, y, facing, gold;
+	uint32_t changed;
+	uint32_t width, height, stride;  /* all 0 when no frame follows */
+};
+
+#endif
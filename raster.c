@@ -0,0 +1,334 @@
+/*
+ *  Copyright 2016 Kendall E. Blake
+ *
+ *  This file is part of cairo-test.
+ *
+ *  cairo-test is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published
+ *  by the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  cairo-test is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with cairo-test.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include "arena.h"
+#include "display_list.h"
+#include "raster.h"
+
+struct edge
+{
+	double ytop, ybottom;   /* ytop < ybottom */
+	double x, dxdy;         /* x at ytop, and its slope */
+	int    winding;
+};
+
+/* An edge crossing the row being filled, with x at the row's centre. */
+struct active
+{
+	double x, dxdy;
+	double ybottom;
+	int    winding;
+};
+
+/* Where spans go: the pixels and the part of them that may be drawn on. */
+struct target
+{
+	char *pixels;
+	int   pitch;
+	int   x0, y0, x1, y1;
+};
+
+/* Sorted in runs this long before merging. */
+#define SORT_RUN 8
+
+/* The edges of the batch being filled, kept between frames.  Scratch for
+ * a single fill comes from the frame arena. */
+static _Thread_local struct edge   *edges;
+static _Thread_local int            nedges, edges_size;
+
+void raster_release(void)
+{
+	free(edges);
+	edges = NULL;
+	nedges = edges_size = 0;
+}
+
+uint32_t raster_pack_color(const float *rgb)
+{
+	uint32_t pixel = 0xff000000u;
+	for (int i = 0; i < 3; i++) {
+		float c = rgb[i] < 0.0f ? 0.0f : rgb[i] > 1.0f ? 1.0f : rgb[i];
+		pixel |= (uint32_t)(c * 255.0f + 0.5f) << (16 - 8 * i);
+	}
+	return pixel;
+}
+
+void raster_fill_span(uint32_t *row, int x0, int x1, uint32_t color)
+{
+	int x = x0;
+
+#if defined(__AVX2__)
+	__m256i wide = _mm256_set1_epi32((int)color);
+	for (; x + 8 <= x1; x += 8)
+		_mm256_storeu_si256((__m256i *)(row + x), wide);
+#endif
+#if defined(__SSE2__)
+	__m128i quad = _mm_set1_epi32((int)color);
+	for (; x + 4 <= x1; x += 4)
+		_mm_storeu_si128((__m128i *)(row + x), quad);
+#elif defined(__ARM_NEON)
+	uint32x4_t quad = vdupq_n_u32(color);
+	for (; x + 4 <= x1; x += 4)
+		vst1q_u32(row + x, quad);
+#endif
+	for (; x < x1; x++)
+		row[x] = color;
+}
+
+static void add_edge(double x0, double y0, double x1, double y1, int winding)
+{
+	struct edge *e;
+
+	if (y0 == y1)
+		return;
+	if (nedges == edges_size) {
+		int new_size = edges_size ? edges_size * 2 : 1024;
+		struct edge *bigger = (struct edge *)realloc(edges, new_size * sizeof(struct edge));
+		if (!bigger)
+			return;
+		edges = bigger;
+		edges_size = new_size;
+	}
+	e = &edges[nedges++];
+	if (y0 > y1) {
+		double t;
+		t = x0; x0 = x1; x1 = t;
+		t = y0; y0 = y1; y1 = t;
+		winding = -winding;
+	}
+	e->ytop    = y0;
+	e->ybottom = y1;
+	e->x       = x0;
+	e->dxdy    = (x1 - x0) / (y1 - y0);
+	e->winding = winding;
+}
+
+static void add_fill_edges(struct display_list *dl, struct display_command *cmd)
+{
+	struct display_point *p = dl->points + cmd->first;
+	int winding = cmd->reversed ? -1 : 1;
+	int start = 0;
+
+	for (int i = 0; i < cmd->count; i++) {
+		int last = (i + 1 == cmd->count || p[i + 1].move);
+		struct display_point *next = last ? &p[start] : &p[i + 1];
+
+		add_edge(p[i].x, p[i].y, next->x, next->y, winding);
+		if (last)
+			start = i + 1;
+	}
+}
+
+static void add_quad(double ax, double ay, double bx, double by,
+	double cx, double cy, double dx, double dy)
+{
+	add_edge(ax, ay, bx, by, 1);
+	add_edge(bx, by, cx, cy, 1);
+	add_edge(cx, cy, dx, dy, 1);
+	add_edge(dx, dy, ax, ay, 1);
+}
+
+/* A stroke is the union of a rectangle along each segment, plus a square
+ * at each vertex standing in for cairo's joins.  All of them go the same
+ * way round so the winding rule merges rather than cancels them. */
+static void add_stroke_edges(struct display_list *dl, struct display_command *cmd)
+{
+	struct display_point *p = dl->points + cmd->first;
+	const double hw = dl->line_width / 2.0;
+
+	for (int i = 0; i + 1 < cmd->count; i++) {
+		double dx = p[i + 1].x - p[i].x, dy = p[i + 1].y - p[i].y;
+		double len = sqrt(dx * dx + dy * dy), nx, ny;
+
+		if (p[i + 1].move || len == 0.0)
+			continue;
+		nx = -dy / len * hw;
+		ny =  dx / len * hw;
+		add_quad(p[i].x + nx, p[i].y + ny, p[i + 1].x + nx, p[i + 1].y + ny,
+			p[i + 1].x - nx, p[i + 1].y - ny, p[i].x - nx, p[i].y - ny);
+
+		if (i + 2 < cmd->count && !p[i + 2].move) {
+			double x = p[i + 1].x, y = p[i + 1].y;
+			add_quad(x - hw, y + hw, x + hw, y + hw, x + hw, y - hw, x - hw, y - hw);
+		}
+	}
+}
+
+/* Sort the edges down the screen, keeping ties in the order they came.
+ * qsort() may take a buffer from the heap on every call; this takes its
+ * buffer from the arena.  Zero if there was no room. */
+static int sort_edges(struct arena *arena)
+{
+	struct edge *from = edges, *to, *swap;
+
+	to = (struct edge *)arena_alloc(arena, (size_t)nedges * sizeof(struct edge));
+	if (!to)
+		return 0;
+	for (int lo = 0; lo < nedges; lo += SORT_RUN)
+	for (int i = lo + 1; i < lo + SORT_RUN && i < nedges; i++) {
+		struct edge e = edges[i];
+		int j = i;
+
+		for (; j > lo && edges[j - 1].ytop > e.ytop; j--)
+			edges[j] = edges[j - 1];
+		edges[j] = e;
+	}
+	for (int width = SORT_RUN; width < nedges; width *= 2) {
+		for (int lo = 0; lo < nedges; lo += 2 * width) {
+			int mid = lo + width < nedges ? lo + width : nedges;
+			int hi  = lo + 2 * width < nedges ? lo + 2 * width : nedges;
+			int i = lo, j = mid, k = lo;
+
+			while (i < mid && j < hi)
+				to[k++] = from[j].ytop < from[i].ytop ? from[j++] : from[i++];
+			while (i < mid)
+				to[k++] = from[i++];
+			while (j < hi)
+				to[k++] = from[j++];
+		}
+		swap = from;
+		from = to;
+		to   = swap;
+	}
+	if (from != edges)
+		memcpy(edges, from, (size_t)nedges * sizeof(struct edge));
+	return 1;
+}
+
+/* Scan convert the collected edges with the winding rule.  Edges join the
+ * active table as the rows reach them and leave it once past their end;
+ * in between each steps along by its slope, so the table stays nearly in
+ * order from row to row and sorting it again is cheap. */
+static void fill_edges(uint32_t color, const struct target *target)
+{
+	struct arena      *arena = frame_arena();
+	struct arena_mark  mark = arena_mark(arena);
+	struct active     *actives;
+	int next = 0, nactive = 0, y, ylast;
+	double ymax = -INFINITY;
+
+	if (!nedges)
+		return;
+	actives = (struct active *)arena_alloc(arena, (size_t)nedges * sizeof(struct active));
+	if (!actives || !sort_edges(arena)) {
+		arena_rewind(arena, mark);
+		return;
+	}
+	for (int i = 0; i < nedges; i++)
+		if (edges[i].ybottom > ymax) ymax = edges[i].ybottom;
+
+	/* rows whose centre lies inside [ytop, ybottom) */
+	y = (int)ceil(edges[0].ytop - 0.5);
+	ylast = (int)ceil(ymax - 0.5) - 1;
+	if (y < target->y0) y = target->y0;
+	if (ylast > target->y1 - 1) ylast = target->y1 - 1;
+
+	for (; y <= ylast; y++)
+	{
+		double yc = y + 0.5;
+		uint32_t *row = (uint32_t *)(target->pixels + (size_t)y * target->pitch);
+		int winding = 0, kept = 0;
+
+		/* drop the edges that ended above this row */
+		for (int i = 0; i < nactive; i++) {
+			if (actives[i].ybottom > yc)
+				actives[kept++] = actives[i];
+		}
+		nactive = kept;
+		/* take on those that start by it */
+		for (; next < nedges && edges[next].ytop <= yc; next++) {
+			struct edge *e = &edges[next];
+			if (e->ybottom <= yc)
+				continue;
+			actives[nactive].x       = e->x + (yc - e->ytop) * e->dxdy;
+			actives[nactive].dxdy    = e->dxdy;
+			actives[nactive].ybottom = e->ybottom;
+			actives[nactive].winding = e->winding;
+			nactive++;
+		}
+		if (!nactive) {
+			if (next == nedges)
+				break;
+			continue;
+		}
+		/* only edges that crossed since the last row are out of place */
+		for (int i = 1; i < nactive; i++) {
+			struct active a = actives[i];
+			int j = i;
+
+			for (; j > 0 && actives[j - 1].x > a.x; j--)
+				actives[j] = actives[j - 1];
+			actives[j] = a;
+		}
+
+		for (int i = 0; i + 1 < nactive; i++) {
+			winding += actives[i].winding;
+			if (winding) {
+				int x0 = (int)ceil(actives[i].x - 0.5);
+				int x1 = (int)ceil(actives[i + 1].x - 0.5);
+				if (x0 < target->x0) x0 = target->x0;
+				if (x1 > target->x1) x1 = target->x1;
+				if (x0 < x1)
+					raster_fill_span(row, x0, x1, color);
+			}
+		}
+		for (int i = 0; i < nactive; i++)
+			actives[i].x += actives[i].dxdy;
+	}
+	arena_rewind(arena, mark);
+}
+
+void raster_submit(struct display_list *dl, void *pixels, int width, int height, int pitch)
+{
+	raster_submit_clipped(dl, pixels, pitch, 0, 0, width, height);
+}
+
+void raster_submit_clipped(struct display_list *dl, void *pixels, int pitch,
+	int x0, int y0, int x1, int y1)
+{
+	struct target target = { (char *)pixels, pitch, x0, y0, x1, y1 };
+
+	display_list_optimize(dl);
+	dl->batches_drawn  = dl->nbatches;
+	dl->source_changes = 0;
+
+	for (int b = 0; b < dl->nbatches; b++)
+	{
+		struct display_batch *batch = &dl->batches[b];
+
+		nedges = 0;
+		for (int c = batch->head; c != -1; c = dl->commands[c].next) {
+			if (batch->op == DISPLAY_FILL)
+				add_fill_edges(dl, &dl->commands[c]);
+			else
+				add_stroke_edges(dl, &dl->commands[c]);
+		}
+		fill_edges(raster_pack_color(batch->color), &target);
+	}
+}
@@ -0,0 +1,42 @@
+#ifndef RASTER_H
+#define RASTER_H
+/*
+ *  Copyright 2016 Kendall E. Blake
+ *
+ *  This file is part of cairo-test.
+ *
+ *  cairo-test is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published
+ *  by the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  cairo-test is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with cairo-test.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+
+#include "display_list.h"
+
+/* A software stand-in for cairo, good for exactly what the dungeon draws:
+ * flat coloured polygons and thin lines.  Each batch of a display list is
+ * scan converted once, sampling at pixel centres with the winding rule,
+ * and its spans are written straight into ARGB8888 pixels with vector
+ * stores.  There is no antialiasing. */
+
+uint32_t raster_pack_color(const float *rgb);
+void raster_fill_span(uint32_t *row, int x0, int x1, uint32_t color);
+/* Draw everything recorded in dl (optimizing it first) onto pixels. */
+void raster_submit(struct display_list *dl, void *pixels, int width, int height, int pitch);
+/* The same, drawing only inside [x0, x1) x [y0, y1). */
+void raster_submit_clipped(struct display_list *dl, void *pixels, int pitch,
+	int x0, int y0, int x1, int y1);
+/* Free the calling thread's scratch buffers. */
+void raster_release(void);
+
+#endif
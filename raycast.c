@@ -0,0 +1,278 @@
+/*
+ *  Copyright 2016 Kendall E. Blake
+ *
+ *  This file is part of cairo-test.
+ *
+ *  cairo-test is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published
+ *  by the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  cairo-test is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with cairo-test.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <math.h>
+
+#include "direction.h"
+#include "display_list.h"
+#include "drawing.h"
+#include "raster.h"
+#include "raycast.h"
+
+static const int forward[4][2] = { { 0, -1 }, { 1, 0 }, { 0, 1 }, { -1, 0 } };
+static const int right[4][2]   = { { 1, 0 }, { 0, 1 }, { -1, 0 }, { 0, -1 } };
+
+/* What a ray finds as it crosses into a cell. */
+enum { PASS, WALL, DOOR, OPEN_DOOR };
+
+/* The column of pixels a ray paints; rows above top are already done. */
+struct column
+{
+	uint32_t *pixels;
+	int       pitch, height, top, line;
+};
+
+/* The face a ray stopped at, so that the next column can tell whether it
+ * has crossed an edge that wants outlining. */
+struct face
+{
+	int steps, lateral, side, door;
+};
+
+static char tile_at(struct raycast_view *view, int steps, int lateral)
+{
+	int x = view->x + forward[view->facing][0] * steps + right[view->facing][0] * lateral;
+	int y = view->y + forward[view->facing][1] * steps + right[view->facing][1] * lateral;
+
+	return map_contains(view->map, x, y) ? map_tile(view->map, x, y) : '\0';
+}
+
+static int is_door(char tile)
+{
+	return tile == '|' || tile == '-';
+}
+
+/* Are a door cell's doors in the faces seen side on from here, rather
+ * than in those that face the eye? */
+static int doors_in_sides(struct raycast_view *view, char tile)
+{
+	int vertical = view->facing == DIRECTION_NORTH || view->facing == DIRECTION_SOUTH;
+
+	return (tile == '|') == vertical;
+}
+
+/* Faces in a line, along a row or down a corridor, are one wall to the
+ * painter and get no outline between them. */
+static int new_plane(const struct face *face, const struct face *last)
+{
+	if (face->side != last->side)
+		return 1;
+	return face->side ? face->lateral != last->lateral : face->steps != last->steps;
+}
+
+/* Is a point along feet across a wall where its door would be? */
+static int in_door(float along)
+{
+	return along >= (10.0f - DOOR_WIDTH) / 2.0f && along < (10.0f + DOOR_WIDTH) / 2.0f;
+}
+
+/* The picture row, at or below the pixel centre, that a point feet up a
+ * face comes out on at scale. */
+static int screen_row(const struct column *column, float feet, float scale)
+{
+	return (int)floorf((5.0f - (feet - 5.0f) * scale) * column->height / 10.0f + 0.5f);
+}
+
+static void fill_rows(struct column *column, int y0, int y1, uint32_t color)
+{
+	uint32_t *pixel;
+
+	if (y0 < column->top)
+		y0 = column->top;
+	if (y1 > column->height)
+		y1 = column->height;
+	pixel = column->pixels + (size_t)y0 * column->pitch;
+	for (int y = y0; y < y1; y++, pixel += column->pitch)
+		*pixel = color;
+}
+
+/* Remember a cell with something in it for the caller to draw. */
+static void note_cell(struct raycast_view *view, int steps, int lateral, char tile, int x)
+{
+	struct raycast_cell *cell;
+
+	if (tile != 'T' && tile != 'D' && tile != 'U')
+		return;
+	for (int i = view->cell_count - 1; i >= 0; i--) {
+		cell = &view->cells[i];
+		if (cell->steps == steps && cell->lateral == lateral) {
+			if (x < cell->x0)
+				cell->x0 = x;
+			if (x >= cell->x1)
+				cell->x1 = x + 1;
+			return;
+		}
+	}
+	if (view->cell_count == RAYCAST_CELLS)
+		return;
+	cell = &view->cells[view->cell_count++];
+	cell->steps   = steps;
+	cell->lateral = lateral;
+	cell->tile    = tile;
+	cell->x0      = x;
+	cell->x1      = x + 1;
+}
+
+/* Paint the face of kind a ray met z feet out, along feet across it,
+ * belonging to the cell steps rows out.  Faces side on to the eye are
+ * light on the right and dark on the left, as the painter has them; the
+ * face of an open door is dark.  edge says the last column showed a
+ * different face, and door_edge the other side of a door's frame, for
+ * the outlines.  Returns nonzero if the ray goes on, through an open door. */
+static int paint_face(struct raycast_view *view, struct column *column, int kind,
+	int steps, float z, float along, int light, int edge, int door_edge)
+{
+	float    scale = exp2f(-(z - view->depth) / 10.0f);
+	int      top = screen_row(column, 10.0f, scale), bottom = screen_row(column, 0.0f, scale);
+	int      lintel = screen_row(column, DOOR_HEIGHT, scale);
+	int      door_part = in_door(along);
+	int      outlined = drawing_outlined(10.0f, steps * 10.0f);
+	int      line = column->line;
+	uint32_t fill, outline;
+
+	drawing_set_depth(steps - view->fog_shift);
+	if (kind == OPEN_DOOR)
+		light = 0;
+	fill    = raster_pack_color(drawing_ink(light ? INK_WALL_LIGHT : INK_WALL_DARK));
+	outline = raster_pack_color(drawing_ink(light ? INK_WALL_DARK : INK_WALL_LIGHT));
+
+	if (kind == OPEN_DOOR && door_part) {
+		fill_rows(column, top, lintel, fill);
+		fill_rows(column, top, top + line, outline);
+		fill_rows(column, lintel - line, lintel, outline);
+		if (column->top < lintel)
+			column->top = lintel;
+		return 1;
+	}
+	if (edge && outlined) {
+		fill_rows(column, top, bottom, outline);
+	} else {
+		fill_rows(column, top, bottom, fill);
+		if (outlined) {
+			fill_rows(column, top, top + line, outline);
+			fill_rows(column, bottom - line, bottom, outline);
+		}
+	}
+	if (kind == DOOR && door_part) {
+		uint32_t door = raster_pack_color(drawing_ink(INK_DOOR_FILL));
+		uint32_t frame = raster_pack_color(drawing_ink(INK_DOOR_OUTLINE));
+		int      framed = drawing_outlined(DOOR_HEIGHT, steps * 10.0f);
+
+		fill_rows(column, lintel, bottom, framed && (edge || door_edge) ? frame : door);
+		if (framed)
+			fill_rows(column, lintel, lintel + line, frame);
+	}
+	return 0;
+}
+
+/* Follow the ray through column x of the picture.  At depth z the eye's
+ * projection puts it at 5 + a * 2^((z - depth) / 10) feet across the
+ * cells of the view, with the eye's own cell from 0 to 10, so the ray
+ * curves out from the middle; it meets the edges of the cells in the
+ * order the DDA steps through them, each crossing worked out exactly. */
+static void cast(struct raycast_view *view, int x, struct face *last)
+{
+	struct column column = { view->pixels + x, view->pitch / 4, view->height, 0, 1 };
+	struct face   face = { 0, 0, -1, 0 };
+	float a = (x + 0.5f) * 10.0f / view->width - 5.0f - view->pan;
+	float z = view->depth;
+	int   steps = (int)floorf(z / 10.0f), lateral = (int)floorf((5.0f + a) / 10.0f);
+	int   direction = a > 0.0f ? 1 : -1, kind = PASS, side = 0;
+	char  tile = tile_at(view, steps, lateral);
+	/* in a door cell, only the way through it is open */
+	int   inside = is_door(tile);
+
+	column.line = (int)(DISPLAY_LINE_WIDTH * display_scale() + 0.5f);
+	if (column.line < 1)
+		column.line = 1;
+	/* standing in a door cell, its near face is round the eye: a wall if
+	 * its doors are to the sides, or else the doorway being stood in */
+	if (inside) {
+		z = 10.0f * steps;
+		kind = doors_in_sides(view, tile) ? WALL : OPEN_DOOR;
+		if (!paint_face(view, &column, kind, steps, z,
+				5.0f + a * exp2f((z - view->depth) / 10.0f) - 10.0f * lateral, 1, 0, 0)) {
+			last->side = -1;
+			return;
+		}
+	}
+	while (steps < view->rows) {
+		float z_row = 10.0f * (steps + 1), z_side = INFINITY, across, along;
+
+		note_cell(view, steps, lateral, tile, x);
+		if (a != 0.0f)
+			z_side = view->depth
+				+ 10.0f * log2f((10.0f * (lateral + (a > 0.0f)) - 5.0f) / a);
+		side = z_side < z_row;
+		if (inside && (side || doors_in_sides(view, tile))) {
+			/* the sides of a door cell, or its far wall */
+			z = side ? z_side : z_row;
+			kind = side && doors_in_sides(view, tile) ? DOOR : WALL;
+		} else {
+			if (side) {
+				z = z_side;
+				lateral += direction;
+				if (lateral > steps + 1 || lateral < -(steps + 1))
+					break;      /* out of the cone the painter draws */
+			} else {
+				z = z_row;
+				if (++steps >= view->rows)
+					break;
+			}
+			tile = tile_at(view, steps, lateral);
+			inside = 0;
+			if (tile == 'X')
+				kind = WALL;
+			else if (!is_door(tile))
+				kind = PASS;
+			else if (side != doors_in_sides(view, tile))
+				kind = WALL;
+			else if (!side && z - view->depth < 10.0f)
+				kind = OPEN_DOOR;   /* as do_door() has it */
+			else
+				kind = DOOR;
+			if (kind == PASS)
+				continue;
+		}
+		across = 5.0f + a * exp2f((z - view->depth) / 10.0f) - 10.0f * lateral;
+		along  = side ? z - 10.0f * steps : across;
+		face.steps   = steps;
+		face.lateral = lateral;
+		face.side    = side;
+		face.door    = kind == DOOR && in_door(along);
+		if (paint_face(view, &column, kind, steps, z, along, side ? a > 0.0f : 1,
+				new_plane(&face, last),
+				face.door != last->door)) {
+			inside = 1;
+			continue;
+		}
+		*last = face;
+		return;
+	}
+	last->side = -1;
+}
+
+void raycast_paint(struct raycast_view *view, int x0, int x1)
+{
+	struct face last = { 0, 0, -1, 0 };
+
+	view->cell_count = 0;
+	for (int x = x0; x < x1; x++)
+		cast(view, x, &last);
+}
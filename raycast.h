@@ -0,0 +1,62 @@
+#ifndef RAYCAST_H
+#define RAYCAST_H
+/*
+ *  Copyright 2016 Kendall E. Blake
+ *
+ *  This file is part of cairo-test.
+ *
+ *  cairo-test is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published
+ *  by the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  cairo-test is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with cairo-test.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+
+#include "map.h"
+
+/* The other way to paint the view: one ray per column of the picture,
+ * stepped through the map a cell at a time until it meets a wall or a
+ * door, which is then written into the pixels as a single vertical span.
+ * The rays follow the same projection as eye_3_to_2(), so walls land
+ * where the painter would put them, and the work grows with the width of
+ * the picture rather than with the number of cells in the view cone. */
+
+/* A cell the rays passed through with something standing in it, which
+ * is left for the caller to draw, and the columns [x0, x1) it was seen
+ * in. */
+struct raycast_cell
+{
+	int  steps, lateral, x0, x1;
+	char tile;
+};
+
+#define RAYCAST_CELLS 256
+
+struct raycast_view
+{
+	/* what to paint into */
+	uint32_t   *pixels;
+	int         pitch, width, height;
+	/* and from where: rows deep, with the eye depth feet forward and the
+	 * picture panned pan tenths across, as for drawing_set_eye() */
+	struct map *map;
+	int         x, y, facing, rows, fog_shift;
+	float       depth, pan;
+	/* filled in by raycast_paint() */
+	int         cell_count;
+	struct raycast_cell cells[RAYCAST_CELLS];
+};
+
+/* Paint columns [x0, x1) of the view, leaving what the rays miss alone. */
+void raycast_paint(struct raycast_view *view, int x0, int x1);
+
+#endif
@@ -0,0 +1,190 @@
+/*
+ *  Copyright 2016 Kendall E. Blake
+ *
+ *  This file is part of cairo-test.
+ *
+ *  cairo-test is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published
+ *  by the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  cairo-test is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with cairo-test.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "game.h"
+#include "map.h"
+#include "player.h"
+#include "recording.h"
+
+#define RECORDING_MAGIC "dungeon-recording"
+#define RECORDING_VERSION 1
+
+struct recording
+{
+	FILE        *file;
+	unsigned int seed;
+	int          x, y, facing, gold;
+	struct map  *map;
+};
+
+/*@null@*/
+struct recording *recording_create(const char *path, struct map *map, unsigned int seed)
+{
+	struct recording *rec = (struct recording *)calloc(1, sizeof(struct recording));
+	if (!rec)
+		return NULL;
+
+	rec->file = fopen(path, "w");
+	if (!rec->file) {
+		free(rec);
+		return NULL;
+	}
+	rec->seed = seed;
+
+	fprintf(rec->file, "%s %i\n", RECORDING_MAGIC, RECORDING_VERSION);
+	fprintf(rec->file, "seed %u\n", seed);
+	fprintf(rec->file, "player %i %i %i %i\n",
+		player_x(), player_y(), player_facing(), player_gold());
+	fprintf(rec->file, "map %i %i\n", map_width(map), map_height(map));
+	for (int y = 0; y < map_height(map); y++)
+	{
+		for (int x = 0; x < map_width(map); x++)
+			fputc(map_tile(map, x, y), rec->file);
+		fputc('\n', rec->file);
+	}
+	return rec;
+}
+
+void recording_add(struct recording *rec, uint32_t ticks, int action)
+{
+	if (rec && action_name(action))
+		fprintf(rec->file, "%u %s\n", (unsigned int)ticks, action_name(action));
+}
+
+void recording_close(struct recording *rec)
+{
+	if (rec) {
+		if (rec->file) fclose(rec->file);
+		map_delete(rec->map);
+		free(rec);
+	}
+}
+
+/*@null@*/
+struct recording *recording_open(const char *path)
+{
+	struct recording *rec = (struct recording *)calloc(1, sizeof(struct recording));
+	int version, width, height;
+	char magic[32];
+
+	if (!rec)
+		return NULL;
+	rec->file = fopen(path, "r");
+	if (!rec->file)
+		goto fail;
+
+	if (fscanf(rec->file, "%31s %i", magic, &version) != 2
+		|| strcmp(magic, RECORDING_MAGIC) || version != RECORDING_VERSION)
+		goto fail;
+	if (fscanf(rec->file, " seed %u", &rec->seed) != 1)
+		goto fail;
+	if (fscanf(rec->file, " player %i %i %i %i",
+			&rec->x, &rec->y, &rec->facing, &rec->gold) != 4)
+		goto fail;
+	if (fscanf(rec->file, " map %i %i ", &width, &height) != 2
+		|| width <= 0 || height <= 0)
+		goto fail;
+
+	rec->map = map_new(width, height);
+	if (!rec->map)
+		goto fail;
+	for (int y = 0; y < height; y++)
+	{
+		for (int x = 0; x < width; x++)
+		{
+			int c = fgetc(rec->file);
+			if (c == EOF || c == '\n')
+				goto fail;
+			map_set_tile(rec->map, x, y, (char)c);
+		}
+		if (fgetc(rec->file) != '\n')
+			goto fail;
+	}
+	return rec;
+
+	fail:
+	recording_close(rec);
+	return NULL;
+}
+
+unsigned int recording_seed(struct recording *rec)
+{
+	return rec->seed;
+}
+
+struct map *recording_take_map(struct recording *rec)
+{
+	struct map *map = rec->map;
+	rec->map = NULL;
+	return map;
+}
+
+void recording_restore_player(struct recording *rec)
+{
+	player_set_x(rec->x);
+	player_set_y(rec->y);
+	player_set_facing(rec->facing);
+	player_set_gold(rec->gold);
+}
+
+int recording_next(struct recording *rec, struct recording_event *event)
+{
+	unsigned int ticks;
+	char name[32];
+
+	while (fscanf(rec->file, " %u %31s", &ticks, name) == 2) {
+		int action = action_from_name(name);
+		if (action != ACTION_NONE) {
+			event->ticks  = ticks;
+			event->action = action;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/* FNV-1a over the tiles and the player, so two runs that end in the same
+ * state can be told apart from ones that don't. */
+static uint64_t fnv1a(uint64_t hash, const void *data, size_t len)
+{
+	const unsigned char *p = (const unsigned char *)data;
+	while (len--) {
+		hash ^= *p++;
+		hash *= 0x100000001b3ULL;
+	}
+	return hash;
+}
+
+uint64_t game_state_checksum(struct map *map)
+{
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	int player[4] = { player_x(), player_y(), player_facing(), player_gold() };
+
+	for (int y = 0; y < map_height(map); y++)
+	for (int x = 0; x < map_width(map); x++)
+	{
+		char tile = map_tile(map, x, y);
+		hash = fnv1a(hash, &tile, 1);
+	}
+	return fnv1a(hash, player, sizeof(player));
+}
@@ -0,0 +1,66 @@
+#ifndef RECORDING_H
+#define RECORDING_H
+/*
+ *  Copyright 2016 Kendall E. Blake
+ *
+ *  This file is part of cairo-test.
+ *
+ *  cairo-test is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published
+ *  by the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  cairo-test is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with cairo-test.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+
+#include "map.h"
+
+/* A recording is a text file holding everything needed to re-run a session:
+
+	dungeon-recording 1
+	seed 1476113042
+	player 1 1 1 0
+	map 20 17
+	XXXXXXXXXXXXXXXXXXXX
+	...
+	1043 forward
+	1290 right
+
+   The player line is x, y, facing and gold at the start of the session.
+   Each event line is the tick (milliseconds since the session started) at
+   which the action was handled, followed by the action name. */
+
+struct recording;
+
+struct recording_event
+{
+	uint32_t ticks;
+	int      action;
+};
+
+/*@null@*/
+struct recording *recording_create(const char *path, struct map *map, unsigned int seed);
+void recording_add(struct recording *rec, uint32_t ticks, int action);
+void recording_close(struct recording *rec);
+
+/*@null@*/
+struct recording *recording_open(const char *path);
+unsigned int recording_seed(struct recording *rec);
+/* The map the session started on.  Ownership passes to the caller. */
+struct map *recording_take_map(struct recording *rec);
+/* Restore the player to where the session started. */
+void recording_restore_player(struct recording *rec);
+/* Returns 0 at end of recording. */
+int recording_next(struct recording *rec, struct recording_event *event);
+
+uint64_t game_state_checksum(struct map *map);
+
+#endif
@@ -0,0 +1,825 @@
+/*
+ *  Copyright 2016 Kendall E. Blake
+ *
+ *  This file is part of cairo-test.
+ *
+ *  cairo-test is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published
+ *  by the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  cairo-test is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with cairo-test.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <cairo.h>
+
+#include "alloc_debug.h"
+#include "atlas.h"
+#include "capture.h"
+#include "direction.h"
+#include "display_list.h"
+#include "drawing.h"
+#include "map.h"
+#include "map_loader.h"
+#include "player.h"
+#include "raster.h"
+#include "triple_buffer.h"
+#include "view.h"
+#include "view_thread.h"
+
+/* A pixel is off if a channel is out by more than this; anything less is
+ * cairo's antialiasing along an edge the software rasterizer leaves hard. */
+#define CHANNEL_TOLERANCE 128
+/* and at most this fraction of a frame may be off. */
+#define FRAME_TOLERANCE 0.01
+/* The raycaster finds edges a pixel or so from where the painter's
+ * polygons put them, and centres the chest the painter leaves off to one
+ * side, so it gets more slack. */
+#define RAYCAST_TOLERANCE 0.03
+
+#define SIZE 32
+#define WHITE 0xffffffffu
+
+typedef int (*test_fn)(void);
+
+#define TEST(name) \
+int inner_##name(void); \
+int name (void) { \
+	int res; \
+	printf ("In %s . . . ", #name); \
+	res = inner_##name(); \
+	printf("%s\n", (res)?"Passed":"Failed"); \
+	return res; \
+} \
+int inner_##name(void)
+
+static uint32_t pixels[SIZE * SIZE];
+
+/* Rasterize dl into a cleared SIZE x SIZE buffer. */
+static void raster_small(struct display_list *dl)
+{
+	memset(pixels, 0, sizeof(pixels));
+	raster_submit(dl, pixels, SIZE, SIZE, SIZE * sizeof(uint32_t));
+}
+
+/* Is exactly the rectangle [x0, x1) x [y0, y1) white? */
+static int only_rectangle(int x0, int y0, int x1, int y1)
+{
+	for (int y = 0; y < SIZE; y++)
+	for (int x = 0; x < SIZE; x++)
+	{
+		int inside = x >= x0 && x < x1 && y >= y0 && y < y1;
+		if ((pixels[y * SIZE + x] == WHITE) != inside)
+			return 0;
+	}
+	return 1;
+}
+
+static void rectangle_path(struct display_list *dl, double x0, double y0, double x1, double y1, int clockwise)
+{
+	display_list_move_to(dl, x0, y0);
+	if (clockwise) {
+		display_list_line_to(dl, x1, y0);
+		display_list_line_to(dl, x1, y1);
+		display_list_line_to(dl, x0, y1);
+	} else {
+		display_list_line_to(dl, x0, y1);
+		display_list_line_to(dl, x1, y1);
+		display_list_line_to(dl, x1, y0);
+	}
+}
+
+static void rectangle(struct display_list *dl, double x0, double y0, double x1, double y1, int clockwise)
+{
+	rectangle_path(dl, x0, y0, x1, y1, clockwise);
+	display_list_fill(dl);
+}
+
+TEST(test_span_fill)
+{
+	uint32_t row[40] = { 0 };
+	int res = 1;
+
+	raster_fill_span(row, 3, 30, 7);
+	for (int x = 0; x < 40; x++)
+		res = res && row[x] == (x >= 3 && x < 30 ? 7u : 0u);
+	return res;
+}
+
+TEST(test_pack_color)
+{
+	float red[3] = { 1.0f, 0.0f, 0.0f }, grey[3] = { 0.5f, 0.5f, 0.5f };
+	return raster_pack_color(red) == 0xffff0000u && raster_pack_color(grey) == 0xff808080u;
+}
+
+TEST(test_fill_rectangle)
+{
+	struct display_list dl;
+	int res;
+
+	display_list_init(&dl);
+	display_list_set_color(&dl, 1.0f, 1.0f, 1.0f);
+	rectangle(&dl, 4.0, 6.0, 20.0, 9.5, 1);
+	raster_small(&dl);
+	/* pixel centres inside the edges: rows 6-8, columns 4-19 */
+	res = only_rectangle(4, 6, 20, 9);
+	display_list_release(&dl);
+	return res;
+}
+
+TEST(test_fill_winding)
+{
+	struct display_list dl;
+	int res;
+
+	/* overlapping, wound opposite ways, merged into one batch */
+	display_list_init(&dl);
+	display_list_set_color(&dl, 1.0f, 1.0f, 1.0f);
+	rectangle(&dl, 2.0, 2.0, 20.0, 20.0, 1);
+	rectangle(&dl, 10.0, 2.0, 28.0, 20.0, 0);
+	raster_small(&dl);
+	res = dl.nbatches == 1 && only_rectangle(2, 2, 28, 20);
+	display_list_release(&dl);
+	return res;
+}
+
+TEST(test_fill_winding_not_convex)
+{
+	struct display_list dl;
+	int res;
+
+	/* an L wound the other way from the rectangle filling its corner */
+	display_list_init(&dl);
+	display_list_set_color(&dl, 1.0f, 1.0f, 1.0f);
+	display_list_move_to(&dl, 2.0, 2.0);
+	display_list_line_to(&dl, 2.0, 20.0);
+	display_list_line_to(&dl, 28.0, 20.0);
+	display_list_line_to(&dl, 28.0, 10.0);
+	display_list_line_to(&dl, 20.0, 10.0);
+	display_list_line_to(&dl, 20.0, 2.0);
+	display_list_fill(&dl);
+	rectangle(&dl, 10.0, 2.0, 28.0, 20.0, 1);
+	raster_small(&dl);
+	res = dl.nbatches == 1 && only_rectangle(2, 2, 28, 20);
+
+	/* two subpaths can't be turned round, so they keep a batch apart */
+	display_list_reset(&dl);
+	rectangle(&dl, 2.0, 2.0, 20.0, 20.0, 1);
+	rectangle_path(&dl, 10.0, 2.0, 20.0, 20.0, 0);
+	rectangle_path(&dl, 20.0, 2.0, 28.0, 20.0, 0);
+	display_list_fill(&dl);
+	raster_small(&dl);
+	res = res && dl.nbatches == 2 && only_rectangle(2, 2, 28, 20);
+	display_list_release(&dl);
+	return res;
+}
+
+TEST(test_stroke_width)
+{
+	struct display_list dl;
+	int res;
+
+	display_list_init(&dl);
+	display_list_set_color(&dl, 1.0f, 1.0f, 1.0f);
+	display_list_move_to(&dl, 4.0, 16.0);
+	display_list_line_to(&dl, 28.0, 16.0);
+	display_list_stroke(&dl, 0);
+	raster_small(&dl);
+	/* a two pixel line straddling y = 16 */
+	res = only_rectangle(4, 15, 28, 17);
+	display_list_release(&dl);
+	return res;
+}
+
+TEST(test_clipping)
+{
+	struct display_list dl;
+	int res;
+
+	display_list_init(&dl);
+	display_list_set_color(&dl, 1.0f, 1.0f, 1.0f);
+	rectangle(&dl, -100.0, 24.0, 100.0, 200.0, 1);
+	raster_small(&dl);
+	res = only_rectangle(0, 24, SIZE, SIZE);
+	display_list_release(&dl);
+	return res;
+}
+
+/* Is (x, y) inside the simple outline p[0..n), wound either way? */
+static int inside_outline(double (*p)[2], int n, double x, double y)
+{
+	int crossings = 0;
+
+	for (int i = 0; i < n; i++) {
+		double *a = p[i], *b = p[(i + 1) % n];
+		double ytop = a[1] < b[1] ? a[1] : b[1], ybottom = a[1] < b[1] ? b[1] : a[1];
+
+		if (ytop <= y && y < ybottom
+			&& a[0] + (y - a[1]) * (b[0] - a[0]) / (b[1] - a[1]) <= x)
+			crossings++;
+	}
+	return crossings & 1;
+}
+
+/* Many outlines in one batch, starting and ending on all sorts of rows,
+ * some above the top: every pixel centre inside one of them is filled. */
+TEST(test_fill_many_edges)
+{
+	enum { W = 64, H = 64, SHAPES = 60, CORNERS = 7 };
+	static uint32_t     frame[W * H];
+	static double       shapes[SHAPES][CORNERS][2];
+	struct display_list dl;
+	unsigned int        seed = 3;
+	int                 res = 1;
+
+	display_list_init(&dl);
+	display_list_set_color(&dl, 1.0f, 1.0f, 1.0f);
+	for (int s = 0; s < SHAPES; s++) {
+		double cx = rand_r(&seed) % 84 - 10 + 0.37, cy = rand_r(&seed) % 84 - 10 + 0.61;
+		double r = 2 + rand_r(&seed) % 14, turn = (rand_r(&seed) % 2) ? 1.0 : -1.0;
+
+		for (int k = 0; k < CORNERS; k++) {
+			double a = turn * (k + (rand_r(&seed) % 50) / 100.0) * 2.0 * M_PI / CORNERS;
+			shapes[s][k][0] = cx + r * cos(a);
+			shapes[s][k][1] = cy + r * sin(a) * (1 + rand_r(&seed) % 3);
+			if (k)
+				display_list_line_to(&dl, shapes[s][k][0], shapes[s][k][1]);
+			else
+				display_list_move_to(&dl, shapes[s][k][0], shapes[s][k][1]);
+		}
+		display_list_fill(&dl);
+	}
+	memset(frame, 0, sizeof frame);
+	raster_submit(&dl, frame, W, H, W * sizeof(uint32_t));
+	for (int y = 0; res && y < H; y++)
+	for (int x = 0; res && x < W; x++) {
+		int inside = 0;
+		for (int s = 0; s < SHAPES && !inside; s++)
+			inside = inside_outline(shapes[s], CORNERS, x + 0.5, y + 0.5);
+		res = (frame[y * W + x] == WHITE) == inside;
+	}
+	res = res && dl.nbatches == 1;
+	display_list_release(&dl);
+	return res;
+}
+
+/* Paint every pose on the stock map both ways and compare the pixels. */
+/* Paint every open pose of the bundled map with renderer and with
+ * reference, and fail if any frame differs by more than tolerance. */
+static int views_match(int reference, int renderer, double tolerance)
+{
+	struct map *map = load_map_from_path("map");
+	int w = (int)display_width(), h = (int)display_height();
+	cairo_surface_t *expected, *actual;
+	cairo_t *expected_cr, *actual_cr;
+	double worst = 0.0;
+	int res = (map != NULL);
+
+	expected = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, w, h);
+	actual   = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, w, h);
+	expected_cr = cairo_create(expected);
+	actual_cr   = cairo_create(actual);
+
+	for (int y = 0; res && y < map_height(map); y++)
+	for (int x = 0; res && x < map_width(map); x++)
+	for (int facing = 0; res && facing < 4; facing++)
+	{
+		uint32_t *a, *b;
+		long off = 0;
+
+		if (map_tile(map, x, y) == 'X')
+			continue;
+		player_set_x(x);
+		player_set_y(y);
+		player_set_facing(facing);
+		view_set_renderer(reference);
+		view_paint(expected_cr, map);
+		view_set_renderer(renderer);
+		view_paint(actual_cr, map);
+		cairo_surface_flush(expected);
+		cairo_surface_flush(actual);
+
+		for (int row = 0; row < h; row++)
+		{
+			a = (uint32_t *)(cairo_image_surface_get_data(expected)
+				+ row * cairo_image_surface_get_stride(expected));
+			b = (uint32_t *)(cairo_image_surface_get_data(actual)
+				+ row * cairo_image_surface_get_stride(actual));
+			for (int col = 0; col < w; col++)
+			for (int shift = 0; shift < 24; shift += 8)
+			{
+				int d = (int)((a[col] >> shift) & 0xff) - (int)((b[col] >> shift) & 0xff);
+				if (d > CHANNEL_TOLERANCE || d < -CHANNEL_TOLERANCE) {
+					off++;
+					break;
+				}
+			}
+		}
+		if ((double)off / ((double)w * h) > worst)
+			worst = (double)off / ((double)w * h);
+		if (worst > tolerance) {
+			printf("(%d,%d facing %d: %ld pixels off) ", x, y, facing, off);
+			res = 0;
+		}
+	}
+	if (res)
+		printf("(worst %.3f%%) ", worst * 100.0);
+
+	view_set_renderer(VIEW_RENDER_CAIRO);
+	view_release();
+	cairo_destroy(expected_cr);
+	cairo_destroy(actual_cr);
+	cairo_surface_destroy(expected);
+	cairo_surface_destroy(actual);
+	map_delete(map);
+	return res;
+}
+
+TEST(test_views_match_cairo)
+{
+	return views_match(VIEW_RENDER_CAIRO, VIEW_RENDER_SOFTWARE, FRAME_TOLERANCE);
+}
+
+TEST(test_raycast_matches_painter)
+{
+	return views_match(VIEW_RENDER_SOFTWARE, VIEW_RENDER_RAYCAST, RAYCAST_TOLERANCE);
+}
+
+/* A slot holds a count twice over; a torn hand-over would show as the two
+ * halves disagreeing, a stale one as the count going backwards. */
+struct counted
+{
+	unsigned long first, second;
+};
+
+#define HANDOVERS 200000
+
+static void *write_counts(void *arg)
+{
+	struct triple_buffer *buffer = arg;
+
+	for (unsigned long n = 1; n <= HANDOVERS; n++) {
+		struct counted *slot = triple_buffer_back(buffer);
+
+		slot->first = n;
+		slot->second = n;
+		triple_buffer_publish(buffer);
+	}
+	return NULL;
+}
+
+TEST(test_triple_buffer)
+{
+	struct counted slots[3] = { { 0, 0 }, { 0, 0 }, { 0, 0 } };
+	struct triple_buffer buffer;
+	struct counted *got;
+	unsigned long last = 0;
+	pthread_t writer;
+	int res = 1;
+
+	triple_buffer_init(&buffer, &slots[0], &slots[1], &slots[2]);
+	res = res && !triple_buffer_take(&buffer);
+	((struct counted *)triple_buffer_back(&buffer))->first = 1;
+	triple_buffer_publish(&buffer);
+	((struct counted *)triple_buffer_back(&buffer))->first = 2;
+	triple_buffer_publish(&buffer);
+	got = triple_buffer_take(&buffer);
+	res = res && got && got->first == 2 && !triple_buffer_take(&buffer);
+	res = res && triple_buffer_back(&buffer) != (void *)got;
+
+	triple_buffer_init(&buffer, &slots[0], &slots[1], &slots[2]);
+	memset(slots, 0, sizeof slots);
+	pthread_create(&writer, NULL, write_counts, &buffer);
+	while (res && last < HANDOVERS) {
+		got = triple_buffer_take(&buffer);
+		if (!got)
+			continue;
+		if (got->first != got->second || got->first <= last) {
+			printf("(took %lu/%lu after %lu) ", got->first, got->second, last);
+			res = 0;
+		}
+		last = got->first;
+	}
+	pthread_join(writer, NULL);
+	return res;
+}
+
+/* Wait for the view thread to finish the frame with serial. */
+static const struct view_frame *frame_for(struct view_thread *thread, unsigned long serial)
+{
+	for (int tries = 0; tries < 5000; tries++) {
+		const struct view_frame *frame = view_thread_frame(thread);
+
+		if (frame && frame->serial == serial)
+			return frame;
+		usleep(1000);
+	}
+	return NULL;
+}
+
+/* The view thread sees only a window of tiles round the player, but
+ * paints the same picture as painting in place, even at the map's edge
+ * and part way through a step. */
+TEST(test_view_thread_matches_view_paint)
+{
+	struct map *map = load_map_from_path("map");
+	int w = (int)display_width(), h = (int)display_height();
+	struct view_thread *thread = view_thread_start();
+	cairo_surface_t *expected = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, w, h);
+	cairo_t *cr = cairo_create(expected);
+	int res = map && thread;
+
+	for (int y = 0; res && y < map_height(map); y++)
+	for (int x = 0; res && x < map_width(map); x++)
+	for (int facing = 0; res && facing < 4; facing++)
+	for (int moving = 0; res && moving < 2; moving++)
+	{
+		struct view_motion motion = { x, y + 1, facing, 0.5 };
+		const struct view_frame *frame;
+		unsigned long serial;
+
+		if (map_tile(map, x, y) == 'X')
+			continue;
+		player_set_x(x);
+		player_set_y(y);
+		player_set_facing(facing);
+		if (moving)
+			view_paint_motion(cr, map, &motion);
+		else
+			view_paint(cr, map);
+		cairo_surface_flush(expected);
+		serial = view_thread_post(thread, map, x, y, facing, moving ? &motion : NULL,
+			w, h, VIEW_RENDER_CAIRO);
+		frame = frame_for(thread, serial);
+		if (!frame || frame->width != w || frame->height != h) {
+			printf("(%d,%d facing %d: no frame) ", x, y, facing);
+			res = 0;
+			break;
+		}
+		for (int row = 0; res && row < h; row++)
+			if (memcmp(cairo_image_surface_get_data(expected)
+					+ row * cairo_image_surface_get_stride(expected),
+					cairo_image_surface_get_data(frame->surface)
+					+ row * cairo_image_surface_get_stride(frame->surface),
+					(size_t)w * 4)) {
+				printf("(%d,%d facing %d%s: row %d differs) ", x, y, facing,
+					moving ? " moving" : "", row);
+				res = 0;
+			}
+	}
+
+	view_thread_stop(thread);
+	view_release();
+	cairo_destroy(cr);
+	cairo_surface_destroy(expected);
+	map_delete(map);
+	return res;
+}
+
+/* Once every pose has been painted, painting them again must not touch
+ * the heap: the frame's scratch is kept or comes from the frame arena.
+ * Only the renderers that put the pixels down themselves are held to it;
+ * cairo keeps its own allocations. */
+TEST(test_steady_frames_allocate_nothing)
+{
+	static const int renderers[] = { VIEW_RENDER_SOFTWARE, VIEW_RENDER_RAYCAST };
+	struct map *map = load_map_from_path("map");
+	int w = (int)display_width(), h = (int)display_height();
+	cairo_surface_t *surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, w, h);
+	cairo_t *cr = cairo_create(surface);
+	int res = (map != NULL);
+
+	for (size_t r = 0; res && r < sizeof renderers / sizeof renderers[0]; r++)
+	for (int pass = 0; res && pass < 2; pass++)
+	for (int y = 0; res && y < map_height(map); y++)
+	for (int x = 0; res && x < map_width(map); x++)
+	for (int facing = 0; res && facing < 4; facing++)
+	for (int moving = 0; res && moving < 3; moving++)
+	{
+		/* at rest, stepping in, and turning in from the left */
+		struct view_motion motion = { x - (facing == 1) + (facing == 3),
+			y + (facing == 0) - (facing == 2), moving == 2 ? (facing + 1) % 4 : facing, 0.5 };
+		struct alloc_count before, after;
+
+		if (map_tile(map, x, y) == 'X')
+			continue;
+		if (moving == 2) {
+			motion.x = x;
+			motion.y = y;
+		}
+		player_set_x(x);
+		player_set_y(y);
+		player_set_facing(facing);
+		view_set_renderer(renderers[r]);
+		alloc_debug_count(&before);
+		if (moving)
+			view_paint_motion(cr, map, &motion);
+		else
+			view_paint(cr, map);
+		alloc_debug_count(&after);
+		if (pass && after.allocations != before.allocations) {
+			printf("(renderer %d at %d,%d facing %d: %lu allocations, %llu bytes) ",
+				renderers[r], x, y, facing, after.allocations - before.allocations,
+				after.bytes - before.bytes);
+			res = 0;
+		}
+	}
+
+	view_set_renderer(VIEW_RENDER_CAIRO);
+	view_release();
+	cairo_destroy(cr);
+	cairo_surface_destroy(surface);
+	map_delete(map);
+	return res;
+}
+
+static void capture_solid(struct capture *capture, uint32_t pixel, uint32_t ms)
+{
+	int stride;
+	unsigned char *out = capture_begin(capture, 4, 2, &stride);
+
+	for (int y = 0; out && y < 2; y++)
+	for (int x = 0; x < 4; x++)
+		((uint32_t *)(out + y * stride))[x] = pixel;
+	if (out)
+		capture_commit(capture, ms);
+}
+
+/* A Y4M stream runs at CAPTURE_FPS whenever frames came: each frame is
+ * repeated until the next, and one replaced within the same tick is never
+ * seen.  A burst the writer can't keep up with is dropped, not waited on. */
+TEST(test_capture_stream)
+{
+	static const char header[] = "YUV4MPEG2 W4 H2 F30:1 Ip A1:1 C444\n";
+	enum { FRAME = 6 + 4 * 2 * 3 };
+	char directory[] = "/tmp/render_test.XXXXXX", path[64];
+	struct capture *capture;
+	unsigned char buffer[sizeof header - 1 + 40 * FRAME];
+	size_t length = 0;
+	FILE *file;
+	int res = mkdtemp(directory) != NULL;
+
+	snprintf(path, sizeof path, "%s/capture.y4m", directory);
+	capture = res ? capture_start(path) : NULL;
+	res = res && capture;
+	if (res) {
+		capture_solid(capture, 0xffffffffu, 1000);
+		capture_solid(capture, 0xffff0000u, 1100);
+		capture_solid(capture, 0xff000000u, 1100);
+		capture_solid(capture, 0xffffffffu, 2000);
+		res = !capture_dropped(capture);
+		capture_stop(capture);
+	}
+	file = res ? fopen(path, "rb") : NULL;
+	if (file) {
+		length = fread(buffer, 1, sizeof buffer, file);
+		fclose(file);
+	}
+	res = res && length == sizeof header - 1 + 31 * FRAME
+		&& !memcmp(buffer, header, sizeof header - 1);
+	for (int f = 0; res && f < 31; f++) {
+		const unsigned char *frame = buffer + sizeof header - 1 + f * FRAME;
+		int luma = f < 3 || f == 30 ? 235 : 16;
+
+		if (memcmp(frame, "FRAME\n", 6) || frame[6] != luma || frame[6 + 8] != 128) {
+			printf("(frame %d: Y %d U %d) ", f, frame[6], frame[6 + 8]);
+			res = 0;
+		}
+	}
+	unlink(path);
+
+	/* a burst far bigger than the queue, all in the same tick */
+	capture = res ? capture_start(path) : NULL;
+	res = res && capture;
+	for (int i = 0; res && i < 200; i++) {
+		int stride;
+
+		if (capture_begin(capture, 1024, 1024, &stride))
+			capture_commit(capture, 0);
+	}
+	if (capture) {
+		res = res && capture_dropped(capture) > 0;
+		capture_stop(capture);
+	}
+	file = res ? fopen(path, "rb") : NULL;
+	if (file) {
+		fseek(file, 0, SEEK_END);
+		res = ftell(file) == (long)(strlen("YUV4MPEG2 W1024 H1024 F30:1 Ip A1:1 C444\n")
+			+ 6 + 1024 * 1024 * 3);
+		fclose(file);
+	} else {
+		res = 0;
+	}
+	unlink(path);
+	rmdir(directory);
+	return res;
+}
+
+/* Compose a solid view above a white panel, from buffers just the size
+ * of each, so that a copy sized by anything else runs off the end. */
+static void capture_view(struct capture *capture, uint32_t pixel, int side, int panel_width,
+	uint32_t ms)
+{
+	uint32_t *view = malloc((size_t)side * side * 4), *panel = malloc((size_t)panel_width * 2 * 4);
+
+	for (int i = 0; view && i < side * side; i++)
+		view[i] = pixel;
+	for (int i = 0; panel && i < panel_width * 2; i++)
+		panel[i] = 0xffffffffu;
+	if (view && panel)
+		capture_compose(capture, (unsigned char *)view, side * 4, side, side,
+			(unsigned char *)panel, panel_width * 4, panel_width, 2, ms);
+	free(view);
+	free(panel);
+}
+
+/* The window grows part way through: the bigger frame is left out of the
+ * stream rather than squeezed into it, and each frame is copied at the
+ * size it really is. */
+TEST(test_capture_across_resize)
+{
+	enum { FRAME = 6 * 6 * 3 };
+	char directory[] = "/tmp/render_test.XXXXXX", path[64];
+	struct capture *capture;
+	unsigned char buffer[40 * FRAME];
+	size_t length = 0;
+	FILE *file;
+	int res = mkdtemp(directory) != NULL;
+
+	snprintf(path, sizeof path, "%s/capture.rgb", directory);
+	capture = res ? capture_start(path) : NULL;
+	res = res && capture;
+	if (res) {
+		capture_view(capture, 0xffff0000u, 4, 6, 0);
+		capture_view(capture, 0xff00ff00u, 8, 10, 500);
+		capture_view(capture, 0xff0000ffu, 4, 6, 1000);
+		capture_stop(capture);
+	}
+	file = res ? fopen(path, "rb") : NULL;
+	if (file) {
+		length = fread(buffer, 1, sizeof buffer, file);
+		fclose(file);
+	}
+	res = res && length == 31 * FRAME
+		/* red view, black beside it, white panel below */
+		&& !memcmp(buffer, "\xff\0\0", 3) && !memcmp(buffer + 5 * 3, "\0\0\0", 3)
+		&& !memcmp(buffer + 6 * 4 * 3, "\xff\xff\xff", 3)
+		&& !memcmp(buffer + 29 * FRAME, "\xff\0\0", 3)
+		&& !memcmp(buffer + 30 * FRAME, "\0\0\xff", 3);
+	unlink(path);
+	rmdir(directory);
+	return res;
+}
+
+/* A one-cell atlas holding one frame of length bytes of data. */
+static int write_atlas(const char *path, struct map *map, int width, int height,
+	const void *data, size_t length)
+{
+	struct atlas_header header = { ATLAS_MAGIC, ATLAS_VERSION, 1, 1,
+		(uint32_t)width, (uint32_t)height, 1, sizeof header, sizeof header + 4 * sizeof(uint32_t) };
+	uint32_t            index[4] = { 0, 0, 0, 0 };
+	struct atlas_frame  frame;
+	FILE               *file = fopen(path, "wb");
+	int                 ok;
+
+	memset(&frame, 0, sizeof frame);
+	frame.offset = header.frames_offset + sizeof frame;
+	frame.length = (uint32_t)length;
+	atlas_signature(map, 0, 0, 0, frame.signature);
+	if (!file)
+		return 0;
+	ok = fwrite(&header, sizeof header, 1, file) == 1 && fwrite(index, sizeof index, 1, file) == 1
+		&& fwrite(&frame, sizeof frame, 1, file) == 1
+		&& (!length || fwrite(data, length, 1, file) == 1);
+	return !fclose(file) && ok;
+}
+
+/* Compress a frame with runs and literals, draw it back out of an atlas,
+ * and refuse it once the file is cut short or has words left over. */
+TEST(test_atlas_round_trip)
+{
+	enum { W = 8, H = 4 };
+	static const uint32_t pixels[H][W] = {
+		{ 1, 1, 1, 1, 1, 1, 1, 1 },
+		{ 1, 2, 1, 2, 1, 2, 1, 2 },
+		{ 3, 3, 4, 5, 5, 5, 5, 6 },
+		{ 7, 7, 7, 8, 9, 8, 9, 9 }
+	};
+	char              path[] = "/tmp/render_test.XXXXXX";
+	uint32_t          out[H][W], data[128];
+	struct map       *map = map_new(1, 1);
+	struct atlas     *atlas = NULL;
+	size_t            length = 0;
+	int               fd = mkstemp(path);
+	int               res = fd >= 0 && map && atlas_compress_bound(W, H) <= sizeof data;
+
+	if (fd >= 0)
+		close(fd);
+	if (res) {
+		map_set_tile(map, 0, 0, '.');
+		length = atlas_compress(pixels, W, H, W * 4, data);
+		/* runs make it smaller than the pixels */
+		res = length < sizeof pixels;
+	}
+	res = res && write_atlas(path, map, W, H, data, length) && (atlas = atlas_open(path));
+	if (res) {
+		memset(out, 0, sizeof out);
+		res = atlas_draw(atlas, map, 0, 0, 0, out, W * 4) && !memcmp(out, pixels, sizeof out);
+		atlas_close(atlas);
+	}
+	/* a word short, either a run's pixel or part of a literal */
+	for (size_t cut = 4; res && cut <= length; cut += 4) {
+		res = write_atlas(path, map, W, H, data, length - cut) && (atlas = atlas_open(path));
+		if (res) {
+			res = !atlas_draw(atlas, map, 0, 0, 0, out, W * 4);
+			atlas_close(atlas);
+		}
+	}
+	if (res) {
+		data[length / 4] = 0;
+		res = write_atlas(path, map, W, H, data, length + 4) && (atlas = atlas_open(path));
+		res = res && !atlas_draw(atlas, map, 0, 0, 0, out, W * 4);
+		atlas_close(atlas);
+	}
+	unlink(path);
+	map_delete(map);
+	return res;
+}
+
+/* Frames are shared by signature: a square room seen from its middle
+ * looks the same facing east at a '|' door as facing north at a '-'. */
+TEST(test_atlas_signature_shares_turned_doors)
+{
+	struct map *east = map_new(9, 9), *north = map_new(9, 9);
+	char        a[VIEW_CONE_CELLS], b[VIEW_CONE_CELLS];
+	int         res = east && north;
+
+	for (int y = 0; res && y < 9; y++)
+	for (int x = 0; x < 9; x++) {
+		map_set_tile(east, x, y, '.');
+		map_set_tile(north, x, y, '.');
+	}
+	if (res) {
+		map_set_tile(east, 6, 4, '|');
+		map_set_tile(north, 4, 2, '-');
+		atlas_signature(east, 4, 4, DIRECTION_EAST, a);
+		atlas_signature(north, 4, 4, DIRECTION_NORTH, b);
+		res = !memcmp(a, b, sizeof a);
+		atlas_signature(east, 4, 4, DIRECTION_WEST, b);
+		res = res && memcmp(a, b, sizeof a);
+	}
+	map_delete(east);
+	map_delete(north);
+	return res;
+}
+
+int main (int argc, char *argv[])
+{
+	int passes = 0;
+	int fails  = 0;
+
+	test_fn functions [] = {
+		test_span_fill,
+		test_pack_color,
+		test_fill_rectangle,
+		test_fill_winding,
+		test_fill_winding_not_convex,
+		test_stroke_width,
+		test_clipping,
+		test_fill_many_edges,
+		test_views_match_cairo,
+		test_raycast_matches_painter,
+		test_triple_buffer,
+		test_view_thread_matches_view_paint,
+		test_steady_frames_allocate_nothing,
+		test_capture_stream,
+		test_capture_across_resize,
+		test_atlas_round_trip,
+		test_atlas_signature_shares_turned_doors
+	};
+
+	if (argc > 1) {
+		printf ("Ignoring arguments to %s\n", argv[0]);
+	}
+
+	for (size_t i = 0; i < sizeof(functions)/sizeof(test_fn); i++)
+	{
+		(functions[i]())?passes++:fails++;
+	}
+	printf ("Passed: %i\tFailed: %i\n", passes, fails);
+	return fails != 0;
+}
@@ -0,0 +1,167 @@
+/*
+ *  Copyright 2016 Kendall E. Blake
+ *
+ *  This file is part of cairo-test.
+ *
+ *  cairo-test is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published
+ *  by the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  cairo-test is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with cairo-test.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <cairo.h>
+
+#include "drawing.h"
+#include "game.h"
+#include "map.h"
+#include "recording.h"
+#include "view.h"
+
+/* Re-run a recorded session as fast as possible, without a window.  With
+ * --render every frame the game would have drawn is painted offscreen. */
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint64_t surface_checksum(cairo_surface_t *surface)
+{
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	unsigned char *data = cairo_image_surface_get_data(surface);
+	int stride = cairo_image_surface_get_stride(surface);
+	int width  = cairo_image_surface_get_width(surface);
+	int height = cairo_image_surface_get_height(surface);
+
+	cairo_surface_flush(surface);
+	for (int y = 0; y < height; y++)
+	for (int x = 0; x < width * 4; x++)
+	{
+		hash ^= data[y * stride + x];
+		hash *= 0x100000001b3ULL;
+	}
+	return hash;
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "usage: %s [--render] [--size WxH] [--renderer immediate|cairo|software|raycast]\n"
+		"\t[--distance rows] [--fog row] recording\n", name);
+	exit(2);
+}
+
+int main (int argc, char *argv[])
+{
+	struct recording      *rec;
+	struct recording_event ev;
+	cairo_surface_t *surface = NULL;
+	cairo_t         *cr = NULL;
+	const char *path = NULL;
+	int    render = 0;
+	int    distance = VIEW_STEPS, fog = -1;
+	long   actions = 0, frames = 0;
+	double sim_time = 0.0, render_time = 0.0, start;
+	uint32_t session_ticks = 0;
+
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "--render")) {
+			render = 1;
+		} else if (!strcmp(argv[i], "--size") && i + 1 < argc) {
+			int w, h;
+			if (!display_parse_size(argv[++i], &w, &h))
+				usage(argv[0]);
+			display_set_size(w, h);
+		} else if (!strcmp(argv[i], "--distance") && i + 1 < argc) {
+			distance = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "--fog") && i + 1 < argc) {
+			fog = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "--renderer") && i + 1 < argc) {
+			int renderer = view_renderer_from_name(argv[++i]);
+			if (renderer < 0)
+				usage(argv[0]);
+			view_set_renderer(renderer);
+		} else if (!path) {
+			path = argv[i];
+		} else {
+			usage(argv[0]);
+		}
+	}
+	if (fog < 0)
+		fog = distance < VIEW_STEPS ? distance : VIEW_STEPS;
+	view_set_draw_distance(distance, fog);
+	if (!path)
+		usage(argv[0]);
+
+	rec = recording_open(path);
+	if (!rec) {
+		fprintf(stderr, "Can't read recording: %s\n", path);
+		return 1;
+	}
+	current_map = recording_take_map(rec);
+	recording_restore_player(rec);
+	game_seed(recording_seed(rec));
+
+	if (render) {
+		surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32,
+			display_width(), display_height());
+		cr = cairo_create(surface);
+		start = now();
+		view_paint(cr, current_map);
+		render_time += now() - start;
+		frames++;
+	}
+
+	while (recording_next(rec, &ev)) {
+		start = now();
+		game_do_action(ev.action);
+		sim_time += now() - start;
+		actions++;
+		session_ticks = ev.ticks;
+
+		if (render && is_dirty()) {
+			start = now();
+			view_paint(cr, current_map);
+			render_time += now() - start;
+			frames++;
+		}
+		mark_clean();
+	}
+
+	printf("recording\t%s\n", path);
+	printf("session_ms\t%u\n", (unsigned int)session_ticks);
+	printf("actions\t%li\n", actions);
+	printf("sim_seconds\t%.6f\n", sim_time);
+	printf("actions_per_second\t%.0f\n", sim_time > 0 ? actions / sim_time : 0.0);
+	printf("state_checksum\t%016llx\n",
+		(unsigned long long)game_state_checksum(current_map));
+	if (render) {
+		printf("frames\t%li\n", frames);
+		printf("render_seconds\t%.6f\n", render_time);
+		printf("frames_per_second\t%.1f\n", render_time > 0 ? frames / render_time : 0.0);
+		printf("frame_checksum\t%016llx\n",
+			(unsigned long long)surface_checksum(surface));
+		cairo_destroy(cr);
+		cairo_surface_destroy(surface);
+	}
+
+	recording_close(rec);
+	map_delete(current_map);
+	return 0;
+}
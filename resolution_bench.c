@@ -0,0 +1,179 @@
+/*
+ *  Copyright 2016 Kendall E. Blake
+ *
+ *  This file is part of cairo-test.
+ *
+ *  cairo-test is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published
+ *  by the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  cairo-test is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with cairo-test.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <cairo.h>
+
+#include "drawing.h"
+#include "map.h"
+#include "map_loader.h"
+#include "player.h"
+#include "view.h"
+
+/* Paint every pose on a map at a range of view sizes with each renderer,
+ * and report the time per frame.  The default sizes are the square views
+ * that fill the height of a 480-line window, 1080p, 1440p and 4K.  Given
+ * several draw distances, every renderer is timed at each, so that the
+ * painters can be set against the raycaster as the view gets deeper. */
+
+static const char *default_sizes[] = { "480x480", "1080x1080", "1440x1440", "2160x2160" };
+static const char *renderer_names[] = { "immediate", "cairo", "software", "raycast" };
+
+#define MAX_DISTANCES 16
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Paint each pose once; returns the number of frames. */
+static long paint_all_poses(cairo_t *cr, struct map *map)
+{
+	long frames = 0;
+
+	for (int y = 0; y < map_height(map); y++)
+	for (int x = 0; x < map_width(map); x++)
+	for (int facing = 0; facing < 4; facing++)
+	{
+		if (map_tile(map, x, y) == 'X')
+			continue;
+		player_set_x(x);
+		player_set_y(y);
+		player_set_facing(facing);
+		view_paint(cr, map);
+		frames++;
+	}
+	return frames;
+}
+
+static void sweep(struct map *map, const char *spec, const char *renderer_name, int distance,
+	double min_seconds)
+{
+	cairo_surface_t *surface;
+	cairo_t *cr;
+	int w, h;
+	long frames = 0;
+	double start, elapsed;
+
+	if (!display_parse_size(spec, &w, &h)) {
+		fprintf(stderr, "Not a size: %s\n", spec);
+		return;
+	}
+	display_set_size(w, h);
+	view_set_renderer(view_renderer_from_name(renderer_name));
+	surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, w, h);
+	cr = cairo_create(surface);
+
+	paint_all_poses(cr, map);   /* warm up */
+	start = now();
+	do {
+		frames += paint_all_poses(cr, map);
+		elapsed = now() - start;
+	} while (elapsed < min_seconds);
+
+	printf("%s\t%d\t%d\t%d\t%li\t%.3f\t%.1f\n", renderer_name, distance, w, h, frames,
+		frames ? elapsed * 1000.0 / frames : 0.0, elapsed > 0 ? frames / elapsed : 0.0);
+	fflush(stdout);
+
+	cairo_destroy(cr);
+	cairo_surface_destroy(surface);
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "usage: %s [--renderer immediate|cairo|software|raycast] [--seconds s]\n"
+		"\t[--no-lod] [--no-coalesce] [--distance rows[,rows...]] [--fog row] [--map file]\n"
+		"\t[WxH ...]\n", name);
+	exit(2);
+}
+
+int main (int argc, char *argv[])
+{
+	const char  *map_path = "map";
+	const char  *only_renderer = NULL;
+	const char **sizes = default_sizes;
+	int          nsizes = sizeof(default_sizes) / sizeof(default_sizes[0]);
+	int          distances[MAX_DISTANCES] = { VIEW_STEPS }, ndistances = 1, fog = -1;
+	double       seconds = 1.0;
+	struct map  *map;
+
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "--distance") && i + 1 < argc) {
+			char *list = argv[++i];
+
+			for (ndistances = 0; ndistances < MAX_DISTANCES && *list; ndistances++) {
+				distances[ndistances] = (int)strtol(list, &list, 10);
+				if (*list == ',')
+					list++;
+				else if (*list)
+					usage(argv[0]);
+			}
+		} else if (!strcmp(argv[i], "--fog") && i + 1 < argc) {
+			fog = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "--renderer") && i + 1 < argc) {
+			only_renderer = argv[++i];
+			if (view_renderer_from_name(only_renderer) < 0)
+				usage(argv[0]);
+		} else if (!strcmp(argv[i], "--seconds") && i + 1 < argc) {
+			seconds = atof(argv[++i]);
+		} else if (!strcmp(argv[i], "--no-lod")) {
+			drawing_set_lod(0);
+		} else if (!strcmp(argv[i], "--no-coalesce")) {
+			view_set_coalesce(0);
+		} else if (!strcmp(argv[i], "--map") && i + 1 < argc) {
+			map_path = argv[++i];
+		} else if (argv[i][0] != '-') {
+			sizes = (const char **)&argv[i];
+			nsizes = argc - i;
+			break;
+		} else {
+			usage(argv[0]);
+		}
+	}
+	map = load_map_from_path(map_path);
+	if (!map) {
+		fprintf(stderr, "Can't open map file: %s\n", map_path);
+		return 1;
+	}
+
+	printf("renderer\tdistance\twidth\theight\tframes\tms_per_frame\tframes_per_second\n");
+	for (int d = 0; d < ndistances; d++) {
+		int distance = distances[d];
+
+		view_set_draw_distance(distance, fog >= 0 ? fog
+			: distance < VIEW_STEPS ? distance : VIEW_STEPS);
+		for (size_t r = 0; r < sizeof(renderer_names) / sizeof(renderer_names[0]); r++) {
+			if (only_renderer && strcmp(only_renderer, renderer_names[r]))
+				continue;
+			for (int s = 0; s < nsizes; s++)
+				sweep(map, sizes[s], renderer_names[r], distance, seconds);
+		}
+	}
+
+	view_release();
+	map_delete(map);
+	return 0;
+}
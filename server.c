@@ -0,0 +1,193 @@
+/*
+ *  Copyright 2016 Kendall E. Blake
+ *
+ *  This file is part of cairo-test.
+ *
+ *  cairo-test is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published
+ *  by the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  cairo-test is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with cairo-test.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cairo.h>
+
+#include "game.h"
+#include "map.h"
+#include "map_loader.h"
+#include "player.h"
+#include "protocol.h"
+#include "session.h"
+
+/* Hosts any number of games in one process.  Every connection on the Unix
+ * socket gets a session and a thread of its own; all sessions start from
+ * the same loaded map and only copy the pages they change. */
+
+static struct map *shared_map;
+static unsigned int next_seed = 1;
+static pthread_mutex_t seed_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int read_all(int fd, void *buf, size_t len)
+{
+	char *p = (char *)buf;
+	while (len) {
+		ssize_t n = read(fd, p, len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return 0;
+		p += n;
+		len -= (size_t)n;
+	}
+	return 1;
+}
+
+static int write_all(int fd, const void *buf, size_t len)
+{
+	const char *p = (const char *)buf;
+	while (len) {
+		ssize_t n = write(fd, p, len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return 0;
+		p += n;
+		len -= (size_t)n;
+	}
+	return 1;
+}
+
+static void *serve_client(void *arg)
+{
+	int fd = (int)(intptr_t)arg;
+	struct protocol_request request;
+	struct session *session;
+	unsigned int seed;
+
+	pthread_mutex_lock(&seed_lock);
+	seed = next_seed++;
+	pthread_mutex_unlock(&seed_lock);
+
+	session = session_new(shared_map, seed);
+	if (!session) {
+		close(fd);
+		return NULL;
+	}
+
+	while (read_all(fd, &request, sizeof(request))) {
+		struct protocol_reply reply;
+		int first = !session->rendered;
+
+		game_do_action(request.action);
+		memset(&reply, 0, sizeof(reply));
+		reply.x       = player_x();
+		reply.y       = player_y();
+		reply.facing  = player_facing();
+		reply.gold    = player_gold();
+		reply.changed = is_dirty();
+
+		if ((request.flags & PROTOCOL_WANT_FRAME) && (reply.changed || first)) {
+			session_render(session);
+			reply.width  = cairo_image_surface_get_width(session->surface);
+			reply.height = cairo_image_surface_get_height(session->surface);
+			reply.stride = cairo_image_surface_get_stride(session->surface);
+		}
+		if (!write_all(fd, &reply, sizeof(reply)))
+			break;
+		if (reply.stride && !write_all(fd,
+				cairo_image_surface_get_data(session->surface),
+				(size_t)reply.stride * reply.height))
+			break;
+		mark_clean();
+	}
+
+	session_delete(session);
+	close(fd);
+	return NULL;
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "usage: %s [--socket path] [map]\n", name);
+	exit(2);
+}
+
+int main (int argc, char *argv[])
+{
+	const char *socket_path = PROTOCOL_DEFAULT_SOCKET;
+	const char *map_path = "map";
+	struct sockaddr_un addr;
+	int listener;
+
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "--socket") && i + 1 < argc) {
+			socket_path = argv[++i];
+		} else if (argv[i][0] != '-') {
+			map_path = argv[i];
+		} else {
+			usage(argv[0]);
+		}
+	}
+
+	shared_map = load_map_from_path(map_path);
+	if (!shared_map) {
+		fprintf(stderr, "Can't open map file: %s\n", map_path);
+		return 1;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "Socket path too long: %s\n", socket_path);
+		return 1;
+	}
+	strcpy(addr.sun_path, socket_path);
+	unlink(socket_path);
+
+	listener = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (listener < 0 || bind(listener, (struct sockaddr *)&addr, sizeof(addr)) < 0
+		|| listen(listener, 128) < 0) {
+		perror(socket_path);
+		return 1;
+	}
+	signal(SIGPIPE, SIG_IGN);
+	printf("Serving %s on %s\n", map_path, socket_path);
+
+	for (;;) {
+		pthread_t thread;
+		int fd = accept(listener, NULL, NULL);
+		if (fd < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("accept");
+			break;
+		}
+		if (pthread_create(&thread, NULL, serve_client, (void *)(intptr_t)fd) != 0) {
+			close(fd);
+			continue;
+		}
+		pthread_detach(thread);
+	}
+
+	close(listener);
+	unlink(socket_path);
+	map_delete(shared_map);
+	return 0;
+}
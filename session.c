@@ -0,0 +1,84 @@
+/*
+ *  Copyright 2016 Kendall E. Blake
+ *
+ *  This file is part of cairo-test.
+ *
+ *  cairo-test is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published
+ *  by the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  cairo-test is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with cairo-test.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+
+#include <cairo.h>
+
+#include "drawing.h"
+#include "game.h"
+#include "map.h"
+#include "player.h"
+#include "session.h"
+#include "view.h"
+
+/*@null@*/
+struct session *session_new(struct map *shared_map, unsigned int seed)
+{
+	struct session *session = (struct session *)calloc(1, sizeof(struct session));
+	if (!session)
+		return NULL;
+
+	session->player = player_new();
+	session->map = map_snapshot(shared_map);
+	session->surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32,
+		display_width(), display_height());
+	if (!session->player || !session->map
+		|| cairo_surface_status(session->surface) != CAIRO_STATUS_SUCCESS) {
+		session_delete(session);
+		return NULL;
+	}
+	session->cr = cairo_create(session->surface);
+	session_use(session);
+	game_seed(seed);
+	mark_dirty();
+	return session;
+}
+
+void session_use(struct session *session)
+{
+	player_use(session->player);
+	current_map = session->map;
+}
+
+void session_render(struct session *session)
+{
+	if (is_dirty() || !session->rendered) {
+		view_paint(session->cr, session->map);
+		cairo_surface_flush(session->surface);
+		session->rendered = 1;
+		mark_clean();
+	}
+}
+
+void session_delete(struct session *session)
+{
+	if (session) {
+		if (current_map == session->map) {
+			game_clear_history();
+			view_release();
+			current_map = NULL;
+		}
+		if (session->cr) cairo_destroy(session->cr);
+		if (session->surface) cairo_surface_destroy(session->surface);
+		map_delete(session->map);
+		player_delete(session->player);
+		free(session);
+	}
+}
@@ -0,0 +1,47 @@
+#ifndef SESSION_H
+#define SESSION_H
+/*
+ *  Copyright 2016 Kendall E. Blake
+ *
+ *  This file is part of cairo-test.
+ *
+ *  cairo-test is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published
+ *  by the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  cairo-test is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with cairo-test.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cairo.h>
+
+#include "map.h"
+#include "player.h"
+
+/* One game being played: its own player, its own copy-on-write view of a
+ * shared map and the surface its view is painted to.  A session is bound
+ * to a thread with session_use() before any game or player call. */
+struct session
+{
+	struct player   *player;
+	struct map      *map;
+	cairo_surface_t *surface;
+	cairo_t         *cr;
+	int              rendered;
+};
+
+/*@null@*/
+struct session *session_new(struct map *shared_map, unsigned int seed);
+void session_use(struct session *session);
+/* Paint the view if the game changed since the last call. */
+void session_render(struct session *session);
+/* Must be called on the thread the session was last used on. */
+void session_delete(struct session *session);
+
+#endif
@@ -0,0 +1,52 @@
+/*
+ *  Copyright 2016 Kendall E. Blake
+ *
+ *  This file is part of cairo-test.
+ *
+ *  cairo-test is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published
+ *  by the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  cairo-test is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with cairo-test.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stddef.h>
+
+#include "triple_buffer.h"
+
+void triple_buffer_init(struct triple_buffer *buffer, void *a, void *b, void *c)
+{
+	buffer->slots[0] = a;
+	buffer->slots[1] = b;
+	buffer->slots[2] = c;
+	buffer->back  = 0;
+	atomic_init(&buffer->middle, 1);
+	buffer->front = 2;
+}
+
+void *triple_buffer_back(struct triple_buffer *buffer)
+{
+	return buffer->slots[buffer->back];
+}
+
+void triple_buffer_publish(struct triple_buffer *buffer)
+{
+	buffer->back = atomic_exchange_explicit(&buffer->middle,
+		buffer->back | TRIPLE_BUFFER_FRESH, memory_order_acq_rel) & ~TRIPLE_BUFFER_FRESH;
+}
+
+void *triple_buffer_take(struct triple_buffer *buffer)
+{
+	if (!(atomic_load_explicit(&buffer->middle, memory_order_relaxed) & TRIPLE_BUFFER_FRESH))
+		return NULL;
+	buffer->front = atomic_exchange_explicit(&buffer->middle, buffer->front,
+		memory_order_acq_rel) & ~TRIPLE_BUFFER_FRESH;
+	return buffer->slots[buffer->front];
+}
@@ -0,0 +1,50 @@
+#ifndef TRIPLE_BUFFER_H
+#define TRIPLE_BUFFER_H
+/*
+ *  Copyright 2016 Kendall E. Blake
+ *
+ *  This file is part of cairo-test.
+ *
+ *  cairo-test is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published
+ *  by the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  cairo-test is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with cairo-test.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdatomic.h>
+
+/* Three slots passed between one writer and one reader without locks.
+ * The writer fills its back slot and publishes it; the reader takes the
+ * newest published slot.  Neither ever waits for the other: a writer that
+ * runs ahead replaces what the reader has not taken yet, and a reader
+ * that runs ahead finds nothing new. */
+struct triple_buffer
+{
+	void        *slots[3];
+	/* The slot between the two sides, with TRIPLE_BUFFER_FRESH set when
+	 * the writer has published it since the reader last took one. */
+	atomic_uint  middle;
+	unsigned     back, front;
+};
+
+#define TRIPLE_BUFFER_FRESH 4u
+
+void triple_buffer_init(struct triple_buffer *buffer, void *a, void *b, void *c);
+/* The slot the writer fills next. */
+void *triple_buffer_back(struct triple_buffer *buffer);
+/* Hand the back slot over and start on another. */
+void triple_buffer_publish(struct triple_buffer *buffer);
+/* The newest slot published since the last call, or NULL if there is none
+ * and the reader should keep using the one it has. */
+/*@null@*/
+void *triple_buffer_take(struct triple_buffer *buffer);
+
+#endif
@@ -0,0 +1,510 @@
+/*
+ *  Copyright 2016 Kendall E. Blake
+ *
+ *  This file is part of cairo-test.
+ *
+ *  cairo-test is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published
+ *  by the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  cairo-test is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with cairo-test.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cairo.h>
+#include <string.h>
+
+#include "arena.h"
+#include "direction.h"
+#include "display_list.h"
+#include "drawing.h"
+#include "map.h"
+#include "player.h"
+#include "raster.h"
+#include "raycast.h"
+#include "view.h"
+
+static _Thread_local struct display_list frame_list;
+static _Thread_local cairo_surface_t *background;
+static _Thread_local int renderer = VIEW_RENDER_CAIRO;
+
+static int coalesce = 1;
+static int draw_distance = VIEW_STEPS;
+
+/* The facing being painted, which mid-turn is not always the player's,
+ * and how many rows nearer the fog has come mid-move. */
+static _Thread_local int view_facing;
+static _Thread_local int fog_shift;
+
+static const int forward[4][2] = { { 0, -1 }, { 1, 0 }, { 0, 1 }, { -1, 0 } };
+static const int right[4][2]   = { { 1, 0 }, { 0, 1 }, { -1, 0 }, { 0, -1 } };
+
+typedef void (*drawing_fn_t)(cairo_t *, const struct view_cone *, int, int);
+
+int horizontal()
+{
+	return view_facing == DIRECTION_EAST || view_facing == DIRECTION_WEST;
+}
+
+int vertical()
+{
+	return view_facing == DIRECTION_NORTH || view_facing == DIRECTION_SOUTH;
+}
+
+static float fog_at(int steps)
+{
+	return drawing_fog(steps - fog_shift);
+}
+
+static char cone_tile(const struct view_cone *cone, int steps, int lateral)
+{
+	if (steps < 0 || steps >= cone->steps || lateral < -(steps + 1) || lateral > steps + 1)
+		return '\0';
+	return cone->tiles[view_cone_index(steps, lateral)];
+}
+
+/* Only open floor, and the space off the map, draw nothing. */
+static int empty(char tile)
+{
+	return tile == '.' || tile == '\0';
+}
+
+/* Is every cell between this one and the middle of the row empty? */
+static int clear_inside(const struct view_cone *cone, int steps, int lateral)
+{
+	int in = lateral > 0 ? -1 : 1;
+
+	for (int l = lateral + in; l != 0; l += in)
+		if (!empty(cone_tile(cone, steps, l)))
+			return 0;
+	return empty(cone_tile(cone, steps, 0));
+}
+
+/* Is the side of this wall that faces the middle of the view drawn?  Not
+ * if the next cell in is solid too; with coalescing that also decides
+ * which cell draws a run of side walls down a corridor.  Walls in a run
+ * after the first are only merged where nothing inside them is drawn, so
+ * painting the whole run at its nearest cell can't cover anything that
+ * should be in front of it, and only while the fog is the same colour. */
+static int side_wall_joins_nearer(const struct view_cone *cone, int steps, int lateral)
+{
+	int in = lateral > 0 ? -1 : 1;
+
+	return steps > 0 && cone_tile(cone, steps - 1, lateral) == 'X'
+		&& cone_tile(cone, steps - 1, lateral + in) != 'X'
+		&& clear_inside(cone, steps, lateral)
+		&& fog_at(steps - 1) == fog_at(steps);
+}
+
+static void draw_side_wall(cairo_t *cr, const struct view_cone *cone, int steps, int lateral)
+{
+	int in = lateral > 0 ? -1 : 1, far = steps;
+
+	if (coalesce) {
+		if (cone_tile(cone, steps, lateral + in) == 'X'
+				|| side_wall_joins_nearer(cone, steps, lateral))
+			return;
+		while (cone_tile(cone, far + 1, lateral) == 'X'
+				&& clear_inside(cone, far + 1, lateral)
+				&& fog_at(far + 1) == fog_at(steps))
+			far++;
+	}
+	if (lateral > 0)
+		left_wall_span(cr, steps * 10.0, (far - steps + 1) * 10.0);
+	else
+		right_wall_span(cr, steps * 10.0, (far - steps + 1) * 10.0);
+}
+
+/* A wall's face is hidden if the cell in front of it is solid. */
+static int front_wall_shown(const struct view_cone *cone, int steps, int lateral)
+{
+	return cone_tile(cone, steps, lateral) == 'X'
+		&& (!coalesce || cone_tile(cone, steps - 1, lateral) != 'X');
+}
+
+static void draw_front_wall(cairo_t *cr, const struct view_cone *cone, int steps, int lateral)
+{
+	int right = lateral;
+
+	if (coalesce) {
+		/* the run across the row is drawn from its leftmost wall */
+		if (front_wall_shown(cone, steps, lateral - 1))
+			return;
+		while (front_wall_shown(cone, steps, right + 1))
+			right++;
+	}
+	wall_span(cr, steps * 10.0, (right - lateral + 1) * 10.0);
+}
+
+void draw_flat_back (cairo_t *cr, const struct view_cone *cone, int steps, int lateral)
+{
+	float dist = steps * 10.0 + 10.0;
+
+	set_left_bias(lateral * 10.0);
+	drawing_set_depth(steps - fog_shift);
+	switch (cone_tile(cone, steps, lateral)) {
+		case 'X': wall(cr, dist); break;
+		case '|': if (horizontal()) { do_door(cr, dist); } else { wall(cr,dist); }; break;
+		case '-': if (vertical()) { do_door(cr, dist); } else { wall(cr,dist); };  break;
+		case '.': break;
+	}
+}
+
+void draw_flat_front (cairo_t *cr, const struct view_cone *cone, int steps, int lateral)
+{
+	float dist = steps * 10.0;
+
+	set_left_bias(lateral * 10.0);
+	drawing_set_depth(steps - fog_shift);
+	switch (cone_tile(cone, steps, lateral)) {
+		case 'X':
+			if (front_wall_shown(cone, steps, lateral))
+				draw_front_wall(cr, cone, steps, lateral);
+			return;
+		case '|': if (horizontal()) { do_door(cr, dist); return; } break;
+		case '-': if (vertical()) { do_door(cr, dist); return; }; break;
+		case '.': return;
+		default: return;
+	}
+	wall(cr, dist); 
+}
+
+void draw_core (cairo_t *cr, const struct view_cone *cone, int steps, int lateral)
+{
+	float dist = steps * 10.0;
+	void (*wallfn)(cairo_t*,float) = right_wall;
+	void (*doorfn)(cairo_t*,float) = right_door;
+	if (lateral > 0) wallfn = left_wall;
+	if (!lateral) wallfn = both_walls;
+	if (!lateral) doorfn = both_doors;
+	if (lateral > 0) doorfn = left_door;
+
+	set_left_bias(lateral * 10.0);
+	drawing_set_depth(steps - fog_shift);
+	switch (cone_tile(cone, steps, lateral)) {
+		case 'T': chest(cr, dist); break;
+		case 'X': if (lateral) { draw_side_wall(cr, cone, steps, lateral); } else { wallfn(cr, dist); }; break;
+		case '|': wallfn(cr, dist); if (vertical ()) { doorfn(cr, dist); }; break;
+		case '-': wallfn(cr, dist); if (horizontal ()) { doorfn(cr, dist); }; break;
+		case 'D': ladder_down(cr, dist); break;
+		case 'U': ladder_up(cr, dist); break;
+		case '.': break;
+	}
+}
+
+/* Visit a row of the cone in painter's order: in from the left edge, then
+ * in from the right edge to the middle. */
+static void paint_row(cairo_t *cr, const struct view_cone *cone, int steps, drawing_fn_t drawfn)
+{
+	for (int lateral = -(steps + 1); lateral < 0; lateral++)
+		drawfn(cr, cone, steps, lateral);
+	for (int lateral = steps + 1; lateral >= 0; lateral--)
+		drawfn(cr, cone, steps, lateral);
+}
+
+int view_cone_index(int steps, int lateral)
+{
+	return steps * (steps + 2) + lateral + steps + 1;
+}
+
+void view_cone_gather(struct map *map, int x, int y, int facing, int steps,
+	struct view_cone *cone)
+{
+	if (steps > VIEW_MAX_STEPS)
+		steps = VIEW_MAX_STEPS;
+	cone->steps = steps;
+	for (int row = 0; row < steps; row++)
+	for (int lateral = -(row + 1); lateral <= row + 1; lateral++)
+	{
+		int cx = x + forward[facing][0] * row + right[facing][0] * lateral;
+		int cy = y + forward[facing][1] * row + right[facing][1] * lateral;
+		char tile = '\0';
+
+		if (map_contains(map, cx, cy))
+			tile = map_tile(map, cx, cy);
+		cone->tiles[view_cone_index(row, lateral)] = tile;
+	}
+}
+
+void view_set_draw_distance(int steps, int fog_start)
+{
+	if (steps < 1)
+		steps = 1;
+	if (steps > VIEW_MAX_STEPS)
+		steps = VIEW_MAX_STEPS;
+	draw_distance = steps;
+	drawing_set_fog(fog_start, steps);
+}
+
+int view_draw_distance(void)
+{
+	return draw_distance;
+}
+
+/* Rows past the fog, or too small to make out, are not worth gathering. */
+static int visible_rows(void)
+{
+	int rows = 0;
+
+	while (rows < draw_distance && drawing_fog(rows) < 1.0
+			&& display_row_height(rows) >= 1.0)
+		rows++;
+	return rows;
+}
+
+void view_set_coalesce(int enabled)
+{
+	coalesce = enabled;
+}
+
+void view_set_renderer(int r)
+{
+	renderer = r;
+}
+
+int view_renderer(void)
+{
+	return renderer;
+}
+
+int view_renderer_from_name(const char *name)
+{
+	if (!strcmp(name, "immediate"))
+		return VIEW_RENDER_IMMEDIATE;
+	if (!strcmp(name, "cairo"))
+		return VIEW_RENDER_CAIRO;
+	if (!strcmp(name, "software"))
+		return VIEW_RENDER_SOFTWARE;
+	if (!strcmp(name, "raycast"))
+		return VIEW_RENDER_RAYCAST;
+	return -1;
+}
+
+/* Rasterize the frame's list straight into the pixels under cr, inside
+ * columns [x0, x1). */
+static void submit_software(cairo_t *cr, int x0, int x1)
+{
+	cairo_surface_t *target = cairo_get_target(cr);
+
+	cairo_surface_flush(target);
+	raster_submit_clipped(&frame_list, cairo_image_surface_get_data(target),
+		cairo_image_surface_get_stride(target),
+		x0, 0, x1, cairo_image_surface_get_height(target));
+	cairo_surface_mark_dirty(target);
+}
+
+/* Walls and doors go straight into the pixels from raycast.c; then what
+ * stands in the cells the rays crossed is drawn, furthest first, each
+ * only in the columns its cell was seen in. */
+static void paint_raycast(cairo_t *cr, struct map *map, int x, int y, int facing,
+	int rows, float depth, float pan, int x0, int x1)
+{
+	static _Thread_local struct raycast_view ray;
+	cairo_surface_t *target = cairo_get_target(cr);
+
+	cairo_surface_flush(target);
+	ray.pixels    = (uint32_t *)cairo_image_surface_get_data(target);
+	ray.pitch     = cairo_image_surface_get_stride(target);
+	ray.width     = display_width();
+	ray.height    = display_height();
+	ray.map       = map;
+	ray.x         = x;
+	ray.y         = y;
+	ray.facing    = facing;
+	ray.rows      = rows;
+	ray.fog_shift = fog_shift;
+	ray.depth     = depth;
+	ray.pan       = pan;
+	raycast_paint(&ray, x0, x1);
+
+	for (int i = 1; i < ray.cell_count; i++)
+	for (int j = i; j > 0 && ray.cells[j].steps > ray.cells[j - 1].steps; j--) {
+		struct raycast_cell swap = ray.cells[j];
+
+		ray.cells[j] = ray.cells[j - 1];
+		ray.cells[j - 1] = swap;
+	}
+	for (int i = 0; i < ray.cell_count; i++) {
+		const struct raycast_cell *cell = &ray.cells[i];
+		float dist = cell->steps * 10.0;
+
+		display_list_reset(&frame_list);
+		display_list_set_line_width(&frame_list, DISPLAY_LINE_WIDTH * display_scale());
+		drawing_record(&frame_list);
+		set_left_bias(cell->lateral * 10.0);
+		drawing_set_depth(cell->steps - fog_shift);
+		switch (cell->tile) {
+			case 'T': chest(cr, dist); break;
+			case 'D': ladder_down(cr, dist); break;
+			case 'U': ladder_up(cr, dist); break;
+		}
+		drawing_record(NULL);
+		raster_submit_clipped(&frame_list, ray.pixels, ray.pitch,
+			cell->x0, 0, cell->x1, ray.height);
+	}
+	cairo_surface_mark_dirty(target);
+}
+
+void view_release(void)
+{
+	display_list_release(&frame_list);
+	raster_release();
+	arena_release(frame_arena());
+	if (background)
+		cairo_surface_destroy(background);
+	background = NULL;
+}
+
+static void draw_background(cairo_t *cr)
+{
+	float scale = display_scale();
+
+	// clear to black
+	cairo_set_source_rgb(cr, 0.0, 0.0, 0.0);
+	cairo_paint(cr);
+
+	cairo_set_source_rgb(cr, 255, 0, 0);
+	cairo_select_font_face(cr, "Sans", CAIRO_FONT_SLANT_NORMAL,
+		CAIRO_FONT_WEIGHT_NORMAL);
+	cairo_set_font_size(cr, 40.0 * scale);
+	cairo_move_to(cr, 10.0 * scale, 50.0 * scale);
+	cairo_show_text(cr, "Hello, world!");
+}
+
+/* The background is the same every frame, so it is drawn once for each
+ * thread and size and copied in from then on: no font lookups or text
+ * layout in the frame. */
+static void paint_background(cairo_t *cr)
+{
+	cairo_surface_t *target = cairo_get_target(cr);
+	int width = display_width(), height = display_height();
+
+	if (cairo_surface_get_type(target) != CAIRO_SURFACE_TYPE_IMAGE
+			|| cairo_image_surface_get_format(target) != CAIRO_FORMAT_ARGB32
+			|| cairo_image_surface_get_width(target) != width
+			|| cairo_image_surface_get_height(target) != height) {
+		draw_background(cr);
+	} else {
+		unsigned char *from, *to;
+		int from_stride, to_stride;
+
+		if (!background || cairo_image_surface_get_width(background) != width
+				|| cairo_image_surface_get_height(background) != height) {
+			cairo_t *bcr;
+
+			if (background)
+				cairo_surface_destroy(background);
+			background = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, width, height);
+			bcr = cairo_create(background);
+			draw_background(bcr);
+			cairo_destroy(bcr);
+			cairo_surface_flush(background);
+		}
+		cairo_surface_flush(target);
+		from = cairo_image_surface_get_data(background);
+		to   = cairo_image_surface_get_data(target);
+		from_stride = cairo_image_surface_get_stride(background);
+		to_stride   = cairo_image_surface_get_stride(target);
+		for (int row = 0; from && to && row < height; row++)
+			memcpy(to + (size_t)row * to_stride, from + (size_t)row * from_stride,
+				(size_t)width * 4);
+		cairo_surface_mark_dirty(target);
+	}
+	cairo_set_source_rgb(cr, 255, 255, 255);
+	cairo_set_line_width(cr, DISPLAY_LINE_WIDTH * display_scale());
+}
+
+/* Paint the view from (x, y, facing) with the eye depth feet forward and
+ * the picture panned pan tenths across, into columns [x0, x1). */
+static void paint_pose(cairo_t *cr, struct map *map, int x, int y, int facing,
+	float depth, float pan, int x0, int x1)
+{
+	struct view_cone cone;
+	int rows = visible_rows();
+	int clipped = x0 > 0 || x1 < display_width();
+
+	/* mid-move the row past the last comes into view */
+	if (depth > 0.0 && rows < VIEW_MAX_STEPS)
+		rows++;
+	view_facing = facing;
+	fog_shift = depth >= 5.0 ? 1 : 0;
+	drawing_set_eye(depth, pan);
+
+	if (renderer == VIEW_RENDER_RAYCAST) {
+		paint_raycast(cr, map, x, y, facing, rows, depth, pan, x0, x1);
+		drawing_set_eye(0.0, 0.0);
+		fog_shift = 0;
+		return;
+	}
+	if (renderer != VIEW_RENDER_IMMEDIATE) {
+		display_list_reset(&frame_list);
+		display_list_set_line_width(&frame_list, DISPLAY_LINE_WIDTH * display_scale());
+		drawing_record(&frame_list);
+	}
+	if (clipped && renderer != VIEW_RENDER_SOFTWARE) {
+		cairo_save(cr);
+		cairo_rectangle(cr, x0, 0, x1 - x0, display_height());
+		cairo_clip(cr);
+	}
+	view_cone_gather(map, x, y, facing, rows, &cone);
+	for (int steps = cone.steps - 1; steps >= 0; steps--) {
+		paint_row(cr, &cone, steps, draw_core);
+		paint_row(cr, &cone, steps, draw_flat_front);
+	}
+	if (renderer != VIEW_RENDER_IMMEDIATE) {
+		drawing_record(NULL);
+		if (renderer == VIEW_RENDER_SOFTWARE)
+			submit_software(cr, x0, x1);
+		else
+			display_list_submit(&frame_list, cr);
+	}
+	if (clipped && renderer != VIEW_RENDER_SOFTWARE)
+		cairo_restore(cr);
+
+	drawing_set_eye(0.0, 0.0);
+	fog_shift = 0;
+}
+
+void view_paint(cairo_t *cr, struct map *map)
+{
+	arena_reset(frame_arena());
+	paint_background(cr);
+	paint_pose(cr, map, player_x(), player_y(), player_facing(), 0.0, 0.0,
+		0, display_width());
+}
+
+void view_paint_motion(cairo_t *cr, struct map *map, const struct view_motion *motion)
+{
+	int   x = player_x(), y = player_y(), facing = player_facing();
+	int   dx = x - motion->x, dy = y - motion->y;
+	int   width = display_width(), split;
+	float t = motion->t < 0.0 ? 0.0 : motion->t > 1.0 ? 1.0 : motion->t;
+
+	arena_reset(frame_arena());
+	paint_background(cr);
+	if (facing == motion->facing && dx == forward[facing][0] && dy == forward[facing][1]) {
+		/* stepping forward: from the old cell, with the eye coming up */
+		paint_pose(cr, map, motion->x, motion->y, facing, 10.0 * t, 0.0, 0, width);
+	} else if (facing == motion->facing && dx == -forward[facing][0] && dy == -forward[facing][1]) {
+		/* stepping back: from the new cell, with the eye going back */
+		paint_pose(cr, map, x, y, facing, 10.0 * (1.0 - t), 0.0, 0, width);
+	} else if (!dx && !dy && facing == (motion->facing + 1) % 4) {
+		/* turning right: the new view slides in from the right */
+		split = (int)(width * (1.0 - t) + 0.5);
+		paint_pose(cr, map, x, y, motion->facing, 0.0, -10.0 * t, 0, split);
+		paint_pose(cr, map, x, y, facing, 0.0, 10.0 * (1.0 - t), split, width);
+	} else if (!dx && !dy && motion->facing == (facing + 1) % 4) {
+		/* turning left: the new view slides in from the left */
+		split = (int)(width * t + 0.5);
+		paint_pose(cr, map, x, y, facing, 0.0, -10.0 * (1.0 - t), 0, split);
+		paint_pose(cr, map, x, y, motion->facing, 0.0, 10.0 * t, split, width);
+	} else {
+		paint_pose(cr, map, x, y, facing, 0.0, 0.0, 0, width);
+	}
+}
@@ -0,0 +1,91 @@
+#ifndef VIEW_H
+#define VIEW_H
+/*
+ *  Copyright 2016 Kendall E. Blake
+ *
+ *  This file is part of cairo-test.
+ *
+ *  cairo-test is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published
+ *  by the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  cairo-test is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with cairo-test.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cairo.h>
+
+#include "map.h"
+
+/* How many rows deep the view goes by default, counting the player's
+ * own, and how deep it can be set to go. */
+#define VIEW_STEPS     6
+#define VIEW_MAX_STEPS 64
+/* Row s of the cone is 2s+3 cells wide, so n rows add up to: */
+#define VIEW_CONE_SIZE(n) ((n) * ((n) + 2))
+#define VIEW_CONE_CELLS   VIEW_CONE_SIZE(VIEW_STEPS)
+
+/* The cells a view of the map can show, nearest row first and left to
+ * right within a row.  Cells off the edge of the map are '\0'.  Two poses
+ * with the same cone (and facing axis) paint the same picture at the
+ * same draw distance and fog. */
+struct view_cone
+{
+	int  steps;
+	char tiles[VIEW_CONE_SIZE(VIEW_MAX_STEPS)];
+};
+
+int view_cone_index(int steps, int lateral);
+/* Gather the first steps rows of the cone. */
+void view_cone_gather(struct map *map, int x, int y, int facing, int steps,
+	struct view_cone *cone);
+
+/* Paint the first-person view of map from the player's position into cr.
+ * cr should target a surface of display_width() x display_height(). */
+void view_paint(cairo_t *cr, struct map *map);
+
+/* Where the player was before the last move or turn, and how far (0 to 1)
+ * the picture has got from there to the player's current pose. */
+struct view_motion
+{
+	int   x, y, facing;
+	float t;
+};
+
+/* Paint the view part way through a step forward or back or a quarter
+ * turn: the eye glides between cells and a turn slides the new view in
+ * beside the old.  Any other change of pose paints where the player is. */
+void view_paint_motion(cairo_t *cr, struct map *map, const struct view_motion *motion);
+/* How view_paint() gets the walls onto the surface. */
+enum {
+	VIEW_RENDER_IMMEDIATE,  /* each primitive straight to cairo */
+	VIEW_RENDER_CAIRO,      /* batched through a display list (the default) */
+	VIEW_RENDER_SOFTWARE,   /* the display list, rasterized by raster.c */
+	VIEW_RENDER_RAYCAST     /* a ray per column, by raycast.c */
+};
+
+/* Each thread paints with its own renderer, VIEW_RENDER_CAIRO until it
+ * sets another. */
+void view_set_renderer(int renderer);
+int view_renderer(void);
+/* Merge runs of wall faces along a corridor or across a row into single
+ * polygons, and skip faces hidden between solid cells (1, the default),
+ * or draw every cell's faces (0). */
+void view_set_coalesce(int enabled);
+/* Paint steps rows deep (VIEW_STEPS to start with), fogging from row
+ * fog_start so that the last row drawn has nearly faded to black.  Rows
+ * too far out to be a pixel tall are never drawn. */
+void view_set_draw_distance(int steps, int fog_start);
+int view_draw_distance(void);
+/* "immediate", "cairo", "software" or "raycast"; -1 for anything else. */
+int view_renderer_from_name(const char *name);
+/* Free the calling thread's drawing buffers. */
+void view_release(void);
+
+#endif
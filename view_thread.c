@@ -0,0 +1,227 @@
+/*
+ *  Copyright 2016 Kendall E. Blake
+ *
+ *  This file is part of cairo-test.
+ *
+ *  cairo-test is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published
+ *  by the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  cairo-test is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with cairo-test.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+
+#ifdef ALLOC_DEBUG
+#include "alloc_debug.h"
+#endif
+#include "drawing.h"
+#include "player.h"
+#include "triple_buffer.h"
+#include "view_thread.h"
+
+/* The view reaches draw distance rows ahead and a cell further to each
+ * side than the row is deep, and a glide starts a cell away from the
+ * player: a window this far around the player holds every tile it can
+ * show. */
+#define WINDOW_REACH(steps) ((steps) + 2)
+#define WINDOW_SIDE_MAX     (2 * WINDOW_REACH(VIEW_MAX_STEPS) + 1)
+
+/* All the view needs of the game, copied out so that it can be painted
+ * while play goes on.  The player is in the middle of the window. */
+struct view_state
+{
+	unsigned long      serial;
+	int                width, height, renderer;
+	int                facing, moving;
+	struct view_motion motion;
+	/* row by row, '\0' off the map */
+	char               tiles[WINDOW_SIDE_MAX * WINDOW_SIDE_MAX];
+};
+
+struct view_thread
+{
+	pthread_t            thread;
+	sem_t                wake;
+	atomic_int           stopping;
+	int                  reach, side;
+	/* the last serial handed over; the game's side only */
+	unsigned long        serial;
+
+	/* Poses go one way and pictures come back the other. */
+	struct triple_buffer states, frames;
+	struct view_state    state_slots[3];
+	struct view_frame    frame_slots[3];
+	/* a context for each frame's surface, kept with it */
+	cairo_t             *frame_crs[3];
+
+	/* The thread's own: the window as a map, and a player to stand in it. */
+	struct map          *window;
+	struct player       *player;
+};
+
+static void paint_state(struct view_thread *thread, const struct view_state *state)
+{
+	struct view_frame *frame = triple_buffer_back(&thread->frames);
+	cairo_t          **cr = &thread->frame_crs[frame - thread->frame_slots];
+#ifdef ALLOC_DEBUG
+	struct alloc_count before, after;
+
+	alloc_debug_count(&before);
+#endif
+	if (!frame->surface || frame->width != state->width || frame->height != state->height) {
+		if (*cr)
+			cairo_destroy(*cr);
+		if (frame->surface)
+			cairo_surface_destroy(frame->surface);
+		frame->surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32,
+			state->width, state->height);
+		*cr = cairo_create(frame->surface);
+		frame->width  = state->width;
+		frame->height = state->height;
+	}
+	for (int row = 0; row < thread->side; row++)
+		map_write_row(thread->window, 0, row, state->tiles + row * thread->side,
+			(size_t)thread->side);
+	player_set_x(thread->reach);
+	player_set_y(thread->reach);
+	player_set_facing(state->facing);
+	display_set_thread_size(state->width, state->height);
+	if (view_renderer() != state->renderer)
+		view_set_renderer(state->renderer);
+
+	cairo_save(*cr);
+	if (state->moving)
+		view_paint_motion(*cr, thread->window, &state->motion);
+	else
+		view_paint(*cr, thread->window);
+	cairo_restore(*cr);
+	cairo_surface_flush(frame->surface);
+	frame->serial = state->serial;
+#ifdef ALLOC_DEBUG
+	alloc_debug_count(&after);
+	frame->allocations = after.allocations - before.allocations;
+#endif
+	triple_buffer_publish(&thread->frames);
+}
+
+static void *paint_views(void *arg)
+{
+	struct view_thread *thread = arg;
+
+	player_use(thread->player);
+	for (;;) {
+		struct view_state *state;
+
+		if (sem_wait(&thread->wake) && errno == EINTR)
+			continue;
+		if (atomic_load(&thread->stopping))
+			break;
+		state = triple_buffer_take(&thread->states);
+		if (state)
+			paint_state(thread, state);
+	}
+	view_release();
+	player_use(NULL);
+	return NULL;
+}
+
+struct view_thread *view_thread_start(void)
+{
+	struct view_thread *thread = calloc(1, sizeof *thread);
+
+	if (!thread)
+		return NULL;
+	thread->reach = WINDOW_REACH(view_draw_distance());
+	thread->side  = 2 * thread->reach + 1;
+	thread->window = map_new((size_t)thread->side, (size_t)thread->side);
+	thread->player = player_new();
+	triple_buffer_init(&thread->states,
+		&thread->state_slots[0], &thread->state_slots[1], &thread->state_slots[2]);
+	triple_buffer_init(&thread->frames,
+		&thread->frame_slots[0], &thread->frame_slots[1], &thread->frame_slots[2]);
+	atomic_init(&thread->stopping, 0);
+	if (!thread->window || !thread->player || sem_init(&thread->wake, 0, 0)) {
+		map_delete(thread->window);
+		player_delete(thread->player);
+		free(thread);
+		return NULL;
+	}
+	if (pthread_create(&thread->thread, NULL, paint_views, thread)) {
+		sem_destroy(&thread->wake);
+		map_delete(thread->window);
+		player_delete(thread->player);
+		free(thread);
+		return NULL;
+	}
+	return thread;
+}
+
+void view_thread_stop(struct view_thread *thread)
+{
+	if (!thread)
+		return;
+	atomic_store(&thread->stopping, 1);
+	sem_post(&thread->wake);
+	pthread_join(thread->thread, NULL);
+	for (int i = 0; i < 3; i++) {
+		if (thread->frame_crs[i])
+			cairo_destroy(thread->frame_crs[i]);
+		if (thread->frame_slots[i].surface)
+			cairo_surface_destroy(thread->frame_slots[i].surface);
+	}
+	sem_destroy(&thread->wake);
+	map_delete(thread->window);
+	player_delete(thread->player);
+	free(thread);
+}
+
+unsigned long view_thread_post(struct view_thread *thread, struct map *map,
+	int x, int y, int facing, const struct view_motion *motion,
+	int width, int height, int renderer)
+{
+	struct view_state *state = triple_buffer_back(&thread->states);
+	int reach = thread->reach, side = thread->side;
+
+	/* Whatever of a row is on the map is all in one piece. */
+	for (int row = 0; row < side; row++) {
+		char *tiles = state->tiles + row * side;
+		int   ty = y - reach + row, first = 0, last = side;
+
+		map_read_row(map, x - reach, ty, tiles, (size_t)side);
+		while (first < last && !map_contains(map, x - reach + first, ty))
+			tiles[first++] = '\0';
+		while (last > first && !map_contains(map, x - reach + last - 1, ty))
+			tiles[--last] = '\0';
+	}
+	state->serial   = ++thread->serial;
+	state->width    = width;
+	state->height   = height;
+	state->renderer = renderer;
+	state->facing   = facing;
+	state->moving   = motion != NULL;
+	if (motion) {
+		state->motion    = *motion;
+		state->motion.x += reach - x;
+		state->motion.y += reach - y;
+	}
+	triple_buffer_publish(&thread->states);
+	sem_post(&thread->wake);
+	return thread->serial;
+}
+
+const struct view_frame *view_thread_frame(struct view_thread *thread)
+{
+	return triple_buffer_take(&thread->frames);
+}
@@ -0,0 +1,61 @@
+#ifndef VIEW_THREAD_H
+#define VIEW_THREAD_H
+/*
+ *  Copyright 2016 Kendall E. Blake
+ *
+ *  This file is part of cairo-test.
+ *
+ *  cairo-test is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published
+ *  by the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  cairo-test is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with cairo-test.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cairo.h>
+
+#include "map.h"
+#include "view.h"
+
+/* A picture of the view, painted by the view thread. */
+struct view_frame
+{
+	/*@null@*/ cairo_surface_t *surface;
+	int           width, height;
+	/* which view_thread_post() it shows */
+	unsigned long serial;
+	/* heap allocations made painting it, counted in ALLOC_DEBUG builds */
+	unsigned long allocations;
+};
+
+struct view_thread;
+
+/* Paint the view on a thread of its own, so that however long a frame
+ * takes the game never waits for it.  The thread paints with whatever
+ * draw distance and fog are set when it starts. */
+/*@null@*/
+struct view_thread *view_thread_start(void);
+void view_thread_stop(/*@null@*/ struct view_thread *thread);
+
+/* Hand the thread a pose to paint at width x height with renderer: the
+ * player at (x, y) facing facing, part way through motion if that is not
+ * NULL.  The tiles around the pose are copied, so map can be played on
+ * straight away.  Never blocks; if the thread is still busy, the last
+ * pose handed over that it has not started on is dropped.  Returns the
+ * serial the frame will carry. */
+unsigned long view_thread_post(struct view_thread *thread, struct map *map,
+	int x, int y, int facing, /*@null@*/ const struct view_motion *motion,
+	int width, int height, int renderer);
+/* The newest frame finished since the last call, or NULL.  It stays good
+ * until the next call. */
+/*@null@*/
+const struct view_frame *view_thread_frame(struct view_thread *thread);
+
+#endif
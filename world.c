@@ -0,0 +1,349 @@
+/*
+ *  Copyright 2016 Kendall E. Blake
+ *
+ *  This file is part of cairo-test.
+ *
+ *  cairo-test is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published
+ *  by the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  cairo-test is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with cairo-test.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "world.h"
+
+/* Chunks are found through a chained hash of their coordinates and kept
+ * in a list from most to least recently used; both are threaded through
+ * the pool by index, with -1 for none.  Everything is under the lock but
+ * the generating itself.
+ *
+ * Reads mostly stay clear of the lock: a chunk only ever holds what the
+ * seed makes of it, so each thread keeps copies of the last few chunks it
+ * read and goes on using them whatever the pool has evicted since.  A
+ * world's serial tells its copies from those of a world freed before it
+ * at the same address. */
+
+#define WORLD_BUCKETS (WORLD_CHUNKS * 2)
+#define NONE          (-1)
+#define WORLD_CACHED  8     /* chunks copied out per thread */
+
+struct chunk
+{
+	long cx, cy;
+	int  next;              /* in its bucket, or the free list */
+	int  newer, older;
+	char tiles[WORLD_CHUNK_TILES];
+};
+
+struct cached_chunk
+{
+	uint64_t serial;        /* of the world it came from, or 0 for none */
+	long     cx, cy;
+	char     tiles[WORLD_CHUNK_TILES];
+};
+
+struct world
+{
+	atomic_int      refs;
+	uint64_t        seed, serial;
+	pthread_mutex_t lock;
+	pthread_cond_t  wake;
+	pthread_t       thread;
+	int             running, stopping;
+	long            focus_cx, focus_cy;
+	int             focused, focus_moved;
+	int             buckets[WORLD_BUCKETS];
+	int             newest, oldest, free_list;
+	size_t          resident;
+	struct chunk    chunks[WORLD_CHUNKS];
+};
+
+static atomic_uint_fast64_t        next_serial = 1;
+static _Thread_local struct cached_chunk cached[WORLD_CACHED];
+static _Thread_local unsigned int  cached_next = 0;
+
+long world_chunk_of(long x)
+{
+	return x >= 0 ? x / WORLD_CHUNK : -((-x - 1) / WORLD_CHUNK) - 1;
+}
+
+static size_t bucket_of(long cx, long cy)
+{
+	uint64_t h = (uint64_t)cx * 0x9e3779b97f4a7c15ull ^ (uint64_t)cy * 0xc2b2ae3d27d4eb4full;
+	return (size_t)(h ^ h >> 29) % WORLD_BUCKETS;
+}
+
+static int find(struct world *world, long cx, long cy)
+{
+	int i = world->buckets[bucket_of(cx, cy)];
+
+	while (i != NONE && (world->chunks[i].cx != cx || world->chunks[i].cy != cy))
+		i = world->chunks[i].next;
+	return i;
+}
+
+static void lru_unlink(struct world *world, int i)
+{
+	struct chunk *c = &world->chunks[i];
+
+	if (c->newer != NONE)
+		world->chunks[c->newer].older = c->older;
+	else
+		world->newest = c->older;
+	if (c->older != NONE)
+		world->chunks[c->older].newer = c->newer;
+	else
+		world->oldest = c->newer;
+}
+
+static void lru_push(struct world *world, int i)
+{
+	struct chunk *c = &world->chunks[i];
+
+	c->newer = NONE;
+	c->older = world->newest;
+	if (world->newest != NONE)
+		world->chunks[world->newest].newer = i;
+	else
+		world->oldest = i;
+	world->newest = i;
+}
+
+static void touch(struct world *world, int i)
+{
+	if (world->newest != i) {
+		lru_unlink(world, i);
+		lru_push(world, i);
+	}
+}
+
+/* Take chunk i out of the hash and the list and put it on the free list. */
+static void drop(struct world *world, int i)
+{
+	struct chunk *c = &world->chunks[i];
+	int          *link = &world->buckets[bucket_of(c->cx, c->cy)];
+
+	while (*link != i)
+		link = &world->chunks[*link].next;
+	*link = c->next;
+	lru_unlink(world, i);
+	c->next = world->free_list;
+	world->free_list = i;
+	world->resident--;
+}
+
+/* A chunk to fill, evicting the least recently used if none is free. */
+static int take(struct world *world, long cx, long cy)
+{
+	size_t        bucket = bucket_of(cx, cy);
+	int           i;
+	struct chunk *c;
+
+	if (world->free_list == NONE)
+		drop(world, world->oldest);
+	i = world->free_list;
+	c = &world->chunks[i];
+	world->free_list = c->next;
+	c->cx = cx;
+	c->cy = cy;
+	c->next = world->buckets[bucket];
+	world->buckets[bucket] = i;
+	lru_push(world, i);
+	world->resident++;
+	return i;
+}
+
+/* The chunk, generated here and now if it is not already there. */
+static struct chunk *fetch(struct world *world, long cx, long cy)
+{
+	int i = find(world, cx, cy);
+
+	if (i == NONE) {
+		i = take(world, cx, cy);
+		generate_region(world->seed, cx, cy, world->chunks[i].tiles);
+	} else {
+		touch(world, i);
+	}
+	return &world->chunks[i];
+}
+
+static long distance(long ax, long ay, long bx, long by)
+{
+	long dx = labs(ax - bx), dy = labs(ay - by);
+	return dx > dy ? dx : dy;
+}
+
+static void *ahead_main(void *arg)
+{
+	struct world *world = (struct world *)arg;
+	char          tiles[WORLD_CHUNK_TILES];
+
+	pthread_mutex_lock(&world->lock);
+	while (!world->stopping) {
+		long fx, fy;
+
+		if (!world->focus_moved) {
+			pthread_cond_wait(&world->wake, &world->lock);
+			continue;
+		}
+		world->focus_moved = 0;
+		fx = world->focus_cx;
+		fy = world->focus_cy;
+
+		for (int i = world->oldest; i != NONE; ) {
+			int newer = world->chunks[i].newer;
+			if (distance(world->chunks[i].cx, world->chunks[i].cy, fx, fy) > WORLD_KEEP)
+				drop(world, i);
+			i = newer;
+		}
+		/* nearest first, starting again if the focus moves meanwhile */
+		for (long r = 0; r <= WORLD_AHEAD && !world->focus_moved && !world->stopping; r++)
+		for (long cy = fy - r; cy <= fy + r && !world->focus_moved && !world->stopping; cy++)
+		for (long cx = fx - r; cx <= fx + r && !world->focus_moved && !world->stopping; cx++)
+		{
+			if (distance(cx, cy, fx, fy) != r || find(world, cx, cy) != NONE)
+				continue;
+			pthread_mutex_unlock(&world->lock);
+			generate_region(world->seed, cx, cy, tiles);
+			pthread_mutex_lock(&world->lock);
+			if (find(world, cx, cy) == NONE)
+				memcpy(world->chunks[take(world, cx, cy)].tiles, tiles, sizeof(tiles));
+		}
+	}
+	pthread_mutex_unlock(&world->lock);
+	return NULL;
+}
+
+/*@null@*/
+struct world *world_new(uint64_t seed)
+{
+	struct world *world = (struct world *)malloc(sizeof(struct world));
+
+	if (!world)
+		return NULL;
+	atomic_init(&world->refs, 1);
+	world->seed = seed;
+	world->serial = atomic_fetch_add(&next_serial, 1);
+	pthread_mutex_init(&world->lock, NULL);
+	pthread_cond_init(&world->wake, NULL);
+	world->running = world->stopping = world->focused = world->focus_moved = 0;
+	world->focus_cx = world->focus_cy = 0;
+	for (int b = 0; b < WORLD_BUCKETS; b++)
+		world->buckets[b] = NONE;
+	for (int i = 0; i < WORLD_CHUNKS; i++)
+		world->chunks[i].next = i + 1 < WORLD_CHUNKS ? i + 1 : NONE;
+	world->free_list = 0;
+	world->newest = world->oldest = NONE;
+	world->resident = 0;
+	return world;
+}
+
+void world_retain(struct world *world)
+{
+	atomic_fetch_add(&world->refs, 1);
+}
+
+void world_release(struct world *world)
+{
+	if (!world || atomic_fetch_sub(&world->refs, 1) != 1)
+		return;
+	if (world->running) {
+		pthread_mutex_lock(&world->lock);
+		world->stopping = 1;
+		pthread_cond_signal(&world->wake);
+		pthread_mutex_unlock(&world->lock);
+		pthread_join(world->thread, NULL);
+	}
+	pthread_cond_destroy(&world->wake);
+	pthread_mutex_destroy(&world->lock);
+	free(world);
+}
+
+void world_chunk(struct world *world, long cx, long cy, char *tiles)
+{
+	pthread_mutex_lock(&world->lock);
+	memcpy(tiles, fetch(world, cx, cy)->tiles, WORLD_CHUNK_TILES);
+	pthread_mutex_unlock(&world->lock);
+}
+
+/* This thread's copy of chunk (cx, cy), made if it has none. */
+static const char *cached_tiles(struct world *world, long cx, long cy)
+{
+	struct cached_chunk *c;
+
+	for (int i = 0; i < WORLD_CACHED; i++) {
+		c = &cached[i];
+		if (c->serial == world->serial && c->cx == cx && c->cy == cy)
+			return c->tiles;
+	}
+	c = &cached[cached_next++ % WORLD_CACHED];
+	world_chunk(world, cx, cy, c->tiles);
+	c->serial = world->serial;
+	c->cx = cx;
+	c->cy = cy;
+	return c->tiles;
+}
+
+char world_tile(struct world *world, int x, int y)
+{
+	long cx = world_chunk_of(x), cy = world_chunk_of(y);
+
+	return cached_tiles(world, cx, cy)[(y - cy * WORLD_CHUNK) * WORLD_CHUNK + (x - cx * WORLD_CHUNK)];
+}
+
+void world_read_row(struct world *world, long x, long y, char *tiles, size_t n)
+{
+	long cy = world_chunk_of(y);
+
+	while (n) {
+		long        cx = world_chunk_of(x), offset = x - cx * WORLD_CHUNK;
+		size_t      span = (size_t)(WORLD_CHUNK - offset);
+		const char *row = cached_tiles(world, cx, cy) + (y - cy * WORLD_CHUNK) * WORLD_CHUNK;
+
+		if (span > n)
+			span = n;
+		memcpy(tiles, row + offset, span);
+		tiles += span;
+		x += (long)span;
+		n -= span;
+	}
+}
+
+void world_set_focus(struct world *world, int x, int y)
+{
+	long cx = world_chunk_of(x), cy = world_chunk_of(y);
+
+	pthread_mutex_lock(&world->lock);
+	if (!world->running)
+		world->running = !pthread_create(&world->thread, NULL, ahead_main, world);
+	if (!world->focused || cx != world->focus_cx || cy != world->focus_cy) {
+		world->focused = 1;
+		world->focus_cx = cx;
+		world->focus_cy = cy;
+		world->focus_moved = 1;
+		pthread_cond_signal(&world->wake);
+	}
+	pthread_mutex_unlock(&world->lock);
+}
+
+size_t world_resident_chunks(struct world *world)
+{
+	size_t resident;
+
+	pthread_mutex_lock(&world->lock);
+	resident = world->resident;
+	pthread_mutex_unlock(&world->lock);
+	return resident;
+}
@@ -0,0 +1,61 @@
+#ifndef WORLD_H
+#define WORLD_H
+/*
+ *  Copyright 2016 Kendall E. Blake
+ *
+ *  This file is part of cairo-test.
+ *
+ *  cairo-test is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published
+ *  by the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  cairo-test is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with cairo-test.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "generator.h"
+
+/* The unbounded dungeon behind map_new_world(): chunks of the generator's
+ * regions, made from the seed when first looked at and kept in a fixed
+ * pool, so memory stays the same however far the player goes.  A thread
+ * of its own generates the chunks around the focus before they are
+ * needed and lets go of ones far from it; anything else that is needed
+ * and not there is generated on the spot, and when the pool is full the
+ * chunk used longest ago makes way.  A world only ever holds tiles as
+ * generated: changes to them are the maps' business.  Any thread may use
+ * a world. */
+
+#define WORLD_CHUNK       GENERATOR_REGION
+#define WORLD_CHUNK_TILES (WORLD_CHUNK * WORLD_CHUNK)
+#define WORLD_CHUNKS      512   /* the most kept at once */
+#define WORLD_AHEAD       3     /* chunks generated out from the focus's */
+#define WORLD_KEEP        6     /* and those further than this let go */
+
+struct world;
+
+/*@null@*/
+struct world *world_new(uint64_t seed);
+void world_retain(struct world *world);
+void world_release(struct world *world);
+
+/* The chunk holding (x, y), in chunks. */
+long world_chunk_of(long x);
+char world_tile(struct world *world, int x, int y);
+/* Copy n tiles along row y from column x. */
+void world_read_row(struct world *world, long x, long y, char *tiles, size_t n);
+/* Copy out the tiles of chunk (cx, cy), row by row. */
+void world_chunk(struct world *world, long cx, long cy, char *tiles);
+/* Generate ahead around (x, y) from now on. */
+void world_set_focus(struct world *world, int x, int y);
+size_t world_resident_chunks(struct world *world);
+
+#endif